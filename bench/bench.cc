@@ -0,0 +1,580 @@
+/* The entry point of our benchmarks. All benchmarks are registered here.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include "../src/io.hh"
+#include "../src/mesh.hh"
+#include "../src/pipeline.hh"
+#include "../src/raster.hh"
+#include "../src/texture.hh"
+#include "../src/tga.hh"
+#include "../src/transform.hh"
+#include "harness.hh"
+
+struct BenchConfig final {
+    BenchOptions bench {};
+    std::string  assets_dir = "assets/test_images";
+    std::string  out_dir {};   // for written files, defaults to a temp dir
+    size_t       size       = 4096;
+};
+
+static void print_usage(void)
+{
+    fprintf(stderr,
+            "usage: bench_suite [options]\n"
+            "  --json          print results as JSON to stdout\n"
+            "  --filter STR    only run benchmarks whose name contains STR\n"
+            "  --reps N        number of samples per benchmark\n"
+            "  --warmup N      number of samples to discard first\n"
+            "  --min-ms MS     minimum duration of a single sample\n"
+            "  --assets DIR    directory with the TGA files to load\n"
+            "  --out DIR       directory for temporary output files\n"
+            "  --size N        width and height of the synthetic images\n");
+}
+
+static BenchConfig parse_args(int argc, char** argv)
+{
+    BenchConfig config {};
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg { argv[i] };
+        if (arg == "--json") {
+            config.bench.json = true;
+            continue;
+        }
+        if (arg == "--help") {
+            print_usage();
+            exit(0);
+        }
+        if (i + 1 >= argc) {
+            print_usage();
+            fail("missing value for argument `", arg, '\'');
+        }
+
+        const char* value = argv[++i];
+        if      (arg == "--filter") config.bench.filter = value;
+        else if (arg == "--reps")   config.bench.reps = strtoul(value, 0, 10);
+        else if (arg == "--warmup") config.bench.warmup = strtoul(value, 0, 10);
+        else if (arg == "--min-ms") config.bench.min_sample_ms = atof(value);
+        else if (arg == "--assets") config.assets_dir = value;
+        else if (arg == "--out")    config.out_dir = value;
+        else if (arg == "--size")   config.size = strtoul(value, 0, 10);
+        else {
+            print_usage();
+            fail("unknown argument `", arg, '\'');
+        }
+    }
+
+    if (config.size == 0 || config.size > UINT16_MAX)
+        fail("synthetic images must be 1 to ", UINT16_MAX, " pixels wide");
+    if (config.out_dir.empty()) {
+        std::error_code err {};
+        config.out_dir = std::filesystem::temp_directory_path(err).string();
+        if (err) fail("cannot find a temporary directory, use --out");
+    }
+    return config;
+}
+
+static size_t get_pixel_bytes(const TGA& image)
+{
+    return image.get_bytes_width() * image.get_height();
+}
+
+static std::vector<uint8_t> read_file(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) fail("cannot open file `", path, '\'');
+    std::vector<uint8_t> bytes {};
+    uint8_t chunk[4096];
+    size_t  len = 0;
+    while ((len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        bytes.insert(bytes.end(), chunk, chunk + len);
+    fclose(file);
+    return bytes;
+}
+
+/* Loading, decoding from memory and writing every file in the asset
+ * directory covers all image types, pixel depths and origins that we have
+ * test images for. Loads count the bytes of the file, writes those of the
+ * pixel data.
+ */
+static void bench_files(BenchRunner& runner, const BenchConfig& config)
+{
+    std::string out_path = config.out_dir + "/bench_file.tga";
+    for (const auto& [path, info] : TGA::probe_directory(config.assets_dir)) {
+        std::string name   = std::filesystem::path { path }.filename();
+        size_t      pixels = info.width * info.height;
+
+        runner.run("load/" + name, info.file_size, pixels, [&] {
+            TGA image { path };
+            keep_alive(image);
+        });
+
+        LoadOptions mmap {};
+        mmap.use_mmap = true;
+        runner.run("load_mmap/" + name, info.file_size, pixels, [&] {
+            TGA image { path, mmap };
+            keep_alive(image);
+        });
+
+        LoadOptions keep {};
+        keep.keep_origin  = true;
+        keep.keep_indexed = true;
+        runner.run("load_keep/" + name, info.file_size, pixels, [&] {
+            TGA image { path, keep };
+            keep_alive(image);
+        });
+
+        // Only run the setup if anything below is selected.
+        if (!runner.is_any_selected({ "decode/" + name, "write/" + name,
+                                      "write_rle/" + name }))
+            continue;
+
+        std::vector<uint8_t> file = read_file(path);
+        runner.run("decode/" + name, file.size(), pixels, [&] {
+            TGA decoded = TGA::from_memory(file);
+            keep_alive(decoded);
+        });
+
+        TGA    image { path };
+        size_t pixel_bytes = get_pixel_bytes(image);
+        runner.run("write/" + name, pixel_bytes, pixels, [&] {
+            image.write_to_file(out_path, { false, {} });
+        });
+        runner.run("write_rle/" + name, pixel_bytes, pixels, [&] {
+            image.write_to_file(out_path, { true, {} });
+        });
+    }
+
+    std::error_code err {};
+    std::filesystem::remove(out_path, err);
+}
+
+/* A synthetic image that is large enough to not fit into any cache. Bands of
+ * solid color alternate with noise, so that RLE gets both run packets and raw
+ * packets to work with.
+ */
+static TGA make_large_image(size_t size)
+{
+    uint16_t n = static_cast<uint16_t>(size);
+    TGA image { n, n };
+    TGAView<PixelFormat::BGRA8> view = image.view<PixelFormat::BGRA8>();
+    uint32_t state = 0x12345678;
+    for (size_t r = 0; r < size; r++) {
+        for (size_t c = 0; c < size; c++) {
+            if ((c / 64) % 2 == 0) {
+                uint8_t v = static_cast<uint8_t>(r / 16);
+                view.set_pixel(r, c, { v, v, 0x80, 0xff });
+            } else {
+                state = state * 1664525 + 1013904223; // an LCG is noisy enough
+                view.set_pixel(r, c, { static_cast<uint8_t>(state >> 24),
+                                       static_cast<uint8_t>(state >> 16),
+                                       static_cast<uint8_t>(state >> 8),
+                                       0xff });
+            }
+        }
+    }
+    return image;
+}
+
+static void bench_large(BenchRunner& runner, const BenchConfig& config)
+{
+    // Building the image alone takes longer than most benchmarks.
+    if (!runner.is_any_selected({ "large/flip_vertical",
+                                  "large/flip_horizontal",
+                                  "large/flip_vertical_threads",
+                                  "large/fill", "large/fill_rect",
+                                  "large/mip_chain",
+                                  "large/mip_chain_threads",
+                                  "large/write", "large/write_rle",
+                                  "large/load", "large/load_mmap",
+                                  "large/load_threads", "large/load_rle",
+                                  "large/load_rle_threads",
+                                  "large/load_region_rle" }))
+        return;
+
+    TGA    image       = make_large_image(config.size);
+    size_t pixels      = image.get_width() * image.get_height();
+    size_t pixel_bytes = get_pixel_bytes(image);
+    Pixel  color { 0x20, 0x40, 0x60, 0xff };
+
+    // Every call flips once, back and forth.
+    bool flipped = false;
+    runner.run("large/flip_vertical", pixel_bytes, pixels, [&] {
+        image.set_origin(flipped ? Origin::LowerLeft : Origin::UpperLeft);
+        flipped = !flipped;
+    });
+    image.set_origin(Origin::LowerLeft);
+    flipped = false;
+    runner.run("large/flip_horizontal", pixel_bytes, pixels, [&] {
+        image.set_origin(flipped ? Origin::LowerLeft : Origin::LowerRight);
+        flipped = !flipped;
+    });
+    image.set_origin(Origin::LowerLeft);
+    flipped = false;
+    runner.run("large/flip_vertical_threads", pixel_bytes, pixels, [&] {
+        image.set_origin(flipped ? Origin::LowerLeft : Origin::UpperLeft, 0);
+        flipped = !flipped;
+    });
+    image.set_origin(Origin::LowerLeft);
+
+    // The fill benchmarks overwrite the image, so they run on a copy.
+    {
+        TGA    canvas { image };
+        size_t quarter = config.size / 4;
+        size_t rect    = (config.size - 2 * quarter) * (config.size -
+                                                        2 * quarter);
+        runner.run("large/fill", pixel_bytes, pixels, [&] {
+            canvas.fill(color);
+        });
+        runner.run("large/fill_rect", rect * 4, rect, [&] {
+            canvas.fill_rect(quarter, quarter, config.size - quarter,
+                             config.size - quarter, color);
+        });
+    }
+
+    runner.run("large/mip_chain", pixel_bytes, pixels, [&] {
+        std::vector<TGA> levels = image.build_mip_chain();
+        keep_alive(levels);
+    });
+    runner.run("large/mip_chain_threads", pixel_bytes, pixels, [&] {
+        std::vector<TGA> levels = image.build_mip_chain(SIZE_MAX, 0);
+        keep_alive(levels);
+    });
+
+    std::string raw_path = config.out_dir + "/bench_large.tga";
+    std::string rle_path = config.out_dir + "/bench_large_rle.tga";
+    auto remove_files = [&] {
+        std::error_code err {};
+        std::filesystem::remove(raw_path, err);
+        std::filesystem::remove(rle_path, err);
+    };
+    runner.run("large/write", pixel_bytes, pixels, [&] {
+        image.write_to_file(raw_path, { false, {} });
+    });
+    runner.run("large/write_rle", pixel_bytes, pixels, [&] {
+        image.write_to_file(rle_path, { true, {} });
+    });
+    if (!runner.is_any_selected({ "large/load", "large/load_mmap",
+                                  "large/load_threads", "large/load_rle",
+                                  "large/load_rle_threads",
+                                  "large/load_region_rle" })) {
+        remove_files();
+        return;
+    }
+
+    image.write_to_file(raw_path, { false, {} });
+    image.write_to_file(rle_path, { true, {} });
+
+    size_t raw_size = TGA::probe(raw_path).file_size;
+    size_t rle_size = TGA::probe(rle_path).file_size;
+    LoadOptions mmap {};
+    mmap.use_mmap = true;
+    LoadOptions threads {};
+    threads.threads = 0;
+    runner.run("large/load", raw_size, pixels, [&] {
+        TGA loaded { raw_path };
+        keep_alive(loaded);
+    });
+    runner.run("large/load_mmap", raw_size, pixels, [&] {
+        TGA loaded { raw_path, mmap };
+        keep_alive(loaded);
+    });
+    runner.run("large/load_threads", raw_size, pixels, [&] {
+        TGA loaded { raw_path, threads };
+        keep_alive(loaded);
+    });
+    runner.run("large/load_rle", rle_size, pixels, [&] {
+        TGA loaded { rle_path };
+        keep_alive(loaded);
+    });
+    runner.run("large/load_rle_threads", rle_size, pixels, [&] {
+        TGA loaded { rle_path, threads };
+        keep_alive(loaded);
+    });
+
+    size_t region = std::min(config.size, size_t { 256 });
+    size_t at     = (config.size - region) / 2;
+    runner.run("large/load_region_rle", region * region * 4, region * region,
+               [&] {
+        TGA loaded = TGA::load_region(rle_path, at, at, region, region);
+        keep_alive(loaded);
+    });
+    remove_files();
+}
+
+/* A grid of cells, each split into two triangles, covers the image exactly
+ * once. The cells are small enough that most tiles are only partially
+ * covered by any triangle, which exercises the per-pixel edge tests rather
+ * than the span fills.
+ */
+static void bench_raster(BenchRunner& runner, const BenchConfig& config)
+{
+    if (!runner.is_any_selected({ "raster/triangle_grid",
+                                  "raster/triangle_grid_threads",
+                                  "raster/depth_clear",
+                                  "raster/depth_overdraw" }))
+        return;
+
+    uint16_t n = static_cast<uint16_t>(config.size);
+    TGA      canvas { n, n };
+    size_t   pixels = canvas.get_width() * canvas.get_height();
+    float    cell   = 24.0f;
+    size_t   cells  = (config.size + 23) / 24;
+
+    for (size_t threads : { size_t { 1 }, size_t { 0 } }) {
+        Rasterizer raster { canvas, threads };
+        std::string name = threads == 1 ? "raster/triangle_grid"
+                                        : "raster/triangle_grid_threads";
+        runner.run(name, pixels * 4, pixels, [&] {
+            for (size_t r = 0; r < cells; r++) {
+                for (size_t c = 0; c < cells; c++) {
+                    float   x = c * cell, y = r * cell;
+                    uint8_t v = static_cast<uint8_t>(r * 16 + c);
+                    Point2  a { x, y }, b { x + cell, y },
+                            d { x + cell, y + cell }, e { x, y + cell };
+                    raster.draw_triangle(a, b, d, { v, 0x40, 0x80, 0xff });
+                    raster.draw_triangle(a, d, e, { 0x80, v, 0x40, 0xff });
+                }
+            }
+            raster.flush();
+        });
+    }
+
+    DepthBuffer depth { canvas.get_width(), canvas.get_height() };
+    runner.run("raster/depth_clear", pixels * 4, pixels, [&] {
+        depth.clear();
+    });
+
+    /* Layers of a full-screen quad, drawn front to back. All but the first
+     * layer are hidden, which is the best case for the tile bounds.
+     */
+    constexpr size_t LAYERS = 8;
+    Rasterizer raster { canvas, 0 };
+    raster.set_depth_buffer(&depth);
+    float size = static_cast<float>(config.size);
+    runner.run("raster/depth_overdraw", LAYERS * pixels * 4, LAYERS * pixels,
+               [&] {
+        depth.clear();
+        for (size_t i = 0; i < LAYERS; i++) {
+            float   z = (i + 1) / (LAYERS + 1.0f);
+            uint8_t v = static_cast<uint8_t>(i * 32);
+            raster.draw_triangle(Point3 { 0, 0, z }, Point3 { size, 0, z },
+                                 Point3 { size, size, z }, { v, 0, 0, 0xff });
+            raster.draw_triangle(Point3 { 0, 0, z }, Point3 { size, size, z },
+                                 Point3 { 0, size, z }, { v, 0, 0, 0xff });
+        }
+        raster.flush();
+    });
+}
+
+/* Rows of samples that walk a 1024 by 1024 texture at 30 degrees, as a
+ * rotated quad on screen does. Each row is sampled in one batch.
+ */
+static void bench_texture(BenchRunner& runner, const BenchConfig& config)
+{
+    if (!runner.is_any_selected({ "texture/build", "texture/nearest_rotated",
+                                  "texture/bilinear_rotated" }))
+        return;
+
+    TGA     image = make_large_image(1024);
+    Texture texture { image };
+    size_t  n = std::min(config.size, size_t { 1024 });
+
+    std::vector<float>    u(n * n), v(n * n);
+    std::vector<uint32_t> out(n * n);
+    float c = std::cos(0.5236f) / n, s = std::sin(0.5236f) / n;
+    for (size_t y = 0; y < n; y++) {
+        for (size_t x = 0; x < n; x++) {
+            u[y * n + x] = x * c - y * s;
+            v[y * n + x] = x * s + y * c;
+        }
+    }
+
+    runner.run("texture/build", get_pixel_bytes(image),
+               image.get_width() * image.get_height(), [&] {
+        Texture built { image };
+        keep_alive(built);
+    });
+    runner.run("texture/nearest_rotated", n * n * 4, n * n, [&] {
+        for (size_t y = 0; y < n; y++)
+            texture.sample_nearest(&u[y * n], &v[y * n], &out[y * n], n);
+        keep_alive(out);
+    });
+    runner.run("texture/bilinear_rotated", n * n * 4, n * n, [&] {
+        for (size_t y = 0; y < n; y++)
+            texture.sample_bilinear(&u[y * n], &v[y * n], &out[y * n], n);
+        keep_alive(out);
+    });
+}
+
+/* An OBJ text for a grid of N by N quads with positions, texture coordinates
+ * and normals, like an exported height map.
+ */
+static std::string make_grid_obj(size_t n)
+{
+    std::string text {};
+    char line[128];
+    for (size_t r = 0; r <= n; r++) {
+        for (size_t c = 0; c <= n; c++) {
+            float x = static_cast<float>(c) / n, y = static_cast<float>(r) / n;
+            snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\n"
+                     "vn 0.0 0.0 1.0\n", x, y, x * y, x, y);
+            text += line;
+        }
+    }
+    for (size_t r = 0; r < n; r++) {
+        for (size_t c = 0; c < n; c++) {
+            size_t a = r * (n + 1) + c + 1, b = a + n + 1;
+            snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu "
+                     "%zu/%zu/%zu %zu/%zu/%zu\n", a, a, a, a + 1, a + 1, a + 1,
+                     b + 1, b + 1, b + 1, b, b, b);
+            text += line;
+        }
+    }
+    return text;
+}
+
+static void bench_mesh(BenchRunner& runner, const BenchConfig& config)
+{
+    if (!runner.is_any_selected({ "mesh/parse_obj",
+                                  "mesh/parse_obj_threads" }))
+        return;
+    std::string text = make_grid_obj(std::min(config.size, size_t { 512 }));
+    runner.run("mesh/parse_obj", text.size(), 0, [&] {
+        Mesh mesh = Mesh::parse_obj(text);
+        keep_alive(mesh);
+    });
+    runner.run("mesh/parse_obj_threads", text.size(), 0, [&] {
+        Mesh mesh = Mesh::parse_obj(text, 0);
+        keep_alive(mesh);
+    });
+}
+
+/* A grid mesh seen at an angle, so that a part of it is clipped by the near
+ * plane and the rest is drawn with depth.
+ */
+static void bench_transform(BenchRunner& runner, const BenchConfig& config)
+{
+    if (!runner.is_any_selected({ "transform/vertices",
+                                  "transform/vertices_threads",
+                                  "transform/draw_mesh" }))
+        return;
+    Mesh   mesh  = Mesh::parse_obj(make_grid_obj(
+        std::min(config.size, size_t { 512 })));
+    size_t n     = mesh.get_vertex_count();
+    Mat4f  model = translation({ -0.5f, -0.5f, 0.0f });
+    Mat4f  view  = look_at({ 0.0f, -0.6f, 0.3f }, { 0.0f, 0.2f, 0.0f },
+                           { 0.0f, 0.0f, 1.0f });
+    Mat4f  mvp   = perspective(1.2f, 1.0f, 0.1f, 10.0f) * view * model;
+    TransformedVertices out {};
+
+    for (size_t threads : { size_t { 1 }, size_t { 0 } }) {
+        VertexStage stage { mvp, 1024, 1024, threads };
+        std::string name = threads == 1 ? "transform/vertices"
+                                        : "transform/vertices_threads";
+        runner.run(name, n * 3 * sizeof(float), n, [&] {
+            stage.transform(mesh, out);
+            keep_alive(out);
+        });
+    }
+
+    TGA         canvas { 1024, 1024 };
+    DepthBuffer depth { 1024, 1024 };
+    Rasterizer  raster { canvas };
+    VertexStage stage { mvp, 1024, 1024 };
+    raster.set_depth_buffer(&depth);
+    runner.run("transform/draw_mesh", 1024 * 1024 * 4, 1024 * 1024, [&] {
+        depth.clear();
+        stage.transform(mesh, out);
+        draw_triangles(raster, out, mesh.indices, Cull::NONE, [](size_t t) {
+            return Pixel { static_cast<uint8_t>(t), 0x80, 0x40, 0xff };
+        });
+        raster.flush();
+    });
+}
+
+/* Render and write a short RLE animation, once frame after frame and once
+ * through a frame pipeline. The difference is the time spent writing that the
+ * pipeline hides behind rendering.
+ */
+static void bench_pipeline(BenchRunner& runner, const BenchConfig& config)
+{
+    if (!runner.is_any_selected({ "pipeline/frames_serial",
+                                  "pipeline/frames" }))
+        return;
+    constexpr size_t FRAMES = 8;
+    uint16_t     n      = static_cast<uint16_t>(std::min(config.size,
+                                                         size_t { 2048 }));
+    size_t       pixels = size_t { n } * n;
+    WriteOptions rle    { true, {} };
+
+    auto render = [n](TGA& target, size_t frame) {
+        target.fill({ 0, 0, 0, 0xff });
+        Rasterizer raster { target };
+        float      cell = 32.0f, shift = static_cast<float>(frame) * 4.0f;
+        for (float y = 0.0f; y < n; y += cell) {
+            for (float x = 0.0f; x < n; x += cell * 2) {
+                Point2 a { x + shift, y }, b { x + shift + cell, y },
+                       c { x + shift, y + cell };
+                raster.draw_triangle(a, b, c, { 0xff, 0x80, 0x40, 0xff });
+            }
+        }
+        raster.flush();
+    };
+    auto path = [&config](size_t frame) {
+        return config.out_dir + "/bench_frame" + std::to_string(frame) + ".tga";
+    };
+
+    TGA canvas { n, n };
+    runner.run("pipeline/frames_serial", FRAMES * pixels * 4, FRAMES * pixels,
+               [&] {
+        for (size_t f = 0; f < FRAMES; f++) {
+            render(canvas, f);
+            canvas.write_to_file(path(f), rle);
+        }
+    });
+    FramePipeline pipeline { canvas, rle };
+    runner.run("pipeline/frames", FRAMES * pixels * 4, FRAMES * pixels, [&] {
+        for (size_t f = 0; f < FRAMES; f++) {
+            render(pipeline.begin_frame(), f);
+            pipeline.submit_frame(path(f));
+        }
+        pipeline.wait_idle();
+    });
+    pipeline.finish();
+
+    std::error_code err {};
+    for (size_t f = 0; f < FRAMES; f++) std::filesystem::remove(path(f), err);
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig config = parse_args(argc, argv);
+    BenchRunner runner { config.bench };
+    bench_files(runner, config);
+    bench_large(runner, config);
+    bench_raster(runner, config);
+    bench_texture(runner, config);
+    bench_mesh(runner, config);
+    bench_transform(runner, config);
+    bench_pipeline(runner, config);
+    runner.report(stdout);
+    return 0;
+}
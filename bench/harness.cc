@@ -0,0 +1,135 @@
+/* harness.cc implements timing, statistics and reports of benchmarks.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "harness.hh"
+
+using BenchClock = std::chrono::steady_clock;
+
+static double time_calls(const std::function<void(void)>& body, size_t calls)
+{
+    BenchClock::time_point start = BenchClock::now();
+    for (size_t i = 0; i < calls; i++) body();
+    std::chrono::duration<double, std::nano> elapsed = BenchClock::now() -
+                                                       start;
+    return elapsed.count();
+}
+
+void BenchRunner::run(std::string_view name, size_t bytes, size_t pixels,
+                      const std::function<void(void)>& body)
+{
+    if (!this->is_selected(name)) return;
+
+    // Double the batch until a single sample takes long enough.
+    double min_sample_ns = this->options.min_sample_ms * 1e6;
+    size_t calls         = 1;
+    while (time_calls(body, calls) < min_sample_ns && calls < (1 << 20))
+        calls *= 2;
+
+    for (size_t i = 0; i < this->options.warmup; i++) time_calls(body, calls);
+
+    BenchResult result { std::string { name }, bytes, pixels, calls, {} };
+    result.samples.reserve(this->options.reps);
+    for (size_t i = 0; i < std::max(this->options.reps, size_t { 1 }); i++)
+        result.samples.push_back(time_calls(body, calls) / calls);
+    std::sort(result.samples.begin(), result.samples.end());
+
+    // Progress goes to stderr, so that stdout stays machine-readable.
+    if (this->options.json) fprintf(stderr, "%s\n", result.name.c_str());
+    this->results.push_back(std::move(result));
+}
+
+double get_percentile(const std::vector<double>& samples, double p)
+{
+    assert(!samples.empty());
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+    return samples[std::clamp(rank, size_t { 1 }, samples.size()) - 1];
+}
+
+// Throughput is always computed from the median.
+static double per_second(size_t n, const std::vector<double>& samples)
+{
+    return n / (get_percentile(samples, 50.0) * 1e-9);
+}
+
+void BenchRunner::report(FILE* out) const
+{
+    if (this->options.json) this->print_json(out);
+    else                    this->print_text(out);
+}
+
+void BenchRunner::print_text(FILE* out) const
+{
+    fprintf(out, "%-44s %10s %10s %10s %10s %10s\n", "benchmark", "p50 us",
+            "p90 us", "p99 us", "MB/s", "Mpx/s");
+    for (const auto& r : this->results) {
+        fprintf(out, "%-44s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                r.name.c_str(), get_percentile(r.samples, 50.0) / 1e3,
+                get_percentile(r.samples, 90.0) / 1e3,
+                get_percentile(r.samples, 99.0) / 1e3,
+                per_second(r.bytes, r.samples) / 1e6,
+                per_second(r.pixels, r.samples) / 1e6);
+    }
+}
+
+/* Names are file names and fixed strings, but we escape them properly anyway,
+ * so that the output is always valid JSON.
+ */
+static void print_json_string(FILE* out, const std::string& s)
+{
+    fputc('"', out);
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (static_cast<unsigned char>(c) < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+void BenchRunner::print_json(FILE* out) const
+{
+    fprintf(out, "{\n  \"options\": { \"warmup\": %zu, \"reps\": %zu, "
+            "\"min_sample_ms\": %g },\n  \"benchmarks\": [\n",
+            this->options.warmup, this->options.reps,
+            this->options.min_sample_ms);
+    for (size_t i = 0; i < this->results.size(); i++) {
+        const BenchResult&         r = this->results[i];
+        const std::vector<double>& s = r.samples;
+        double mean = 0.0;
+        for (double ns : s) mean += ns / s.size();
+
+        fprintf(out, "    { \"name\": ");
+        print_json_string(out, r.name);
+        fprintf(out, ", \"bytes\": %zu, \"pixels\": %zu, "
+                "\"calls_per_sample\": %zu, \"samples\": %zu,\n"
+                "      \"ns\": { \"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+                "\"p99\": %.1f, \"max\": %.1f, \"mean\": %.1f },\n"
+                "      \"bytes_per_s\": %.1f, \"pixels_per_s\": %.1f }%s\n",
+                r.bytes, r.pixels, r.calls_per_sample, s.size(), s.front(),
+                get_percentile(s, 50.0), get_percentile(s, 90.0),
+                get_percentile(s, 99.0), s.back(), mean,
+                per_second(r.bytes, s), per_second(r.pixels, s),
+                i + 1 < this->results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
@@ -0,0 +1,99 @@
+/* A small harness for timing benchmarks and reporting their throughput.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _HARNESS_HH_
+#define _HARNESS_HH_
+
+#include <cstdio>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/common.hh"
+
+struct BenchOptions final {
+    size_t      warmup        = 2;   // samples that are taken, but not kept
+    size_t      reps          = 15;  // samples that are kept
+    double      min_sample_ms = 2.0; // calls are batched up to this duration
+    bool        json          = false;
+    std::string filter {};           // only run benchmarks containing this
+};
+
+/* Every sample times a batch of calls, so that even calls of a few
+ * microseconds are measured well above the resolution of the clock. SAMPLES
+ * holds the time per call of every kept sample, in nanoseconds. BYTES and
+ * PIXELS are what a single call processes.
+ */
+struct BenchResult final {
+    std::string         name {};
+    size_t              bytes            = 0;
+    size_t              pixels           = 0;
+    size_t              calls_per_sample = 0;
+    std::vector<double> samples {};
+};
+
+class BenchRunner final {
+private:
+    BenchOptions             options;
+    std::vector<BenchResult> results {};
+
+    void print_text(FILE*) const;
+    void print_json(FILE*) const;
+
+public:
+    explicit BenchRunner(const BenchOptions& options) : options { options } {}
+
+    inline bool is_selected(std::string_view name) const
+    {
+        return name.find(this->options.filter) != std::string_view::npos;
+    }
+
+    // Whether the filter selects any of NAMES, to skip unneeded setup.
+    inline bool
+    is_any_selected(std::initializer_list<std::string_view> names) const
+    {
+        for (std::string_view name : names)
+            if (this->is_selected(name)) return true;
+        return false;
+    }
+
+    /* Time BODY, unless the filter doesn't select NAME. The batch size is
+     * calibrated before the warmup samples, which also get caches, page
+     * tables and branch predictors into a steady state.
+     */
+    void run(std::string_view name, size_t bytes, size_t pixels,
+             const std::function<void(void)>& body);
+
+    // Print all results so far, as a table or as JSON.
+    void report(FILE*) const;
+};
+
+/* Keep the compiler from optimizing away a computation whose result isn't
+ * used otherwise.
+ */
+template<typename T>
+inline void keep_alive(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Nearest-rank percentile P (0 to 100) of the sorted, non-empty SAMPLES.
+double get_percentile(const std::vector<double>& samples, double p);
+
+#endif /* _HARNESS_HH_ */
@@ -0,0 +1,246 @@
+/* A byte buffer for pixel data that either owns its storage or aliases a
+ * region of a memory-mapped file or of memory owned by the caller.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _BUFFER_HH_
+#define _BUFFER_HH_
+
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common.hh"
+#include "mmap.hh"
+#include "pool.hh"
+
+/* The interface mirrors the parts of STD::VECTOR that we actually use, so
+ * code working on pixel data doesn't need to care where the bytes live. The
+ * bytes are either owned, possibly as a sub-range of a larger vector (e.g. a
+ * whole file), aliased from a mapping or borrowed from the caller. As soon as
+ * the buffer is resized, it is compacted into owned storage. Copies are always
+ * deep and owned. With a BUFFERPOOL, owned storage comes from and goes back to
+ * the pool.
+ */
+class ImageBuffer final {
+private:
+    std::vector<uint8_t> storage {};
+    MappedFile           mapping {};
+    uint8_t*             ptr      = nullptr;
+    size_t               len      = 0;
+    BufferPool*          pool     = nullptr;
+    bool                 borrowed = false;
+
+    /* Only vectors that hold exactly our pixels go back to the pool. Others,
+     * like a whole file that was adopted, would never fit a later request
+     * for pixels and only take up room in the pool.
+     */
+    void release_storage(void)
+    {
+        if (this->pool != nullptr && this->storage.capacity() == this->len)
+            this->pool->release(std::move(this->storage));
+        this->storage = {};
+    }
+
+public:
+    ImageBuffer(void) = default;
+
+    ImageBuffer(const ImageBuffer& other)
+        : storage {}, mapping {}, ptr { nullptr }, len { other.size() },
+          pool { other.pool }, borrowed { false }
+    {
+        this->storage = this->allocate(this->len);
+        if (this->len > 0)
+            memcpy(this->storage.data(), other.data(), this->len);
+        this->ptr = this->storage.data();
+    }
+
+    // Moving a vector keeps its heap buffer, so PTR stays valid.
+    ImageBuffer(ImageBuffer&& other) noexcept
+        : storage { std::move(other.storage) },
+          mapping { std::move(other.mapping) },
+          ptr { std::exchange(other.ptr, nullptr) },
+          len { std::exchange(other.len, 0) },
+          pool { other.pool },
+          borrowed { std::exchange(other.borrowed, false) }
+    {
+    }
+
+    ImageBuffer& operator=(const ImageBuffer& other)
+    {
+        if (this != &other) *this = ImageBuffer { other };
+        return *this;
+    }
+
+    ImageBuffer& operator=(ImageBuffer&& other) noexcept
+    {
+        if (this != &other) {
+            this->release_storage();
+            this->storage = std::move(other.storage);
+            this->mapping = std::move(other.mapping);
+            this->ptr     = std::exchange(other.ptr, nullptr);
+            this->len     = std::exchange(other.len, 0);
+            this->pool    = other.pool;
+            this->borrowed = std::exchange(other.borrowed, false);
+        }
+        return *this;
+    }
+
+    ~ImageBuffer(void) { this->release_storage(); }
+
+    // Only affects storage that is allocated from now on.
+    inline void use_pool(BufferPool* pool) { this->pool = pool; }
+
+    /* Allocate N bytes with unspecified contents the same way this buffer
+     * does, e.g. for new pixel data that is adopted later on.
+     */
+    std::vector<uint8_t> allocate(size_t n)
+    {
+        if (this->pool != nullptr) return this->pool->acquire(n);
+        return std::vector<uint8_t>(n);
+    }
+
+    /* Alias N bytes at OFFSET of a mapped file. The buffer takes ownership of
+     * the mapping and keeps it alive for as long as the pixels are used.
+     */
+    void alias(MappedFile&& file, size_t offset, size_t n)
+    {
+        assert(offset + n <= file.size());
+        this->release_storage();
+        this->mapping  = std::move(file);
+        this->ptr      = this->mapping.data() + offset;
+        this->len      = n;
+        this->borrowed = false;
+    }
+
+    /* Alias N bytes at DATA that the caller owns. They must outlive the
+     * buffer (or its next resize), and writes go straight to them.
+     */
+    void borrow(uint8_t* data, size_t n)
+    {
+        this->release_storage();
+        this->mapping  = MappedFile {};
+        this->ptr      = data;
+        this->len      = n;
+        this->borrowed = true;
+    }
+
+    // Take over an owned vector without copying its contents.
+    void adopt(std::vector<uint8_t>&& bytes)
+    {
+        size_t n = bytes.size();
+        this->adopt(std::move(bytes), 0, n);
+    }
+
+    // Like ALIAS, but for N bytes at OFFSET of an owned vector.
+    void adopt(std::vector<uint8_t>&& bytes, size_t offset, size_t n)
+    {
+        assert(offset + n <= bytes.size());
+        this->release_storage();
+        this->storage = std::move(bytes);
+        this->mapping  = MappedFile {};
+        this->ptr      = this->storage.data() + offset;
+        this->len      = n;
+        this->borrowed = false;
+    }
+
+    // Hand the bytes back as a vector, copying them only if they aren't owned.
+    std::vector<uint8_t> release(void)
+    {
+        this->compact();
+        std::vector<uint8_t> bytes { std::move(this->storage) };
+        this->storage = {};
+        this->ptr     = nullptr;
+        this->len     = 0;
+        return bytes;
+    }
+
+    // Copy aliased or borrowed bytes into owned storage.
+    void materialize(void)
+    {
+        if (!this->is_mapped() && !this->borrowed) return;
+        this->storage = this->allocate(this->len);
+        if (this->len > 0) memcpy(this->storage.data(), this->ptr, this->len);
+        this->mapping  = MappedFile {};
+        this->ptr      = this->storage.data();
+        this->borrowed = false;
+    }
+
+    /* Make sure the bytes start at a multiple of ALIGNMENT, at most that of
+     * the allocator, by moving or copying them into owned storage.
+     */
+    void align(size_t alignment)
+    {
+        assert(alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        if (reinterpret_cast<uintptr_t>(this->ptr) % alignment == 0) return;
+        this->materialize();
+        this->compact();
+    }
+
+    // Make sure that STORAGE holds exactly our bytes, starting at index 0.
+    void compact(void)
+    {
+        this->materialize();
+        if (this->ptr == this->storage.data() &&
+            this->len == this->storage.size())
+            return;
+        memmove(this->storage.data(), this->ptr, this->len);
+        this->storage.resize(this->len);
+        this->ptr = this->storage.data();
+    }
+
+    void resize(size_t n, uint8_t value = 0)
+    {
+        this->compact();
+        if (this->pool != nullptr && this->storage.capacity() < n) {
+            std::vector<uint8_t> bigger = this->allocate(n);
+            if (this->len > 0)
+                memcpy(bigger.data(), this->storage.data(), this->len);
+            memset(bigger.data() + this->len, value, n - this->len);
+            this->release_storage();
+            this->storage = std::move(bigger);
+        }
+        this->storage.resize(n, value);
+        this->ptr = this->storage.data();
+        this->len = n;
+    }
+
+    void clear(void)
+    {
+        this->storage.clear();
+        this->mapping  = MappedFile {};
+        this->ptr      = this->storage.data();
+        this->len      = 0;
+        this->borrowed = false;
+    }
+
+    inline bool is_mapped(void)   const { return this->mapping.is_mapped(); }
+    inline bool is_borrowed(void) const { return this->borrowed; }
+
+    inline uint8_t*       data(void)       { return this->ptr; }
+    inline const uint8_t* data(void) const { return this->ptr; }
+    inline size_t         size(void) const { return this->len; }
+
+    inline uint8_t& operator[](size_t i)       { return this->ptr[i]; }
+    inline uint8_t  operator[](size_t i) const { return this->ptr[i]; }
+};
+
+// Images move their pixels around a lot, see TGA.
+static_assert(std::is_nothrow_move_constructible_v<ImageBuffer> &&
+              std::is_nothrow_move_assignable_v<ImageBuffer>);
+
+#endif /* _BUFFER_HH_ */
@@ -0,0 +1,65 @@
+/* depth.cc implements clearing and bookkeeping of tiled depth buffers.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "depth.hh"
+#include "kernels.hh"
+
+DepthBuffer::DepthBuffer(size_t width, size_t height, float value)
+    : width { width }, height { height },
+      tiles_x { (width + TILE_SIZE - 1) / TILE_SIZE },
+      tiles_y { (height + TILE_SIZE - 1) / TILE_SIZE }
+{
+    this->depths.resize(this->get_tile_count() * TILE_PIXELS);
+    this->tile_min.resize(this->get_tile_count());
+    this->tile_max.resize(this->get_tile_count());
+    this->clear(value);
+}
+
+// Floats are 4 byte pixels as far as BROADCAST_PIXEL is concerned.
+void DepthBuffer::clear(float value)
+{
+    uint8_t pattern[sizeof(float)];
+    memcpy(pattern, &value, sizeof(pattern));
+    broadcast_pixel(reinterpret_cast<uint8_t*>(this->depths.data()), pattern,
+                    this->depths.size(), sizeof(pattern));
+    std::fill(this->tile_min.begin(), this->tile_min.end(), value);
+    std::fill(this->tile_max.begin(), this->tile_max.end(), value);
+}
+
+/* Padding keeps the value of the last clear, usually the far plane. Counting
+ * it would keep tiles at the border from ever being culled.
+ */
+void DepthBuffer::update_tile_bounds(size_t tile)
+{
+    size_t x0 = (tile % this->tiles_x) * TILE_SIZE;
+    size_t y0 = (tile / this->tiles_x) * TILE_SIZE;
+    size_t w  = std::min(TILE_SIZE, this->width - x0);
+    size_t h  = std::min(TILE_SIZE, this->height - y0);
+
+    const float* data = this->tile_data(tile);
+    float min = data[0], max = data[0];
+    for (size_t y = 0; y < h; y++) {
+        for (size_t x = 0; x < w; x++) {
+            min = std::min(min, data[y * TILE_SIZE + x]);
+            max = std::max(max, data[y * TILE_SIZE + x]);
+        }
+    }
+    this->set_tile_bounds(tile, min, max);
+}
@@ -0,0 +1,108 @@
+/* A tiled depth buffer with a per-tile min/max hierarchy.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _DEPTH_HH_
+#define _DEPTH_HH_
+
+#include <vector>
+
+#include "common.hh"
+
+/* A DEPTHBUFFER stores one float per pixel, where smaller values are closer.
+ * Depths aren't stored row by row, but one tile of TILE_SIZE by TILE_SIZE
+ * pixels after the other, so that a tile is a single contiguous block of
+ * 16 KiB. Tiles at the right and top borders are padded to the full size.
+ *
+ * For every tile, the buffer keeps the smallest and largest depth it holds
+ * (Hi-Z). Whatever is farther than the largest depth of a tile is hidden in
+ * all of it, and whatever is closer than the smallest is visible everywhere.
+ * Pixel coordinates use the same lower-left origin as the TGA it belongs to.
+ */
+class DepthBuffer final {
+public:
+    static constexpr size_t TILE_SIZE   = 64;
+    static constexpr size_t TILE_PIXELS = TILE_SIZE * TILE_SIZE;
+
+private:
+    size_t             width;
+    size_t             height;
+    size_t             tiles_x;
+    size_t             tiles_y;
+    std::vector<float> depths {};
+    std::vector<float> tile_min {};
+    std::vector<float> tile_max {};
+
+public:
+    DepthBuffer(size_t width, size_t height, float = 1.0f);
+
+    /* Set every depth to VALUE. The padding is cleared as well, which
+     * keeps this a single bulk fill.
+     */
+    void clear(float = 1.0f);
+
+    inline size_t get_width(void) const      { return this->width; }
+    inline size_t get_height(void) const     { return this->height; }
+    inline size_t get_tile_count(void) const
+    {
+        return this->tiles_x * this->tiles_y;
+    }
+
+    // The tile that holds pixel (X, Y), counting rows of tiles from below.
+    inline size_t get_tile(size_t x, size_t y) const
+    {
+        return (y / TILE_SIZE) * this->tiles_x + x / TILE_SIZE;
+    }
+
+    inline float get_depth(size_t x, size_t y) const
+    {
+        assert(x < this->width && y < this->height);
+        return this->depths[this->get_tile(x, y) * TILE_PIXELS +
+                            (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+    }
+
+    /* The depths of TILE, with each row of the tile TILE_SIZE floats after
+     * the previous one.
+     */
+    inline float* tile_data(size_t tile)
+    {
+        assert(tile < this->get_tile_count());
+        return this->depths.data() + tile * TILE_PIXELS;
+    }
+
+    inline float get_tile_min(size_t tile) const
+    {
+        return this->tile_min[tile];
+    }
+    inline float get_tile_max(size_t tile) const
+    {
+        return this->tile_max[tile];
+    }
+
+    /* Whoever writes to TILE_DATA must keep the bounds conservative, i.e.
+     * MIN must not be larger and MAX not smaller than any depth of the tile.
+     */
+    inline void set_tile_bounds(size_t tile, float min, float max)
+    {
+        this->tile_min[tile] = min;
+        this->tile_max[tile] = max;
+    }
+
+    // Recompute the exact bounds of a tile from its depths.
+    void update_tile_bounds(size_t tile);
+};
+
+#endif /* _DEPTH_HH_ */
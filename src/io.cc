@@ -0,0 +1,192 @@
+/* io.cc implements the instrumentation registry and its reports.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "io.hh"
+
+class InstrumentRegistry final {
+private:
+    std::mutex                                    mutex {};
+    std::vector<std::unique_ptr<InstrumentBlock>> blocks {};
+    std::vector<InstrumentBlock*>                 unused {};
+
+public:
+    const std::chrono::steady_clock::time_point epoch {
+        std::chrono::steady_clock::now()
+    };
+    std::atomic<bool> tracing { false };
+
+    static inline InstrumentRegistry& get(void)
+    {
+        static InstrumentRegistry registry {};
+        return registry;
+    }
+
+    InstrumentBlock* acquire(void)
+    {
+        std::lock_guard<std::mutex> lock { this->mutex };
+        if (!this->unused.empty()) {
+            InstrumentBlock* block = this->unused.back();
+            this->unused.pop_back();
+            return block;
+        }
+        this->blocks.push_back(
+            std::make_unique<InstrumentBlock>(this->blocks.size()));
+        return this->blocks.back().get();
+    }
+
+    void release(InstrumentBlock* block)
+    {
+        std::lock_guard<std::mutex> lock { this->mutex };
+        this->unused.push_back(block);
+    }
+
+    // Call F(BLOCK) for all blocks, including those of exited threads.
+    template<typename F>
+    void for_each(F&& f)
+    {
+        std::lock_guard<std::mutex> lock { this->mutex };
+        for (auto& block : this->blocks) f(*block);
+    }
+
+    inline uint64_t now_ns(void) const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - this->epoch).count();
+    }
+};
+
+InstrumentBlock& get_instrument_block(void)
+{
+    struct Handle final {
+        InstrumentBlock* block = InstrumentRegistry::get().acquire();
+        Handle(void) = default;
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+        ~Handle(void) { InstrumentRegistry::get().release(this->block); }
+    };
+    thread_local Handle handle {};
+    return *handle.block;
+}
+
+uint64_t get_instrument_time(void)
+{
+    return InstrumentRegistry::get().now_ns();
+}
+
+void add_trace_event(InstrumentBlock& block, uint64_t start_ns,
+                     uint64_t duration, Timer timer)
+{
+    if (!InstrumentRegistry::get().tracing.load(std::memory_order_relaxed))
+        return;
+    size_t n = block.n_events.load(std::memory_order_relaxed);
+    if (n == InstrumentBlock::MAX_EVENTS) return;
+    if (!block.events)
+        block.events = new InstrumentBlock::Event[InstrumentBlock::MAX_EVENTS];
+    block.events[n] = { start_ns, duration, timer };
+    block.n_events.store(n + 1, std::memory_order_release);
+}
+
+void set_tracing(bool on)
+{
+    InstrumentRegistry::get().tracing.store(on, std::memory_order_relaxed);
+}
+
+void write_instrumentation_summary(std::ostream& os)
+{
+    std::array<uint64_t, COUNTERS> counts {};
+    std::array<uint64_t, TIMERS>   calls {}, nanoseconds {};
+    InstrumentRegistry::get().for_each([&](InstrumentBlock& block) {
+        for (size_t i = 0; i < COUNTERS; i++)
+            counts[i] += block.counts[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < TIMERS; i++) {
+            calls[i] += block.calls[i].load(std::memory_order_relaxed);
+            nanoseconds[i] +=
+                block.nanoseconds[i].load(std::memory_order_relaxed);
+        }
+    });
+
+    os << std::left << std::setw(24) << "counter" << "total\n";
+    for (size_t i = 0; i < COUNTERS; i++)
+        os << std::setw(24) << COUNTER_NAMES[i] << counts[i] << '\n';
+    os << '\n' << std::setw(24) << "timer" << std::setw(12) << "calls"
+       << std::setw(14) << "total ms" << "mean us\n";
+    for (size_t i = 0; i < TIMERS; i++) {
+        double ms   = static_cast<double>(nanoseconds[i]) / 1e6;
+        double mean = calls[i] ? ms * 1e3 / static_cast<double>(calls[i]) : 0;
+        os << std::setw(24) << TIMER_NAMES[i] << std::setw(12) << calls[i]
+           << std::fixed << std::setprecision(3) << std::setw(14) << ms
+           << mean << '\n';
+    }
+    os << std::defaultfloat << std::right;
+}
+
+void write_chrome_trace(std::string_view path)
+{
+    std::ofstream out { std::string { path } };
+    if (!out) fail("cannot open file `", path, '\'');
+
+    out << "{\"traceEvents\":[";
+    const char* sep = "\n";
+    uint64_t    end_ns = 0;
+    std::array<uint64_t, COUNTERS> counts {};
+    InstrumentRegistry::get().for_each([&](InstrumentBlock& block) {
+        size_t n = block.n_events.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; i++) {
+            const InstrumentBlock::Event& e = block.events[i];
+            out << sep << "{\"name\":\""
+                << TIMER_NAMES[static_cast<size_t>(e.timer)]
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << block.id
+                << ",\"ts\":" << e.start_ns / 1000 << '.' << std::setw(3)
+                << std::setfill('0') << e.start_ns % 1000 << std::setfill(' ')
+                << ",\"dur\":" << e.duration_ns / 1000 << '.' << std::setw(3)
+                << std::setfill('0') << e.duration_ns % 1000
+                << std::setfill(' ') << '}';
+            sep    = ",\n";
+            end_ns = std::max(end_ns, e.start_ns + e.duration_ns);
+        }
+        for (size_t i = 0; i < COUNTERS; i++)
+            counts[i] += block.counts[i].load(std::memory_order_relaxed);
+    });
+    for (size_t i = 0; i < COUNTERS; i++) {
+        out << sep << "{\"name\":\"" << COUNTER_NAMES[i]
+            << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << end_ns / 1000
+            << ",\"args\":{\"value\":" << counts[i] << "}}";
+        sep = ",\n";
+    }
+    out << "\n]}\n";
+    if (!out) fail("cannot write file `", path, '\'');
+}
+
+void reset_instrumentation(void)
+{
+    InstrumentRegistry::get().for_each([](InstrumentBlock& block) {
+        for (auto& count : block.counts) count.store(0);
+        for (auto& calls : block.calls) calls.store(0);
+        for (auto& ns : block.nanoseconds) ns.store(0);
+        block.n_events.store(0);
+    });
+}
@@ -1,5 +1,5 @@
-/* A header-only library providing common I/O routines and a basic logger
- * class.
+/* A header-only library providing common I/O routines, a basic logger class
+ * and counters and timers for instrumentation.
  *
  * renderer Copyright (C) 2021 Daniel Schuette
  *
@@ -19,7 +19,10 @@
 #ifndef _IO_HH_
 #define _IO_HH_
 
+#include <array>
+#include <atomic>
 #include <iostream>
+#include <string_view>
 
 #include "common.hh"
 
@@ -70,4 +73,150 @@ public:
     void log(Ts&&... args) { warn(args...); }
 };
 
+/* Instrumentation is compiled in with -DINSTRUMENT. Otherwise, ADD_COUNT and
+ * SCOPEDTIMER compile to nothing, so release builds don't pay for them.
+ */
+#ifdef INSTRUMENT
+constexpr bool INSTRUMENTATION_ON = true;
+#else
+constexpr bool INSTRUMENTATION_ON = false;
+#endif
+
+enum class Counter : uint8_t {
+    BytesDecoded,          // pixel data bytes of loaded images
+    RlePackets,            // RLE packets decoded
+    PixelsWritten,         // pixels written to files or memory
+    TrianglesRasterized,   // triangles drawn by a RASTERIZER
+    Count,
+};
+
+enum class Timer : uint8_t {
+    Load,
+    Write,
+    FlipVertical,
+    FlipHorizontal,
+    Rasterize,
+    Count,
+};
+
+constexpr size_t COUNTERS = static_cast<size_t>(Counter::Count);
+constexpr size_t TIMERS   = static_cast<size_t>(Timer::Count);
+
+constexpr std::array<const char*, COUNTERS> COUNTER_NAMES {
+    "bytes_decoded", "rle_packets", "pixels_written", "triangles_rasterized",
+};
+constexpr std::array<const char*, TIMERS> TIMER_NAMES {
+    "load", "write", "flip_vertical", "flip_horizontal", "rasterize",
+};
+
+/* Every thread accumulates into a block of its own, so recording never
+ * contends with other threads. Only the owning thread writes to a block,
+ * thus plain loads and stores of relaxed atomics do (there's no locked
+ * instruction), and other threads can still read the totals at any time.
+ * Blocks are kept once their thread exits and handed to the next new one.
+ * They are managed in io.cc, which also has the reports below.
+ */
+struct InstrumentBlock final {
+    struct Event final {
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        Timer    timer;
+    };
+
+    static constexpr size_t MAX_EVENTS = size_t { 1 } << 16;
+
+    size_t                                      id;
+    std::array<std::atomic<uint64_t>, COUNTERS> counts {};
+    std::array<std::atomic<uint64_t>, TIMERS>   calls {};
+    std::array<std::atomic<uint64_t>, TIMERS>   nanoseconds {};
+
+    // Trace events, allocated on the first one. EVENTS[0, N_EVENTS) are set.
+    Event*              events = nullptr;
+    std::atomic<size_t> n_events { 0 };
+
+    explicit InstrumentBlock(size_t id) : id { id } {}
+    InstrumentBlock(const InstrumentBlock&) = delete;
+    InstrumentBlock(InstrumentBlock&&)      = delete;
+    InstrumentBlock& operator=(const InstrumentBlock&) = delete;
+    InstrumentBlock& operator=(InstrumentBlock&&)      = delete;
+    ~InstrumentBlock(void) { delete[] this->events; }
+
+    static inline void add(std::atomic<uint64_t>& a, uint64_t n)
+    {
+        a.store(a.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+};
+
+// The block of the calling thread.
+InstrumentBlock& get_instrument_block(void);
+
+// Nanoseconds since the program started.
+uint64_t get_instrument_time(void);
+
+// Add a trace event to BLOCK, if tracing is on and there's room left.
+void add_trace_event(InstrumentBlock&, uint64_t, uint64_t, Timer);
+
+template<bool on = INSTRUMENTATION_ON>
+inline void add_count(Counter counter, uint64_t n = 1)
+{
+    if constexpr (on) {
+        InstrumentBlock::add(
+            get_instrument_block().counts[static_cast<size_t>(counter)], n);
+    }
+}
+
+/* A SCOPEDTIMER adds the time from its construction to its destruction to
+ * its TIMER, and records a trace event if tracing is enabled.
+ */
+template<bool on = INSTRUMENTATION_ON>
+class BasicScopedTimer final {
+private:
+    Timer    timer;
+    uint64_t start_ns = 0;
+
+public:
+    explicit BasicScopedTimer(Timer timer) : timer { timer }
+    {
+        if constexpr (on) this->start_ns = get_instrument_time();
+    }
+    BasicScopedTimer(const BasicScopedTimer&) = delete;
+    BasicScopedTimer(BasicScopedTimer&&)      = delete;
+    BasicScopedTimer& operator=(const BasicScopedTimer&) = delete;
+    BasicScopedTimer& operator=(BasicScopedTimer&&)      = delete;
+
+    ~BasicScopedTimer(void)
+    {
+        if constexpr (on) {
+            InstrumentBlock& block    = get_instrument_block();
+            uint64_t         duration = get_instrument_time() - this->start_ns;
+            size_t           t        = static_cast<size_t>(this->timer);
+            InstrumentBlock::add(block.calls[t], 1);
+            InstrumentBlock::add(block.nanoseconds[t], duration);
+            add_trace_event(block, this->start_ns, duration, this->timer);
+        }
+    }
+};
+
+using ScopedTimer = BasicScopedTimer<>;
+
+/* Trace events are only recorded while tracing is on, at most
+ * INSTRUMENTBLOCK::MAX_EVENTS per thread.
+ */
+void set_tracing(bool);
+
+// Print the totals of all counters and timers, over all threads.
+void write_instrumentation_summary(std::ostream& = std::cerr);
+
+/* Write all trace events, and the final value of every counter, to PATH in
+ * the Chrome trace event format (chrome://tracing, Perfetto). Threads that
+ * are still recording events may or may not have their latest ones in it.
+ */
+void write_chrome_trace(std::string_view);
+
+/* Set all counters and timers back to zero and drop all trace events. Must
+ * not run while other threads record anything.
+ */
+void reset_instrumentation(void);
+
 #endif /* _IO_HH_ */
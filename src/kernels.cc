@@ -0,0 +1,501 @@
+/* kernels.cc implements bulk operations on rows of packed pixels.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#include "kernels.hh"
+
+/* 48 bytes hold a whole number of 1, 2, 3 and 4 byte pixels and are exactly
+ * three 16 byte vectors. Thus, once a pixel is broadcast into a pattern of
+ * that size, we can repeat the pattern with full-width vector stores and
+ * never split a pixel, not even for the tail.
+ */
+static constexpr size_t PATTERN_LEN = 48;
+
+template<size_t BPP>
+static void broadcast_pattern(uint8_t* dst, const uint8_t* pixel, size_t n)
+{
+    constexpr size_t PATTERN_PIXELS = PATTERN_LEN / BPP;
+    static_assert(PATTERN_LEN % BPP == 0);
+
+    // Short runs are the common case in RLE data, don't build a pattern.
+    if (n < PATTERN_PIXELS) {
+        for (size_t i = 0; i < n; i++) memcpy(dst + i*BPP, pixel, BPP);
+        return;
+    }
+
+    alignas(16) uint8_t pattern[PATTERN_LEN];
+    for (size_t i = 0; i < PATTERN_PIXELS; i++)
+        memcpy(pattern + i*BPP, pixel, BPP);
+
+    size_t len = n * BPP;
+    size_t pos = 0;
+#ifdef __SSE2__
+    __m128i v0 = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern));
+    __m128i v1 = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern+16));
+    __m128i v2 = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern+32));
+    for (; pos + PATTERN_LEN <= len; pos += PATTERN_LEN) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos +  0), v0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos + 16), v1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos + 32), v2);
+    }
+#else
+    for (; pos + PATTERN_LEN <= len; pos += PATTERN_LEN)
+        memcpy(dst + pos, pattern, PATTERN_LEN);
+#endif
+    memcpy(dst + pos, pattern, len - pos);
+}
+
+void broadcast_pixel(uint8_t* dst, const uint8_t* pixel, size_t n,
+                     size_t bytes_per_pixel)
+{
+    switch (bytes_per_pixel) {
+    case 1:  memset(dst, *pixel, n);               return;
+    case 2:  broadcast_pattern<2>(dst, pixel, n);  return;
+    case 3:  broadcast_pattern<3>(dst, pixel, n);  return;
+    case 4:  broadcast_pattern<4>(dst, pixel, n);  return;
+    default:
+        for (size_t i = 0; i < n; i++)
+            memcpy(dst + i*bytes_per_pixel, pixel, bytes_per_pixel);
+    }
+}
+
+template<size_t BPP>
+static void reverse_scalar(uint8_t* lo, uint8_t* hi, size_t bpp)
+{
+    const size_t stride = BPP != 0 ? BPP : bpp;
+    uint8_t tmp[32];  // pixels are at most 255 bits wide
+    while (lo < hi) {
+        memcpy(tmp, lo, stride);
+        memcpy(lo, hi, stride);
+        memcpy(hi, tmp, stride);
+        lo += stride;
+        hi -= stride;
+    }
+}
+
+/* LO and HI point to the first and last pixel of the range to reverse. For
+ * 4 byte pixels, a single PSHUFD reverses four pixels at once, so we swap 16
+ * byte blocks from both ends until they'd overlap.
+ */
+static void reverse_bgra(uint8_t* lo, uint8_t* hi)
+{
+#ifdef __SSE2__
+    while (hi - lo >= 28) {
+        __m128i* l = reinterpret_cast<__m128i*>(lo);
+        __m128i* h = reinterpret_cast<__m128i*>(hi - 12);
+        __m128i  a = _mm_loadu_si128(l);
+        __m128i  b = _mm_loadu_si128(h);
+        _mm_storeu_si128(l, _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3)));
+        _mm_storeu_si128(h, _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 1, 2, 3)));
+        lo += 16;
+        hi -= 16;
+    }
+#endif
+    reverse_scalar<4>(lo, hi, 4);
+}
+
+void reverse_pixels(uint8_t* row, size_t n, size_t bytes_per_pixel)
+{
+    if (n < 2) return;
+    uint8_t* lo = row;
+    uint8_t* hi = row + (n - 1) * bytes_per_pixel;
+    switch (bytes_per_pixel) {
+    case 3:  reverse_scalar<3>(lo, hi, 3);               return;
+    case 4:  reverse_bgra(lo, hi);                       return;
+    default: reverse_scalar<0>(lo, hi, bytes_per_pixel); return;
+    }
+}
+
+/* Rows are swapped in blocks of a single cache line. The temporary block
+ * stays in L1 (or registers) and both rows are streamed front to back.
+ */
+void swap_bytes(uint8_t* a, uint8_t* b, size_t len)
+{
+    constexpr size_t BLOCK = 64;
+    alignas(BLOCK) uint8_t tmp[BLOCK];
+
+    size_t pos = 0;
+    for (; pos + BLOCK <= len; pos += BLOCK) {
+        memcpy(tmp, a + pos, BLOCK);
+        memcpy(a + pos, b + pos, BLOCK);
+        memcpy(b + pos, tmp, BLOCK);
+    }
+    size_t rest = len - pos;
+    memcpy(tmp, a + pos, rest);
+    memcpy(a + pos, b + pos, rest);
+    memcpy(b + pos, tmp, rest);
+}
+
+void expand_indexed(uint8_t* dst, const uint8_t* src, size_t n,
+                    const uint32_t* lut, size_t index_bytes)
+{
+    uint32_t pixel;
+    if (index_bytes == 2) {
+        for (size_t i = 0; i < n; i++) {
+            pixel = lut[src[2*i] | (src[2*i + 1] << 8)];
+            memcpy(dst + 4*i, &pixel, sizeof(pixel));
+        }
+        return;
+    }
+
+    size_t i = 0;
+#ifdef __AVX2__
+    const int* base = reinterpret_cast<const int*>(lut);
+    for (; i + 8 <= n; i += 8) {
+        __m128i bytes   = _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(src + i));
+        __m256i indices = _mm256_cvtepu8_epi32(bytes);
+        __m256i pixels  = _mm256_i32gather_epi32(base, indices, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4*i), pixels);
+    }
+#endif
+    for (; i < n; i++) {
+        pixel = lut[src[i]];
+        memcpy(dst + 4*i, &pixel, sizeof(pixel));
+    }
+}
+
+/* Interleaving a vector of gray bytes G with itself gives GG pairs, and with
+ * 0xff (or the alpha bytes) gives GA pairs. Interleaving those once more
+ * yields G G G A, i.e. a BGRA pixel, for 16 (or 8) pixels at a time.
+ */
+void expand_gray(uint8_t* dst, const uint8_t* src, size_t n, bool has_alpha)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    if (has_alpha) {
+        const __m128i lo = _mm_set1_epi16(0x00ff);
+        for (; i + 8 <= n; i += 8) {
+            __m128i ga = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(src + 2*i));
+            __m128i g  = _mm_and_si128(ga, lo);
+            __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+            __m128i* out = reinterpret_cast<__m128i*>(dst + 4*i);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg, ga));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg, ga));
+        }
+    } else {
+        const __m128i opaque = _mm_set1_epi8(static_cast<char>(0xff));
+        for (; i + 16 <= n; i += 16) {
+            __m128i g  = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(src + i));
+            __m128i gg_lo = _mm_unpacklo_epi8(g, g);
+            __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+            __m128i ga_lo = _mm_unpacklo_epi8(g, opaque);
+            __m128i ga_hi = _mm_unpackhi_epi8(g, opaque);
+            __m128i* out = reinterpret_cast<__m128i*>(dst + 4*i);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg_lo, ga_lo));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg_lo, ga_lo));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(gg_hi, ga_hi));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(gg_hi, ga_hi));
+        }
+    }
+#endif
+    size_t stride = has_alpha ? 2 : 1;
+    for (; i < n; i++) {
+        uint8_t g = src[stride*i];
+        dst[4*i + 0] = g;
+        dst[4*i + 1] = g;
+        dst[4*i + 2] = g;
+        dst[4*i + 3] = has_alpha ? src[stride*i + 1] : 0xff;
+    }
+}
+
+static void downsample_scalar(uint8_t* dst, const uint8_t* row0,
+                              const uint8_t* row1, size_t begin, size_t end,
+                              size_t src_width, size_t bpp)
+{
+    for (size_t x = begin; x < end; x++) {
+        size_t left  = 2*x * bpp;
+        size_t right = src_width > 1 ? left + bpp : left;
+        for (size_t c = 0; c < bpp; c++) {
+            unsigned sum = row0[left + c] + row0[right + c] +
+                           row1[left + c] + row1[right + c];
+            dst[x*bpp + c] = static_cast<uint8_t>((sum + 2) >> 2);
+        }
+    }
+}
+
+/* Sums are formed in 16 bit lanes. For gray pixels, every lane of the input
+ * already holds a horizontal pair, so masking and shifting adds them up. For
+ * BGRA pixels, adding the low and high halves of the widened vectors adds up
+ * neighbouring pixels.
+ */
+void downsample_2x2(uint8_t* dst, const uint8_t* row0, const uint8_t* row1,
+                    size_t dst_width, size_t src_width,
+                    size_t bytes_per_pixel)
+{
+    size_t x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two  = _mm_set1_epi16(2);
+    auto load = [](const uint8_t* p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    };
+
+    if (bytes_per_pixel == 1) {
+        const __m128i lo = _mm_set1_epi16(0x00ff);
+        auto pairs = [lo](__m128i v) {
+            return _mm_add_epi16(_mm_and_si128(v, lo), _mm_srli_epi16(v, 8));
+        };
+        for (; x + 16 <= dst_width; x += 16) {
+            const uint8_t* a = row0 + 2*x;
+            const uint8_t* b = row1 + 2*x;
+            __m128i s0 = _mm_add_epi16(pairs(load(a)), pairs(load(b)));
+            __m128i s1 = _mm_add_epi16(pairs(load(a + 16)),
+                                       pairs(load(b + 16)));
+            s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+            s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                             _mm_packus_epi16(s0, s1));
+        }
+    } else if (bytes_per_pixel == 4) {
+        auto sum4 = [zero, two](__m128i a, __m128i b) {
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                       _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                       _mm_unpackhi_epi8(b, zero));
+            __m128i s  = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+                                       _mm_unpackhi_epi64(lo, hi));
+            return _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+        };
+        for (; x + 4 <= dst_width; x += 4) {
+            const uint8_t* a = row0 + 8*x;
+            const uint8_t* b = row1 + 8*x;
+            __m128i s0 = sum4(load(a), load(b));
+            __m128i s1 = sum4(load(a + 16), load(b + 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4*x),
+                             _mm_packus_epi16(s0, s1));
+        }
+    }
+#endif
+    downsample_scalar(dst, row0, row1, x, dst_width, src_width,
+                      bytes_per_pixel);
+}
+
+/* Lanes are evaluated in wrapping unsigned arithmetic. Within the N pixels,
+ * the values are known to fit, but stepping past the last vector may
+ * overflow, which must not be undefined behaviour.
+ */
+static inline int32_t step_edge(int32_t e, int32_t step, size_t k)
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(e) +
+                                static_cast<uint32_t>(step) * k);
+}
+
+void fill_covered(uint32_t* dst, ptrdiff_t row_step, size_t width,
+                  size_t height, const int32_t* edges, const int32_t* steps_x,
+                  const int32_t* steps_y, uint32_t color)
+{
+#if defined(__AVX2__)
+    const __m256i color8 = _mm256_set1_epi32(static_cast<int>(color));
+    const __m256i none   = _mm256_set1_epi32(-1);
+    __m256i lanes[3], step8[3];
+    for (size_t k = 0; k < 3; k++) {
+        int32_t s = steps_x[k];
+        lanes[k] = _mm256_setr_epi32(0, s, step_edge(0, s, 2),
+                                     step_edge(0, s, 3), step_edge(0, s, 4),
+                                     step_edge(0, s, 5), step_edge(0, s, 6),
+                                     step_edge(0, s, 7));
+        step8[k] = _mm256_set1_epi32(step_edge(0, s, 8));
+    }
+#elif defined(__SSE2__)
+    const __m128i color4 = _mm_set1_epi32(static_cast<int>(color));
+    const __m128i none   = _mm_set1_epi32(-1);
+    __m128i lanes[3], step4[3];
+    for (size_t k = 0; k < 3; k++) {
+        int32_t s = steps_x[k];
+        lanes[k] = _mm_setr_epi32(0, s, step_edge(0, s, 2),
+                                  step_edge(0, s, 3));
+        step4[k] = _mm_set1_epi32(step_edge(0, s, 4));
+    }
+#endif
+
+    int32_t row_edges[3] = { edges[0], edges[1], edges[2] };
+    for (size_t y = 0; y < height; y++, dst += row_step) {
+        size_t i = 0;
+#if defined(__AVX2__)
+        __m256i e[3];
+        for (size_t k = 0; k < 3; k++)
+            e[k] = _mm256_add_epi32(_mm256_set1_epi32(row_edges[k]),
+                                    lanes[k]);
+        for (; i + 8 <= width; i += 8) {
+            __m256i any    = _mm256_or_si256(_mm256_or_si256(e[0], e[1]),
+                                             e[2]);
+            __m256i inside = _mm256_cmpgt_epi32(any, none);
+            int     mask   = _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+            __m256i* out   = reinterpret_cast<__m256i*>(dst + i);
+            if (mask == 0xff)
+                _mm256_storeu_si256(out, color8);
+            else if (mask != 0)
+                _mm256_storeu_si256(out, _mm256_blendv_epi8(
+                    _mm256_loadu_si256(out), color8, inside));
+            for (size_t k = 0; k < 3; k++)
+                e[k] = _mm256_add_epi32(e[k], step8[k]);
+        }
+#elif defined(__SSE2__)
+        __m128i e[3];
+        for (size_t k = 0; k < 3; k++)
+            e[k] = _mm_add_epi32(_mm_set1_epi32(row_edges[k]), lanes[k]);
+        for (; i + 4 <= width; i += 4) {
+            __m128i any    = _mm_or_si128(_mm_or_si128(e[0], e[1]), e[2]);
+            __m128i inside = _mm_cmpgt_epi32(any, none);
+            int     mask   = _mm_movemask_ps(_mm_castsi128_ps(inside));
+            __m128i* out   = reinterpret_cast<__m128i*>(dst + i);
+            if (mask == 0xf)
+                _mm_storeu_si128(out, color4);
+            else if (mask != 0)
+                _mm_storeu_si128(out, _mm_or_si128(
+                    _mm_and_si128(inside, color4),
+                    _mm_andnot_si128(inside, _mm_loadu_si128(out))));
+            for (size_t k = 0; k < 3; k++)
+                e[k] = _mm_add_epi32(e[k], step4[k]);
+        }
+#endif
+        int32_t e0 = step_edge(row_edges[0], steps_x[0], i);
+        int32_t e1 = step_edge(row_edges[1], steps_x[1], i);
+        int32_t e2 = step_edge(row_edges[2], steps_x[2], i);
+        for (; i < width; i++) {
+            if ((e0 | e1 | e2) >= 0) dst[i] = color;
+            e0 = step_edge(e0, steps_x[0], 1);
+            e1 = step_edge(e1, steps_x[1], 1);
+            e2 = step_edge(e2, steps_x[2], 1);
+        }
+        for (size_t k = 0; k < 3; k++)
+            row_edges[k] = step_edge(row_edges[k], steps_y[k], 1);
+    }
+}
+
+// The outcode bits of clip coordinates X, Y and Z against W.
+static inline uint8_t get_outcode(float x, float y, float z, float w)
+{
+    return static_cast<uint8_t>((x < -w) | (x > w) << 1 | (y < -w) << 2 |
+                                (y > w) << 3 | (z < -w) << 4 | (z > w) << 5);
+}
+
+void transform_vertices(const float* matrix, const float* const* position,
+                        size_t n, float width, float height,
+                        float* const* clip, float* const* screen,
+                        uint8_t* outcodes)
+{
+    const float* m = matrix;
+    const float  half_w = width / 2.0f, half_h = height / 2.0f;
+    size_t i = 0;
+#if defined(__AVX__)
+    __m256 m8[16];
+    for (size_t k = 0; k < 16; k++) m8[k] = _mm256_set1_ps(m[k]);
+    const __m256 hw8 = _mm256_set1_ps(half_w), hh8 = _mm256_set1_ps(half_h);
+    const __m256 half8 = _mm256_set1_ps(0.5f), one8 = _mm256_set1_ps(1.0f);
+    __m256 bit8[6];
+    for (size_t k = 0; k < 6; k++)
+        bit8[k] = _mm256_castsi256_ps(_mm256_set1_epi32(1 << k));
+    for (; i + 8 <= n; i += 8) {
+        __m256 p[3], c[4];
+        for (size_t k = 0; k < 3; k++) p[k] = _mm256_loadu_ps(position[k] + i);
+        for (size_t r = 0; r < 4; r++) {
+            const __m256* row = m8 + 4 * r;
+            c[r] = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(row[0], p[0]),
+                              _mm256_mul_ps(row[1], p[1])),
+                _mm256_add_ps(_mm256_mul_ps(row[2], p[2]), row[3]));
+            _mm256_storeu_ps(clip[r] + i, c[r]);
+        }
+
+        __m256 inv_w = _mm256_div_ps(one8, c[3]);
+        _mm256_storeu_ps(screen[0] + i, _mm256_add_ps(_mm256_mul_ps(
+            _mm256_mul_ps(c[0], inv_w), hw8), hw8));
+        _mm256_storeu_ps(screen[1] + i, _mm256_add_ps(_mm256_mul_ps(
+            _mm256_mul_ps(c[1], inv_w), hh8), hh8));
+        _mm256_storeu_ps(screen[2] + i, _mm256_add_ps(_mm256_mul_ps(
+            _mm256_mul_ps(c[2], inv_w), half8), half8));
+
+        __m256 neg_w = _mm256_sub_ps(_mm256_setzero_ps(), c[3]);
+        __m256 code  = _mm256_setzero_ps();
+        for (size_t k = 0; k < 3; k++) {
+            __m256 below = _mm256_cmp_ps(c[k], neg_w, _CMP_LT_OQ);
+            __m256 above = _mm256_cmp_ps(c[k], c[3], _CMP_GT_OQ);
+            code = _mm256_or_ps(code, _mm256_and_ps(below, bit8[2 * k]));
+            code = _mm256_or_ps(code, _mm256_and_ps(above, bit8[2 * k + 1]));
+        }
+        __m128i words = _mm_packs_epi32(
+            _mm_castps_si128(_mm256_castps256_ps128(code)),
+            _mm_castps_si128(_mm256_extractf128_ps(code, 1)));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(outcodes + i),
+                         _mm_packus_epi16(words, words));
+    }
+#elif defined(__SSE2__)
+    __m128 m4[16];
+    for (size_t k = 0; k < 16; k++) m4[k] = _mm_set1_ps(m[k]);
+    const __m128 hw4 = _mm_set1_ps(half_w), hh4 = _mm_set1_ps(half_h);
+    const __m128 half4 = _mm_set1_ps(0.5f), one4 = _mm_set1_ps(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 p[3], c[4];
+        for (size_t k = 0; k < 3; k++) p[k] = _mm_loadu_ps(position[k] + i);
+        for (size_t r = 0; r < 4; r++) {
+            const __m128* row = m4 + 4 * r;
+            c[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[0], p[0]),
+                                         _mm_mul_ps(row[1], p[1])),
+                              _mm_add_ps(_mm_mul_ps(row[2], p[2]), row[3]));
+            _mm_storeu_ps(clip[r] + i, c[r]);
+        }
+
+        __m128 inv_w = _mm_div_ps(one4, c[3]);
+        _mm_storeu_ps(screen[0] + i, _mm_add_ps(_mm_mul_ps(
+            _mm_mul_ps(c[0], inv_w), hw4), hw4));
+        _mm_storeu_ps(screen[1] + i, _mm_add_ps(_mm_mul_ps(
+            _mm_mul_ps(c[1], inv_w), hh4), hh4));
+        _mm_storeu_ps(screen[2] + i, _mm_add_ps(_mm_mul_ps(
+            _mm_mul_ps(c[2], inv_w), half4), half4));
+
+        __m128  neg_w = _mm_sub_ps(_mm_setzero_ps(), c[3]);
+        __m128i code  = _mm_setzero_si128();
+        for (size_t k = 0; k < 3; k++) {
+            __m128i below = _mm_castps_si128(_mm_cmplt_ps(c[k], neg_w));
+            __m128i above = _mm_castps_si128(_mm_cmpgt_ps(c[k], c[3]));
+            code = _mm_or_si128(code, _mm_and_si128(
+                below, _mm_set1_epi32(1 << (2 * k))));
+            code = _mm_or_si128(code, _mm_and_si128(
+                above, _mm_set1_epi32(2 << (2 * k))));
+        }
+        __m128i words = _mm_packs_epi32(code, code);
+        int     bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        memcpy(outcodes + i, &bytes, 4);
+    }
+#endif
+    for (; i < n; i++) {
+        float p[3] = { position[0][i], position[1][i], position[2][i] };
+        float c[4];
+        for (size_t r = 0; r < 4; r++) {
+            const float* row = m + 4 * r;
+            c[r] = (row[0] * p[0] + row[1] * p[1]) + (row[2] * p[2] + row[3]);
+            clip[r][i] = c[r];
+        }
+        float inv_w = 1.0f / c[3];
+        screen[0][i] = c[0] * inv_w * half_w + half_w;
+        screen[1][i] = c[1] * inv_w * half_h + half_h;
+        screen[2][i] = c[2] * inv_w * 0.5f + 0.5f;
+        outcodes[i]  = get_outcode(c[0], c[1], c[2], c[3]);
+    }
+}
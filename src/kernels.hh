@@ -0,0 +1,91 @@
+/* Bulk pixel kernels that are shared by the TGA decoder, encoder and the
+ * image manipulation routines.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _KERNELS_HH_
+#define _KERNELS_HH_
+
+#include <cstddef>
+
+#include "common.hh"
+
+/* Write the BYTES_PER_PIXEL bytes at PIXEL to N consecutive pixels at DST.
+ * Pixels of 1, 2, 3 and 4 bytes are broadcast into a SIMD-width pattern
+ * first, other widths are copied one pixel at a time.
+ */
+void broadcast_pixel(uint8_t* dst, const uint8_t* pixel, size_t n,
+                     size_t bytes_per_pixel);
+
+/* Reverse the order of the N pixels of BYTES_PER_PIXEL bytes each at ROW, in
+ * place. The bytes within each pixel keep their order.
+ */
+void reverse_pixels(uint8_t* row, size_t n, size_t bytes_per_pixel);
+
+// Swap the LEN bytes at A with the LEN bytes at B. The ranges must not overlap.
+void swap_bytes(uint8_t* a, uint8_t* b, size_t len);
+
+/* Expand N color map indices of INDEX_BYTES (1 or 2) bytes each at SRC into
+ * 4 byte BGRA pixels at DST. LUT maps every possible index to a pixel, stored
+ * as little-endian B | G << 8 | R << 16 | A << 24, so there are no bounds
+ * checks. With AVX2, 8 pixels are looked up by a single gather.
+ */
+void expand_indexed(uint8_t* dst, const uint8_t* src, size_t n,
+                    const uint32_t* lut, size_t index_bytes);
+
+/* Expand N gray-scale pixels at SRC into 4 byte BGRA pixels at DST. With
+ * HAS_ALPHA, every source pixel is a gray byte followed by an alpha byte,
+ * otherwise the pixels are opaque.
+ */
+void expand_gray(uint8_t* dst, const uint8_t* src, size_t n, bool has_alpha);
+
+/* Average every 2 by 2 block of pixels from the scanlines ROW0 and ROW1 into
+ * one of the DST_WIDTH pixels at DST, rounding to nearest. Both rows have
+ * SRC_WIDTH pixels of BYTES_PER_PIXEL bytes, one byte per channel. Usually,
+ * SRC_WIDTH is at least twice DST_WIDTH; a single column is used twice. Gray
+ * and BGRA pixels are averaged 16 and 4 at a time.
+ */
+void downsample_2x2(uint8_t* dst, const uint8_t* row0, const uint8_t* row1,
+                    size_t dst_width, size_t src_width,
+                    size_t bytes_per_pixel);
+
+/* Write COLOR to those pixels of a WIDTH by HEIGHT block that are inside all
+ * three edges of a triangle, i.e. whose edge values are non-negative. DST is
+ * the first pixel of the first row, and ROW_STEP the distance between rows,
+ * in pixels. EDGES are the values at the first pixel, STEPS_X and STEPS_Y
+ * their change from one pixel to the next. The caller makes sure that the
+ * values of all pixels in the block fit into 32 bits. With AVX2, 8 pixels are
+ * tested at a time, otherwise 4 with SSE2.
+ */
+void fill_covered(uint32_t* dst, ptrdiff_t row_step, size_t width,
+                  size_t height, const int32_t* edges, const int32_t* steps_x,
+                  const int32_t* steps_y, uint32_t color);
+
+/* Transform N positions (X, Y, Z, 1), whose coordinates are in the arrays
+ * POSITION[0] to POSITION[2], by the row-major 4 by 4 MATRIX. The results go
+ * to CLIP[0] to CLIP[3] as X, Y, Z and W of clip space. Their perspective
+ * divide, mapped onto a WIDTH by HEIGHT viewport with depths from 0 to 1,
+ * goes to SCREEN[0] to SCREEN[2]; it's only meaningful for visible points.
+ * Bit 2K of an outcode is set if clip coordinate K is below -W, and bit
+ * 2K + 1 if it is above W. With AVX, 8 positions are done at a time,
+ * otherwise 4 with SSE2.
+ */
+void transform_vertices(const float* matrix, const float* const* position,
+                        size_t n, float width, float height,
+                        float* const* clip, float* const* screen,
+                        uint8_t* outcodes);
+
+#endif /* _KERNELS_HH_ */
@@ -0,0 +1,65 @@
+/* linalg.cc implements the transforms that need trigonometry.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+
+#include "io.hh"
+#include "linalg.hh"
+
+// Rodrigues' rotation formula, written out as a matrix.
+Mat4f rotation(const Vec3f& axis, float angle)
+{
+    Vec3f a = normalize(axis);
+    float c = std::cos(angle), s = std::sin(angle), t = 1.0f - c;
+    return { {
+        { t * a[0] * a[0] + c, t * a[0] * a[1] - s * a[2],
+          t * a[0] * a[2] + s * a[1], 0.0f },
+        { t * a[0] * a[1] + s * a[2], t * a[1] * a[1] + c,
+          t * a[1] * a[2] - s * a[0], 0.0f },
+        { t * a[0] * a[2] - s * a[1], t * a[1] * a[2] + s * a[0],
+          t * a[2] * a[2] + c, 0.0f },
+        { 0.0f, 0.0f, 0.0f, 1.0f },
+    } };
+}
+
+Mat4f look_at(const Vec3f& eye, const Vec3f& center, const Vec3f& up)
+{
+    Vec3f f = normalize(center - eye);
+    Vec3f s = normalize(cross(f, up));
+    Vec3f u = cross(s, f);
+    return { {
+        { s[0], s[1], s[2], -dot(s, eye) },
+        { u[0], u[1], u[2], -dot(u, eye) },
+        { -f[0], -f[1], -f[2], dot(f, eye) },
+        { 0.0f, 0.0f, 0.0f, 1.0f },
+    } };
+}
+
+Mat4f perspective(float fov_y, float aspect, float near, float far)
+{
+    if (!(near > 0.0f && far > near && aspect > 0.0f))
+        fail("invalid perspective with near ", near, ", far ", far,
+             " and aspect ", aspect);
+    float f = 1.0f / std::tan(fov_y / 2.0f);
+    return { {
+        { f / aspect, 0.0f, 0.0f, 0.0f },
+        { 0.0f, f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, (far + near) / (near - far),
+          2.0f * far * near / (near - far) },
+        { 0.0f, 0.0f, -1.0f, 0.0f },
+    } };
+}
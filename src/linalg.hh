@@ -0,0 +1,186 @@
+/* Small vectors and matrices for transforming geometry.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LINALG_HH_
+#define _LINALG_HH_
+
+#include <cmath>
+
+#include "common.hh"
+
+/* A VEC is an aggregate, so VEC3F { 1, 2, 3 } just works. Everything that
+ * doesn't need a square root or a trigonometric function is constexpr.
+ */
+template<typename T, size_t N>
+struct Vec final {
+    T data[N] {};
+
+    constexpr T&       operator[](size_t i)       { return this->data[i]; }
+    constexpr const T& operator[](size_t i) const { return this->data[i]; }
+
+    constexpr Vec operator+(const Vec& other) const
+    {
+        Vec out {};
+        for (size_t i = 0; i < N; i++) out[i] = this->data[i] + other[i];
+        return out;
+    }
+
+    constexpr Vec operator-(const Vec& other) const
+    {
+        Vec out {};
+        for (size_t i = 0; i < N; i++) out[i] = this->data[i] - other[i];
+        return out;
+    }
+
+    constexpr Vec operator-(void) const
+    {
+        Vec out {};
+        for (size_t i = 0; i < N; i++) out[i] = -this->data[i];
+        return out;
+    }
+
+    constexpr Vec operator*(T s) const
+    {
+        Vec out {};
+        for (size_t i = 0; i < N; i++) out[i] = this->data[i] * s;
+        return out;
+    }
+
+    constexpr Vec operator/(T s) const
+    {
+        Vec out {};
+        for (size_t i = 0; i < N; i++) out[i] = this->data[i] / s;
+        return out;
+    }
+
+    constexpr bool operator==(const Vec&) const = default;
+};
+
+template<typename T, size_t N>
+constexpr T dot(const Vec<T, N>& a, const Vec<T, N>& b)
+{
+    T sum {};
+    for (size_t i = 0; i < N; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+template<typename T>
+constexpr Vec<T, 3> cross(const Vec<T, 3>& a, const Vec<T, 3>& b)
+{
+    return { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+             a[0] * b[1] - a[1] * b[0] };
+}
+
+template<typename T, size_t N>
+inline T length(const Vec<T, N>& a)
+{
+    return std::sqrt(dot(a, a));
+}
+
+// A zero vector stays zero instead of turning into NaNs.
+template<typename T, size_t N>
+inline Vec<T, N> normalize(const Vec<T, N>& a)
+{
+    T len = length(a);
+    return len > T {} ? a / len : a;
+}
+
+/* A MAT is an array of R rows with C columns each, and transforms column
+ * vectors, i.e. M * V. Thus, in A * B * V, B is applied first.
+ */
+template<typename T, size_t R, size_t C>
+struct Mat final {
+    Vec<T, C> rows[R] {};
+
+    constexpr Vec<T, C>& operator[](size_t r) { return this->rows[r]; }
+    constexpr const Vec<T, C>& operator[](size_t r) const
+    {
+        return this->rows[r];
+    }
+
+    static constexpr Mat identity(void)
+    {
+        static_assert(R == C, "only square matrices have an identity");
+        Mat out {};
+        for (size_t i = 0; i < R; i++) out[i][i] = T { 1 };
+        return out;
+    }
+
+    template<size_t K>
+    constexpr Mat<T, R, K> operator*(const Mat<T, C, K>& other) const
+    {
+        Mat<T, R, K> out {};
+        for (size_t r = 0; r < R; r++)
+            for (size_t k = 0; k < K; k++)
+                for (size_t c = 0; c < C; c++)
+                    out[r][k] += this->rows[r][c] * other[c][k];
+        return out;
+    }
+
+    constexpr Vec<T, R> operator*(const Vec<T, C>& v) const
+    {
+        Vec<T, R> out {};
+        for (size_t r = 0; r < R; r++) out[r] = dot(this->rows[r], v);
+        return out;
+    }
+
+    constexpr Mat<T, C, R> transposed(void) const
+    {
+        Mat<T, C, R> out {};
+        for (size_t r = 0; r < R; r++)
+            for (size_t c = 0; c < C; c++) out[c][r] = this->rows[r][c];
+        return out;
+    }
+
+    constexpr bool operator==(const Mat&) const = default;
+};
+
+using Vec2f = Vec<float, 2>;
+using Vec3f = Vec<float, 3>;
+using Vec4f = Vec<float, 4>;
+using Mat3f = Mat<float, 3, 3>;
+using Mat4f = Mat<float, 4, 4>;
+
+constexpr Mat4f translation(const Vec3f& t)
+{
+    Mat4f m = Mat4f::identity();
+    for (size_t i = 0; i < 3; i++) m[i][3] = t[i];
+    return m;
+}
+
+constexpr Mat4f scaling(const Vec3f& s)
+{
+    Mat4f m = Mat4f::identity();
+    for (size_t i = 0; i < 3; i++) m[i][i] = s[i];
+    return m;
+}
+
+// A counter-clockwise rotation by ANGLE radians around AXIS.
+Mat4f rotation(const Vec3f& axis, float angle);
+
+/* A camera at EYE that looks at CENTER, with UP pointing up on screen. The
+ * camera looks down its negative Z axis, as in OpenGL.
+ */
+Mat4f look_at(const Vec3f& eye, const Vec3f& center, const Vec3f& up);
+
+/* Map the view frustum with a vertical field of view of FOV_Y radians onto
+ * clip space, where visible points have -W <= X, Y, Z <= W. Z = -W is the
+ * NEAR plane and Z = W the FAR plane.
+ */
+Mat4f perspective(float fov_y, float aspect, float near, float far);
+
+#endif /* _LINALG_HH_ */
@@ -0,0 +1,150 @@
+/* loader.cc implements a thread pool that loads many TGA files at once.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "io.hh"
+#include "loader.hh"
+
+TGALoader::TGALoader(const BatchOptions& options)
+    : options { options }
+{
+    size_t io_threads     = std::max(size_t { 1 }, options.io_threads);
+    size_t decode_threads = resolve_threads(options.decode_threads);
+
+    this->io_workers.reserve(io_threads);
+    for (size_t i = 0; i < io_threads; i++)
+        this->io_workers.emplace_back([this] { this->run_io(); });
+
+    this->decode_workers.reserve(decode_threads);
+    for (size_t i = 0; i < decode_threads; i++)
+        this->decode_workers.emplace_back([this] { this->run_decode(); });
+}
+
+/* Closing the queues in pipeline order lets each stage drain: I/O threads exit
+ * once no more paths are queued, and only then can no more loaded files show
+ * up for the decode threads.
+ */
+TGALoader::~TGALoader(void)
+{
+    this->io_queue.close();
+    for (auto& worker : this->io_workers) worker.join();
+    this->decode_queue.close();
+    for (auto& worker : this->decode_workers) worker.join();
+}
+
+std::future<TGA> TGALoader::load(std::string_view filepath)
+{
+    Job job { std::string { filepath }, std::promise<TGA> {} };
+    std::future<TGA> future = job.promise.get_future();
+    this->io_queue.push(std::move(job));
+    return future;
+}
+
+std::vector<std::future<TGA>>
+TGALoader::load_many(std::span<const std::string> paths)
+{
+    std::vector<std::future<TGA>> futures {};
+    futures.reserve(paths.size());
+    for (const auto& path : paths) futures.push_back(this->load(path));
+    return futures;
+}
+
+/* A file larger than the whole budget would wait forever, so it may start as
+ * soon as nothing else is in flight.
+ */
+void TGALoader::acquire_budget(size_t n)
+{
+    std::unique_lock<std::mutex> lock { this->budget_mutex };
+    this->budget_cv.wait(lock, [this, n] {
+        return this->bytes_in_flight == 0 ||
+               this->bytes_in_flight + n <= this->options.max_bytes_in_flight;
+    });
+    this->bytes_in_flight += n;
+}
+
+void TGALoader::release_budget(size_t n)
+{
+    {
+        std::lock_guard<std::mutex> lock { this->budget_mutex };
+        this->bytes_in_flight -= n;
+    }
+    this->budget_cv.notify_all();
+}
+
+void TGALoader::run_io(void)
+{
+    while (std::optional<Job> job = this->io_queue.pop()) {
+        const char* path = job->path.c_str();
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) fail("cannot open file `", job->path, '\'');
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) fail("cannot stat file `", job->path, '\'');
+        size_t len = st.st_size;
+
+        this->acquire_budget(len);
+        LoadedJob loaded { std::move(*job), len, MappedFile {}, {} };
+        if (this->options.load.use_mmap) {
+            loaded.mapping = MappedFile { fd, len, loaded.job.path };
+            close(fd);
+            loaded.mapping.prefetch();
+        } else {
+            loaded.bytes.resize(len);
+            size_t pos = 0;
+            while (pos < len) {
+                ssize_t ret = pread(fd, loaded.bytes.data() + pos, len - pos,
+                                    pos);
+                if (ret <= 0) fail("cannot read file `", loaded.job.path, '\'');
+                pos += ret;
+            }
+            close(fd);
+        }
+        this->decode_queue.push(std::move(loaded));
+    }
+}
+
+void TGALoader::run_decode(void)
+{
+    while (std::optional<LoadedJob> loaded = this->decode_queue.pop()) {
+        const LoadOptions& load = this->options.load;
+        size_t len = loaded->len;
+        if (load.use_mmap) {
+            TGA image { std::move(loaded->mapping), load };
+            this->release_budget(len);
+            loaded->job.promise.set_value(std::move(image));
+        } else {
+            TGA image { std::move(loaded->bytes), load };
+            this->release_budget(len);
+            loaded->job.promise.set_value(std::move(image));
+        }
+    }
+}
+
+std::vector<TGA> TGA::load_many(std::span<const std::string> paths,
+                                const BatchOptions& options)
+{
+    TGALoader loader { options };
+    std::vector<std::future<TGA>> futures = loader.load_many(paths);
+
+    std::vector<TGA> images {};
+    images.reserve(futures.size());
+    for (auto& future : futures) images.push_back(future.get());
+    return images;
+}
@@ -0,0 +1,88 @@
+/* Batch loading of many TGA files, with file I/O and decoding running on
+ * separate pools of threads.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LOADER_HH_
+#define _LOADER_HH_
+
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hh"
+#include "mmap.hh"
+#include "parallel.hh"
+#include "tga.hh"
+
+/* A TGALOADER pipelines the loading of many files: while decode threads work
+ * on one file, I/O threads already read (or map and fault in) the next ones.
+ * Files whose bytes are loaded but not yet decoded count towards a budget of
+ * BATCH_OPTIONS.MAX_BYTES_IN_FLIGHT, so a long list of paths doesn't read
+ * everything into memory before decoding catches up. Files are loaded in the
+ * order they were submitted, but may finish in any order.
+ *
+ * @NOTE: Errors are fatal just like everywhere else (see io.hh), so a broken
+ * file ends the program instead of a single future.
+ */
+class TGALoader final {
+private:
+    struct Job final {
+        std::string       path;
+        std::promise<TGA> promise;
+    };
+
+    // A job whose file is in memory, either mapped or read into BYTES.
+    struct LoadedJob final {
+        Job                  job;
+        size_t               len;
+        MappedFile           mapping;
+        std::vector<uint8_t> bytes;
+    };
+
+    BatchOptions             options;
+    WorkQueue<Job>           io_queue {};
+    WorkQueue<LoadedJob>     decode_queue {};
+    std::mutex               budget_mutex {};
+    std::condition_variable  budget_cv {};
+    size_t                   bytes_in_flight = 0;
+    std::vector<std::thread> io_workers {};
+    std::vector<std::thread> decode_workers {};
+
+    void run_io(void);
+    void run_decode(void);
+    void acquire_budget(size_t);
+    void release_budget(size_t);
+
+public:
+    explicit TGALoader(const BatchOptions& = {});
+    TGALoader(const TGALoader&) = delete;
+    TGALoader(TGALoader&&)      = delete;
+    TGALoader& operator=(const TGALoader&) = delete;
+    TGALoader& operator=(TGALoader&&)      = delete;
+
+    // Waits for all submitted files to be loaded.
+    ~TGALoader(void);
+
+    std::future<TGA> load(std::string_view);
+    std::vector<std::future<TGA>> load_many(std::span<const std::string>);
+};
+
+#endif /* _LOADER_HH_ */
@@ -16,6 +16,7 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 #include "io.hh"
+#include "raster.hh"
 #include "tga.hh"
 
 int main(int argc, char** argv)
@@ -29,12 +30,14 @@ int main(int argc, char** argv)
 
     {
         TGA tga_file { 600, 400, Pixel { 0xff, 0, 0, 0xff } };
-        for (size_t col = 0; col < 600; col++) {
-            tga_file.set_pixel(75, col, { 0, 0, 0xff, 0xff });
-            tga_file.set_pixel(150, col, { 0, 0, 0xff, 0xff });
-        }
+        Rasterizer raster { tga_file };
+        raster.draw_line(0, 75, 599, 75, { 0, 0, 0xff, 0xff });
+        raster.draw_line(0, 150, 599, 150, { 0, 0, 0xff, 0xff });
+        raster.flush();
         tga_file.write_to_file("outfile1.tga");
     }
 
+    if constexpr (INSTRUMENTATION_ON) write_instrumentation_summary();
+
     return 0;
 }
@@ -0,0 +1,333 @@
+/* mesh.cc implements parsing of Wavefront OBJ files into meshes.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+
+#include "io.hh"
+#include "mesh.hh"
+#include "mmap.hh"
+#include "parallel.hh"
+
+// Chunks smaller than this aren't worth a thread of their own.
+static constexpr size_t MIN_CHUNK_BYTES = size_t { 1 } << 20;
+
+// Face corners refer to positions, texture coordinates and normals.
+static constexpr size_t ATTRIBS = 3;
+static constexpr int64_t MISSING = INT64_MIN;
+
+/* A face corner as written in the file. Indices are 0-based. Negative
+ * indices in the file count back from the last element so far; those are
+ * turned into indices relative to the start of the chunk and flagged in
+ * RELATIVE, because the chunk doesn't know how many elements came before it.
+ */
+struct Corner final {
+    std::array<int64_t, ATTRIBS> index;
+    uint8_t                      relative;
+};
+
+struct ObjChunk final {
+    std::vector<float>  positions {}; // x, y, z
+    std::vector<float>  uvs {};       // u, v
+    std::vector<float>  normals {};   // x, y, z
+    std::vector<Corner> corners {};   // three per triangle
+};
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Parses the values of a single line. LINE is only kept for error
+ * messages, REST is what hasn't been parsed yet.
+ */
+class LineParser final {
+private:
+    std::string_view line;
+    std::string_view rest;
+
+    inline const char* begin(void) const { return this->rest.data(); }
+    inline const char* end(void) const
+    {
+        return this->rest.data() + this->rest.size();
+    }
+    inline void advance_to(const char* next)
+    {
+        this->rest.remove_prefix(next - this->begin());
+    }
+
+public:
+    LineParser(std::string_view line, size_t offset)
+        : line { line }, rest { line.substr(offset) }
+    {
+    }
+
+    [[noreturn]] void fail_malformed(void) const
+    {
+        fail("malformed OBJ line `", this->line, '\'');
+    }
+
+    // Skip blanks and report whether anything but a comment is left.
+    inline bool has_more(void)
+    {
+        while (!this->rest.empty() && is_blank(this->rest.front()))
+            this->rest.remove_prefix(1);
+        return !this->rest.empty() && this->rest.front() != '#';
+    }
+
+    inline float parse_float(void)
+    {
+        if (!this->has_more()) this->fail_malformed();
+        // FROM_CHARS doesn't take a plus sign.
+        if (this->rest.front() == '+') this->rest.remove_prefix(1);
+        float value = 0.0f;
+        auto [next, err] = std::from_chars(this->begin(), this->end(), value);
+        if (err != std::errc {}) this->fail_malformed();
+        this->advance_to(next);
+        return value;
+    }
+
+    // Parse a face corner such as `1', `1/2', `1//3' or `1/2/3'.
+    inline Corner parse_corner(const std::array<size_t, ATTRIBS>& counts)
+    {
+        Corner corner { { MISSING, MISSING, MISSING }, 0 };
+        for (size_t k = 0; k < ATTRIBS; k++) {
+            if (k > 0) {
+                if (this->rest.empty() || this->rest.front() != '/') break;
+                this->rest.remove_prefix(1);
+                if (k == 1 && !this->rest.empty() && this->rest.front() == '/')
+                    continue;
+            }
+            int64_t value = 0;
+            auto [next, err] = std::from_chars(this->begin(), this->end(),
+                                               value);
+            if (err != std::errc {} || value == 0) this->fail_malformed();
+            this->advance_to(next);
+            if (value > 0) {
+                corner.index[k] = value - 1;
+            } else {
+                corner.index[k] = static_cast<int64_t>(counts[k]) + value;
+                corner.relative |= 1 << k;
+            }
+        }
+        if (!this->rest.empty() && !is_blank(this->rest.front()))
+            this->fail_malformed();
+        return corner;
+    }
+};
+
+static void parse_line(std::string_view line, ObjChunk& chunk)
+{
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos || line[start] == '#') return;
+    size_t stop = std::min(line.find_first_of(" \t\r", start), line.size());
+    std::string_view keyword = line.substr(start, stop - start);
+    LineParser       parser { line, stop };
+
+    if (keyword == "v") {
+        for (size_t k = 0; k < 3; k++)
+            chunk.positions.push_back(parser.parse_float());
+    } else if (keyword == "vt") {
+        // Only U is required, V defaults to 0.
+        chunk.uvs.push_back(parser.parse_float());
+        chunk.uvs.push_back(parser.has_more() ? parser.parse_float() : 0.0f);
+    } else if (keyword == "vn") {
+        for (size_t k = 0; k < 3; k++)
+            chunk.normals.push_back(parser.parse_float());
+    } else if (keyword == "f") {
+        std::array<size_t, ATTRIBS> counts { chunk.positions.size() / 3,
+                                             chunk.uvs.size() / 2,
+                                             chunk.normals.size() / 3 };
+        Corner first {}, prev {};
+        size_t n = 0;
+        for (; parser.has_more(); n++) {
+            Corner corner = parser.parse_corner(counts);
+            if (n >= 2) {
+                chunk.corners.push_back(first);
+                chunk.corners.push_back(prev);
+                chunk.corners.push_back(corner);
+            }
+            if (n == 0) first = corner;
+            prev = corner;
+        }
+        if (n < 3) fail("OBJ face with fewer than three corners `", line,
+                        '\'');
+    }
+    // Everything else (groups, materials, smoothing, ...) doesn't matter.
+}
+
+/* Lines of a chunk are parsed one after the other. The values that follow
+ * V, VT and VN are only checked for being numbers; anything after them,
+ * like a W coordinate, is ignored. A VT line may have U alone.
+ */
+static void parse_chunk(std::string_view text, ObjChunk& chunk)
+{
+    while (!text.empty()) {
+        size_t eol = text.find('\n');
+        parse_line(text.substr(0, eol), chunk);
+        if (eol == std::string_view::npos) break;
+        text.remove_prefix(eol + 1);
+    }
+}
+
+/* Maps each distinct face corner to its vertex. Open addressing with linear
+ * probing keeps that to (mostly) one cache miss per corner, where a node
+ * based map would have several. Slots refer to KEYS, which hold the corner of
+ * every vertex in the order they were added.
+ */
+class VertexTable final {
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    std::vector<uint32_t>                     slots;
+    std::vector<std::array<int64_t, ATTRIBS>> keys {};
+    size_t                                    mask;
+
+    static inline size_t hash(const std::array<int64_t, ATTRIBS>& key)
+    {
+        uint64_t h = static_cast<uint64_t>(key[0]) * 0x9e3779b97f4a7c15 ^
+                     static_cast<uint64_t>(key[1]) * 0xc2b2ae3d27d4eb4f ^
+                     static_cast<uint64_t>(key[2]) * 0x165667b19e3779f9;
+        return h ^ (h >> 32);
+    }
+
+public:
+    // The table never grows, so it must have room for all corners.
+    explicit VertexTable(size_t corners)
+        : slots(std::bit_ceil(std::max(corners * 2, size_t { 16 })), EMPTY),
+          mask { slots.size() - 1 }
+    {
+    }
+
+    // The vertex of KEY, and whether it was just added.
+    inline std::pair<uint32_t, bool>
+    insert(const std::array<int64_t, ATTRIBS>& key)
+    {
+        size_t i = hash(key) & this->mask;
+        for (; this->slots[i] != EMPTY; i = (i + 1) & this->mask)
+            if (this->keys[this->slots[i]] == key)
+                return { this->slots[i], false };
+        if (this->keys.size() == UINT32_MAX)
+            fail("OBJ file has too many vertices");
+        this->slots[i] = static_cast<uint32_t>(this->keys.size());
+        this->keys.push_back(key);
+        return { this->slots[i], true };
+    }
+};
+
+Mesh Mesh::load_obj(std::string_view path, size_t threads)
+{
+    MappedFile file { path };
+    return parse_obj({ reinterpret_cast<const char*>(file.data()),
+                       file.size() }, threads);
+}
+
+/* Chunks are split at line breaks, parsed in parallel and then resolved:
+ * once the number of elements of all previous chunks is known, relative
+ * indices become absolute. Deduplication of vertices needs a single table
+ * and runs on one thread afterwards.
+ */
+Mesh Mesh::parse_obj(std::string_view text, size_t threads)
+{
+    size_t chunks = std::min(resolve_threads(threads),
+                             text.size() / MIN_CHUNK_BYTES + 1);
+    std::vector<size_t> bounds { 0 };
+    for (size_t c = 1; c < chunks; c++) {
+        size_t at = std::max(c * text.size() / chunks, bounds.back());
+        at = text.find('\n', at);
+        bounds.push_back(at == std::string_view::npos ? text.size() : at + 1);
+    }
+    bounds.push_back(text.size());
+
+    std::vector<ObjChunk> parsed(chunks);
+    parallel_for(chunks, chunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++)
+            parse_chunk(text.substr(bounds[c], bounds[c + 1] - bounds[c]),
+                        parsed[c]);
+    });
+
+    std::array<size_t, ATTRIBS> totals { 0, 0, 0 };
+    size_t corners = 0;
+    for (ObjChunk& chunk : parsed) {
+        std::array<size_t, ATTRIBS> counts { chunk.positions.size() / 3,
+                                             chunk.uvs.size() / 2,
+                                             chunk.normals.size() / 3 };
+        for (Corner& corner : chunk.corners)
+            for (size_t k = 0; k < ATTRIBS; k++)
+                if (corner.relative & (1 << k))
+                    corner.index[k] += totals[k];
+        for (size_t k = 0; k < ATTRIBS; k++) totals[k] += counts[k];
+        corners += chunk.corners.size();
+    }
+
+    Mesh mesh {};
+    mesh.indices.reserve(corners);
+    bool uvs = false, normals = false;
+    for (const ObjChunk& chunk : parsed) {
+        for (const Corner& corner : chunk.corners) {
+            for (size_t k = 0; k < ATTRIBS; k++) {
+                int64_t i = corner.index[k];
+                if (i == MISSING && k > 0) continue;
+                if (i < 0 || static_cast<size_t>(i) >= totals[k])
+                    fail("OBJ face refers to a missing element");
+            }
+            uvs     |= corner.index[1] != MISSING;
+            normals |= corner.index[2] != MISSING;
+        }
+    }
+
+    // Gather the attributes of all chunks, so that indices are global.
+    std::vector<float> positions {}, uv_data {}, normal_data {};
+    positions.reserve(totals[0] * 3);
+    for (const ObjChunk& chunk : parsed) {
+        positions.insert(positions.end(), chunk.positions.begin(),
+                         chunk.positions.end());
+        uv_data.insert(uv_data.end(), chunk.uvs.begin(), chunk.uvs.end());
+        normal_data.insert(normal_data.end(), chunk.normals.begin(),
+                           chunk.normals.end());
+    }
+
+    VertexTable vertices { corners };
+    for (const ObjChunk& chunk : parsed) {
+        for (const Corner& corner : chunk.corners) {
+            auto [vertex, inserted] = vertices.insert(corner.index);
+            mesh.indices.push_back(vertex);
+            if (!inserted) continue;
+
+            const float* p = &positions[corner.index[0] * 3];
+            mesh.x.push_back(p[0]);
+            mesh.y.push_back(p[1]);
+            mesh.z.push_back(p[2]);
+            if (uvs) {
+                int64_t t = corner.index[1];
+                mesh.u.push_back(t == MISSING ? 0.0f : uv_data[t * 2 + 0]);
+                mesh.v.push_back(t == MISSING ? 0.0f : uv_data[t * 2 + 1]);
+            }
+            if (normals) {
+                int64_t n = corner.index[2];
+                mesh.nx.push_back(n == MISSING ? 0.0f : normal_data[n * 3]);
+                mesh.ny.push_back(n == MISSING ? 0.0f
+                                               : normal_data[n * 3 + 1]);
+                mesh.nz.push_back(n == MISSING ? 0.0f
+                                               : normal_data[n * 3 + 2]);
+            }
+        }
+    }
+    return mesh;
+}
@@ -0,0 +1,61 @@
+/* Triangle meshes in structure-of-arrays form, and a Wavefront OBJ loader.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _MESH_HH_
+#define _MESH_HH_
+
+#include <string_view>
+#include <vector>
+
+#include "common.hh"
+
+/* A MESH keeps every vertex attribute in an array of its own, e.g. all X
+ * coordinates of positions one after the other, so that a transform streams
+ * through exactly the attributes it needs. INDICES holds three vertices per
+ * triangle, in the winding order of the file. Normals and texture
+ * coordinates are either there for every vertex or empty; vertices whose
+ * face corner had none get zeros.
+ */
+struct Mesh final {
+    std::vector<float>    x {}, y {}, z {};
+    std::vector<float>    nx {}, ny {}, nz {};
+    std::vector<float>    u {}, v {};
+    std::vector<uint32_t> indices {};
+
+    inline size_t get_vertex_count(void) const   { return this->x.size(); }
+    inline size_t get_triangle_count(void) const
+    {
+        return this->indices.size() / 3;
+    }
+    inline bool has_normals(void) const { return !this->nx.empty(); }
+    inline bool has_uvs(void) const     { return !this->u.empty(); }
+
+    /* Parse the OBJ file at PATH, which is mapped into memory rather than
+     * read. Only geometry is used: V, VT, VN and F lines. Polygons are split
+     * into fans of triangles. Every distinct combination of position, texture
+     * coordinate and normal of a face corner becomes one vertex. Large files
+     * are split into chunks of lines that are parsed by up to THREADS
+     * threads (0 means one per hardware thread); the result is the same for
+     * any thread count. Malformed files are a fatal error.
+     */
+    static Mesh load_obj(std::string_view path, size_t threads = 1);
+
+    // Like LOAD_OBJ, for the contents of an OBJ file that are in memory.
+    static Mesh parse_obj(std::string_view text, size_t threads = 1);
+};
+
+#endif /* _MESH_HH_ */
@@ -0,0 +1,103 @@
+/* mmap.cc implements memory mappings of whole files for zero-copy loading.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+
+#include "io.hh"
+#include "mmap.hh"
+
+MappedFile::MappedFile(std::string_view filepath)
+{
+    // FILEPATH is not guaranteed to be null-terminated, so we make a copy.
+    std::string path { filepath };
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) fail("cannot open file `", filepath, '\'');
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) fail("cannot stat file `", filepath, '\'');
+    this->map(fd, st.st_size, filepath);
+    close(fd);
+}
+
+MappedFile::MappedFile(int fd, size_t len, std::string_view filepath)
+{
+    this->map(fd, len, filepath);
+}
+
+void MappedFile::map(int fd, size_t len, std::string_view filepath)
+{
+    if (len == 0) fail("cannot map empty file `", filepath, '\'');
+
+    /* PROT_WRITE together with MAP_PRIVATE gives us copy-on-write pages, so
+     * callers can modify pixels in place and the kernel only copies the pages
+     * that are actually touched.
+     */
+    void* ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) fail("cannot map file `", filepath, '\'');
+
+    // We read the whole file front to back during decoding.
+    madvise(ptr, len, MADV_SEQUENTIAL);
+    this->addr = static_cast<uint8_t*>(ptr);
+    this->len  = len;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : addr { std::exchange(other.addr, nullptr) },
+      len  { std::exchange(other.len, 0) }
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        this->unmap();
+        this->addr = std::exchange(other.addr, nullptr);
+        this->len  = std::exchange(other.len, 0);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile(void)
+{
+    this->unmap();
+}
+
+void MappedFile::prefetch(void) const
+{
+    if (this->addr == nullptr) return;
+    madvise(this->addr, this->len, MADV_WILLNEED);
+
+    // Reading a single byte per page is enough to fault it in.
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint8_t sum = 0;
+    for (size_t pos = 0; pos < this->len; pos += page)
+        sum ^= static_cast<const volatile uint8_t*>(this->addr)[pos];
+    (void) sum;
+}
+
+void MappedFile::unmap(void)
+{
+    if (this->addr != nullptr) munmap(this->addr, this->len);
+    this->addr = nullptr;
+    this->len  = 0;
+}
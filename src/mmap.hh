@@ -0,0 +1,62 @@
+/* A small RAII wrapper around read-only, private memory mappings of files.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _MMAP_HH_
+#define _MMAP_HH_
+
+#include "common.hh"
+
+/* A MAPPEDFILE maps an entire file copy-on-write (MAP_PRIVATE). Thus, we can
+ * write through the mapping, e.g. via TGA::SET_PIXEL, without ever modifying
+ * the file on disk. A file that is mapped by path has its descriptor closed
+ * right after mapping, one that is mapped through a descriptor stays with
+ * the caller. The mapping itself lives until the object is destroyed.
+ */
+class MappedFile final {
+private:
+    uint8_t* addr = nullptr;
+    size_t   len  = 0;
+
+    void map(int fd, size_t len, std::string_view filepath);
+    void unmap(void);
+
+public:
+    MappedFile(void) = default;
+    explicit MappedFile(std::string_view);
+
+    /* Map the first LEN bytes of FD, which is already open for reading and
+     * named FILEPATH in error messages. It's left to the caller to close FD.
+     */
+    MappedFile(int fd, size_t len, std::string_view filepath);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) noexcept;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&&) noexcept;
+    ~MappedFile(void);
+
+    inline uint8_t*       data(void)       { return this->addr; }
+    inline const uint8_t* data(void) const { return this->addr; }
+    inline size_t         size(void) const { return this->len; }
+    inline bool      is_mapped(void) const { return this->addr != nullptr; }
+
+    /* Fault in every page of the mapping now, so that a later consumer (e.g.
+     * a decoder on another thread) doesn't stall on disk reads.
+     */
+    void prefetch(void) const;
+};
+
+#endif /* _MMAP_HH_ */
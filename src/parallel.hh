@@ -0,0 +1,203 @@
+/* Header-only helpers to split work on rows (or any other index range) into
+ * bands that are processed by multiple threads, and to hand work items from
+ * one pool of threads to another.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _PARALLEL_HH_
+#define _PARALLEL_HH_
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "common.hh"
+
+// A thread count of 0 means "as many as there are hardware threads".
+inline size_t resolve_threads(size_t threads)
+{
+    if (threads != 0) return threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/* Call BODY(BEGIN, END) for contiguous bands that cover [0, N), using up to
+ * THREADS threads. The calling thread processes the last band itself, so with
+ * a single thread (or N <= 1) no thread is ever spawned. Bands differ in size
+ * by at most one element.
+ */
+template<typename F>
+void parallel_for(size_t n, size_t threads, F&& body)
+{
+    threads = std::min(resolve_threads(threads), n);
+    if (threads <= 1) {
+        if (n > 0) body(size_t { 0 }, n);
+        return;
+    }
+
+    std::vector<std::thread> workers {};
+    workers.reserve(threads - 1);
+
+    size_t band = n / threads, rest = n % threads, begin = 0;
+    for (size_t t = 0; t < threads; t++) {
+        size_t end = begin + band + (t < rest ? 1 : 0);
+        if (t == threads - 1)
+            body(begin, end);
+        else
+            workers.emplace_back([&body, begin, end] { body(begin, end); });
+        begin = end;
+    }
+
+    for (auto& worker : workers) worker.join();
+}
+
+/* A blocking, unbounded multi-producer multi-consumer queue. POP waits until
+ * an item is available and returns nothing once the queue was closed and all
+ * remaining items were taken, which is the signal for consumers to exit.
+ */
+template<typename T>
+class WorkQueue final {
+private:
+    std::mutex              mutex {};
+    std::condition_variable cv {};
+    std::deque<T>           items {};
+    bool                    closed = false;
+
+public:
+    void push(T&& item)
+    {
+        {
+            std::lock_guard<std::mutex> lock { this->mutex };
+            assert(!this->closed);
+            this->items.push_back(std::move(item));
+        }
+        this->cv.notify_one();
+    }
+
+    std::optional<T> pop(void)
+    {
+        std::unique_lock<std::mutex> lock { this->mutex };
+        this->cv.wait(lock, [this] {
+            return this->closed || !this->items.empty();
+        });
+        if (this->items.empty()) return std::nullopt;
+
+        T item { std::move(this->items.front()) };
+        this->items.pop_front();
+        return item;
+    }
+
+    void close(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock { this->mutex };
+            this->closed = true;
+        }
+        this->cv.notify_all();
+    }
+};
+
+/* A bounded multi-producer multi-consumer queue without locks, after Dmitry
+ * Vyukov's design. Every slot has a sequence number that tells whether it is
+ * ready to be written or read for a given position, so producers and
+ * consumers only contend on claiming positions, with a single CAS each. PUSH
+ * waits while the queue is full and POP while it is empty, by waiting on the
+ * sequence of the slot (a futex, not a lock); neither ever spins for long.
+ * There's no CLOSE, consumers are usually told to exit by a sentinel item.
+ */
+template<typename T>
+class BoundedQueue final {
+private:
+    struct Slot final {
+        std::atomic<size_t> sequence { 0 };
+        T                   item {};
+    };
+
+    std::vector<Slot>               slots;
+    size_t                          mask;
+    alignas(64) std::atomic<size_t> push_pos { 0 };
+    alignas(64) std::atomic<size_t> pop_pos { 0 };
+
+public:
+    // CAPACITY is rounded up to a power of two.
+    explicit BoundedQueue(size_t capacity)
+        : slots(std::bit_ceil(std::max(capacity, size_t { 1 }))),
+          mask { slots.size() - 1 }
+    {
+        for (size_t i = 0; i < this->slots.size(); i++)
+            this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue(BoundedQueue&&)      = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(BoundedQueue&&)      = delete;
+
+    void push(T&& item)
+    {
+        size_t pos = this->push_pos.load(std::memory_order_relaxed);
+        Slot*  slot;
+        for (;;) {
+            slot = &this->slots[pos & this->mask];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            auto   diff = static_cast<ptrdiff_t>(seq - pos);
+            if (diff == 0) {
+                if (this->push_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+                continue;
+            }
+            // A negative DIFF means the slot wasn't read since the last lap.
+            if (diff < 0) slot->sequence.wait(seq, std::memory_order_acquire);
+            pos = this->push_pos.load(std::memory_order_relaxed);
+        }
+        slot->item = std::move(item);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        slot->sequence.notify_all();
+    }
+
+    T pop(void)
+    {
+        size_t pos = this->pop_pos.load(std::memory_order_relaxed);
+        Slot*  slot;
+        for (;;) {
+            slot = &this->slots[pos & this->mask];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            auto   diff = static_cast<ptrdiff_t>(seq - (pos + 1));
+            if (diff == 0) {
+                if (this->pop_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+                continue;
+            }
+            // A negative DIFF means nothing was written to the slot yet.
+            if (diff < 0) slot->sequence.wait(seq, std::memory_order_acquire);
+            pos = this->pop_pos.load(std::memory_order_relaxed);
+        }
+        T item { std::move(slot->item) };
+        slot->sequence.store(pos + this->mask + 1, std::memory_order_release);
+        slot->sequence.notify_all();
+        return item;
+    }
+};
+
+#endif /* _PARALLEL_HH_ */
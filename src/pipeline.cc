@@ -0,0 +1,91 @@
+/* pipeline.cc implements the frame pipeline and its writer threads.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "io.hh"
+#include "pipeline.hh"
+
+/* Every target is in at most one of the queues at any time, so neither of
+ * them can fill up with targets alone. The filled queue has room for the
+ * exit signals of all writers on top.
+ */
+FramePipeline::FramePipeline(const TGA& prototype, const WriteOptions& options,
+                             size_t targets, size_t writers)
+    : options { options }, free_targets { targets },
+      filled_targets { targets + writers }
+{
+    if (targets == 0 || writers == 0)
+        fail("a frame pipeline needs at least one target and one writer");
+
+    this->targets.reserve(targets);
+    for (size_t i = 0; i < targets; i++) {
+        this->targets.push_back(prototype);
+        this->free_targets.push(&this->targets.back());
+    }
+
+    this->writers.reserve(writers);
+    for (size_t i = 0; i < writers; i++)
+        this->writers.emplace_back([this] { this->run_writer(); });
+}
+
+FramePipeline::~FramePipeline(void)
+{
+    this->finish();
+}
+
+TGA& FramePipeline::begin_frame(void)
+{
+    if (this->writers.empty()) fail("frame pipeline is already finished");
+    if (this->current) fail("previous frame was never submitted");
+    this->current = this->free_targets.pop();
+    return *this->current;
+}
+
+void FramePipeline::submit_frame(std::string_view path)
+{
+    if (!this->current) fail("no frame was begun");
+    this->filled_targets.push({ this->current, std::string { path } });
+    this->current = nullptr;
+}
+
+// All targets are free once the writers are done, so we take all of them.
+void FramePipeline::wait_idle(void)
+{
+    if (this->current) fail("current frame was never submitted");
+    std::vector<TGA*> idle {};
+    idle.reserve(this->targets.size());
+    for (size_t i = 0; i < this->targets.size(); i++)
+        idle.push_back(this->free_targets.pop());
+    for (TGA* target : idle) this->free_targets.push(std::move(target));
+}
+
+void FramePipeline::finish(void)
+{
+    for (size_t i = 0; i < this->writers.size(); i++)
+        this->filled_targets.push({});
+    for (auto& writer : this->writers) writer.join();
+    this->writers.clear();
+}
+
+void FramePipeline::run_writer(void)
+{
+    for (;;) {
+        Frame frame = this->filled_targets.pop();
+        if (!frame.image) return;
+        frame.image->write_to_file(frame.path, this->options);
+        this->free_targets.push(std::move(frame.image));
+    }
+}
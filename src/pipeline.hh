@@ -0,0 +1,92 @@
+/* A frame pipeline that renders one frame while earlier ones are written.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _PIPELINE_HH_
+#define _PIPELINE_HH_
+
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "common.hh"
+#include "parallel.hh"
+#include "tga.hh"
+
+/* A FRAMEPIPELINE owns a fixed pool of TARGETS images, all copies of the
+ * image it was made from. A frame is rendered into a target between
+ * BEGIN_FRAME and SUBMIT_FRAME, and then encoded (RLE, if the write options
+ * say so) and written by one of WRITERS background threads, while the
+ * caller goes on with the next frame in another target. Targets travel
+ * between the stages through two bounded lock-free queues, so nothing is
+ * allocated per frame and BEGIN_FRAME only waits if every target is still
+ * queued for writing, i.e. if writing is the bottleneck.
+ *
+ * With two targets, rendering and writing overlap; a third one absorbs
+ * frames that take longer than usual to render or to write. More writers
+ * only help if encoding, rather than the disk, is the bottleneck. With more
+ * than one writer, frames finish in any order.
+ *
+ * @NOTE: A target still holds whatever frame was last rendered into it, so
+ * renderers must clear (or completely overwrite) it.
+ */
+class FramePipeline final {
+private:
+    // A target, or the signal for a writer to exit if IMAGE is a nullptr.
+    struct Frame final {
+        TGA*        image = nullptr;
+        std::string path {};
+    };
+
+    WriteOptions             options;
+    std::vector<TGA>         targets {};   // never resized
+    BoundedQueue<TGA*>       free_targets;
+    BoundedQueue<Frame>      filled_targets;
+    std::vector<std::thread> writers {};
+    TGA*                     current = nullptr;
+
+    void run_writer(void);
+
+public:
+    FramePipeline(const TGA& prototype, const WriteOptions& = {},
+                  size_t targets = 3, size_t writers = 1);
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline(FramePipeline&&)      = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+    FramePipeline& operator=(FramePipeline&&)      = delete;
+
+    // Waits for all submitted frames to be written.
+    ~FramePipeline(void);
+
+    // Wait for a free target and return it for the next frame.
+    TGA& begin_frame(void);
+
+    // Queue the target of the current frame to be written to PATH.
+    void submit_frame(std::string_view path);
+
+    /* Wait until all submitted frames are written. The pipeline can be used
+     * as before afterwards.
+     */
+    void wait_idle(void);
+
+    /* Wait until all submitted frames are written and stop the writers. No
+     * frames can be started afterwards.
+     */
+    void finish(void);
+};
+
+#endif /* _PIPELINE_HH_ */
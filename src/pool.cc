@@ -0,0 +1,78 @@
+/* pool.cc implements the buffer pool and scratch arenas used for pixel data.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "pool.hh"
+
+std::vector<uint8_t> BufferPool::acquire(size_t n)
+{
+    {
+        std::lock_guard<std::mutex> lock { this->mutex };
+        auto it = this->free_lists.find(n);
+        if (it != this->free_lists.end() && !it->second.empty()) {
+            std::vector<uint8_t> bytes { std::move(it->second.back()) };
+            it->second.pop_back();
+            this->pooled_bytes -= n;
+            bytes.resize(n);
+            return bytes;
+        }
+    }
+
+    // Reserving first keeps the capacity at exactly N, which is our key.
+    std::vector<uint8_t> bytes {};
+    bytes.reserve(n);
+    bytes.resize(n);
+    return bytes;
+}
+
+void BufferPool::release(std::vector<uint8_t>&& bytes)
+{
+    size_t n = bytes.capacity();
+    if (n == 0) return;
+
+    std::lock_guard<std::mutex> lock { this->mutex };
+    if (this->pooled_bytes + n > this->max_bytes) return;
+    this->free_lists[n].push_back(std::move(bytes));
+    this->pooled_bytes += n;
+}
+
+size_t BufferPool::get_pooled_bytes(void) const
+{
+    std::lock_guard<std::mutex> lock { this->mutex };
+    return this->pooled_bytes;
+}
+
+uint8_t* ScratchArena::get(size_t n)
+{
+    // The old contents are garbage anyway, so don't let RESIZE copy them.
+    if (this->bytes.size() < n) {
+        this->trim();
+        this->bytes.resize(n);
+    }
+    return this->bytes.data();
+}
+
+void ScratchArena::trim(void)
+{
+    this->bytes.clear();
+    this->bytes.shrink_to_fit();
+}
+
+ScratchArena& ScratchArena::for_this_thread(void)
+{
+    static thread_local ScratchArena arena {};
+    return arena;
+}
@@ -0,0 +1,79 @@
+/* Reusable memory for pixel data and decoder scratch space, so that loading or
+ * creating many images of the same size doesn't go through malloc and fresh
+ * page faults every time.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _POOL_HH_
+#define _POOL_HH_
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hh"
+
+/* A BUFFERPOOL keeps released byte vectors around, grouped by capacity, and
+ * hands them out again for requests of exactly that size. Images of the same
+ * dimensions thus end up reusing each other's pixel storage. At most
+ * MAX_BYTES are kept; vectors beyond that are simply freed. The pool is safe
+ * to share between threads and must outlive every buffer that uses it.
+ */
+class BufferPool final {
+private:
+    mutable std::mutex mutex {};
+    std::unordered_map<size_t, std::vector<std::vector<uint8_t>>> free_lists {};
+    size_t max_bytes;
+    size_t pooled_bytes = 0;
+
+public:
+    explicit BufferPool(size_t max_bytes = size_t { 256 } << 20)
+        : max_bytes { max_bytes }
+    {
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool(BufferPool&&)      = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    BufferPool& operator=(BufferPool&&)      = delete;
+    ~BufferPool(void) = default;
+
+    // Returns a vector of N bytes with unspecified contents.
+    std::vector<uint8_t> acquire(size_t n);
+    void release(std::vector<uint8_t>&&);
+
+    size_t get_pooled_bytes(void) const;
+};
+
+/* A SCRATCHARENA is a single growable block of temporary memory, e.g. for the
+ * encoded bytes of an RLE image while it is decoded. It only ever grows, so a
+ * thread that loads many images allocates once for the largest of them.
+ */
+class ScratchArena final {
+private:
+    std::vector<uint8_t> bytes {};
+
+public:
+    // The returned memory stays valid until the next call to GET or TRIM.
+    uint8_t* get(size_t n);
+
+    // Give the memory back to the system.
+    void trim(void);
+
+    static ScratchArena& for_this_thread(void);
+};
+
+#endif /* _POOL_HH_ */
@@ -0,0 +1,587 @@
+/* raster.cc implements binning and per-tile rasterization of primitives.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <utility>
+
+#include "io.hh"
+#include "kernels.hh"
+#include "parallel.hh"
+#include "raster.hh"
+
+// Signed, so that it mixes with pixel coordinates, which can be negative.
+static constexpr int64_t TILE = Rasterizer::TILE_SIZE;
+static_assert(Rasterizer::TILE_SIZE == DepthBuffer::TILE_SIZE);
+
+static uint32_t encode_bgra(const Pixel& p)
+{
+    return p.b | (p.g << 8) | (p.r << 16) | (static_cast<uint32_t>(p.a) << 24);
+}
+
+/* Bresenham's algorithm in closed form: at step K along the major axis, the
+ * minor coordinate has moved by K * AD_MINOR / LEN, rounded half up. Thus,
+ * a tile can start drawing at any step and still get the same pixels as a
+ * single walk along the whole line.
+ */
+struct LineSteps final {
+    bool    x_major;
+    int64_t major0, minor0, len, ad_minor, sign;
+
+    explicit LineSteps(const int64_t* coords)
+        : x_major { std::abs(coords[2] - coords[0]) >=
+                    std::abs(coords[3] - coords[1]) },
+          major0 { x_major ? coords[0] : coords[1] },
+          minor0 { x_major ? coords[1] : coords[0] },
+          len { x_major ? coords[2] - coords[0] : coords[3] - coords[1] },
+          ad_minor { std::abs(x_major ? coords[3] - coords[1]
+                                      : coords[2] - coords[0]) },
+          sign { (x_major ? coords[3] - coords[1]
+                          : coords[2] - coords[0]) < 0 ? -1 : 1 }
+    {
+        assert(this->len >= 0);
+    }
+
+    /* The rounded minor offset at step K, and the remainder of its
+     * numerator 2 * K * AD_MINOR + LEN. Between int32 endpoints far apart,
+     * that numerator takes up to 66 bits, so it's computed in 128.
+     */
+    inline std::pair<int64_t, int64_t> offset_at(int64_t k) const
+    {
+        __extension__ typedef __int128 wide;
+        if (this->len == 0) return { 0, 0 };
+        wide num   = 2 * static_cast<wide>(k) * this->ad_minor + this->len;
+        wide denom = 2 * static_cast<wide>(this->len);
+        return { static_cast<int64_t>(num / denom),
+                 static_cast<int64_t>(num % denom) };
+    }
+
+    inline int64_t minor_at(int64_t k) const
+    {
+        return this->minor0 + this->sign * this->offset_at(k).first;
+    }
+};
+
+Rasterizer::Rasterizer(TGA& target, size_t threads)
+    : target { &target }, view { target.view<PixelFormat::BGRA8>() },
+      threads { resolve_threads(threads) },
+      tiles_x { (target.get_width() + TILE_SIZE - 1) / TILE_SIZE },
+      tiles_y { (target.get_height() + TILE_SIZE - 1) / TILE_SIZE }
+{
+}
+
+void Rasterizer::draw_line(int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+                           const Pixel& p)
+{
+    // Step along the major axis in increasing direction.
+    bool x_major = std::abs(int64_t { x1 } - x0) >=
+                   std::abs(int64_t { y1 } - y0);
+    if ((x_major && x1 < x0) || (!x_major && y1 < y0)) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+
+    int64_t width  = this->view.get_width();
+    int64_t height = this->view.get_height();
+    Primitive line { PrimitiveKind::Line, encode_bgra(p),
+                     { x0, y0, x1, y1, 0, 0 },
+                     std::max<int64_t>(std::min(x0, x1), 0),
+                     std::max<int64_t>(std::min(y0, y1), 0),
+                     std::min<int64_t>(std::max(x0, x1), width - 1),
+                     std::min<int64_t>(std::max(y0, y1), height - 1) };
+    if (line.min_x > line.max_x || line.min_y > line.max_y) return;
+    this->primitives.push_back(line);
+}
+
+void Rasterizer::draw_triangle(Point2 a, Point2 b, Point2 c, const Pixel& p)
+{
+    this->push_triangle({ a.x, a.y, 0.0f }, { b.x, b.y, 0.0f },
+                        { c.x, c.y, 0.0f }, p, false);
+}
+
+void Rasterizer::draw_triangle(Point3 a, Point3 b, Point3 c, const Pixel& p)
+{
+    this->push_triangle(a, b, c, p, true);
+}
+
+void Rasterizer::set_depth_buffer(DepthBuffer* depth)
+{
+    if (depth != nullptr &&
+        (depth->get_width() != this->view.get_width() ||
+         depth->get_height() != this->view.get_height()))
+        fail("depth buffer doesn't match the size of the target");
+    this->depth = depth;
+}
+
+/* @NOTE: Triangles outside the guard band are dropped rather than clipped.
+ * Geometry that large has to be clipped before it gets here.
+ */
+void Rasterizer::push_triangle(Point3 a, Point3 b, Point3 c, const Pixel& p,
+                               bool has_depth)
+{
+    for (float v : { a.x, a.y, b.x, b.y, c.x, c.y })
+        if (!(std::abs(v) <= GUARD_BAND)) return;
+    if (has_depth && !std::isfinite(a.z + b.z + c.z)) return;
+
+    auto to_fixed = [](float v) {
+        return static_cast<int64_t>(std::lround(v * (1 << SUBPIXEL_BITS)));
+    };
+    int64_t ax = to_fixed(a.x), ay = to_fixed(a.y);
+    int64_t bx = to_fixed(b.x), by = to_fixed(b.y);
+    int64_t cx = to_fixed(c.x), cy = to_fixed(c.y);
+
+    // With a lower-left origin, a positive area means counter-clockwise.
+    int64_t area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+    if (area == 0) return;
+    if (area < 0) {
+        std::swap(bx, cx);
+        std::swap(by, cy);
+        std::swap(b, c);
+        area = -area;
+    }
+
+    /* The first pixel center at or after the smallest coordinate, and the
+     * last one at or before the largest.
+     */
+    constexpr int64_t ONE  = 1 << SUBPIXEL_BITS;
+    constexpr int64_t HALF = ONE / 2;
+    int64_t width  = this->view.get_width();
+    int64_t height = this->view.get_height();
+    auto first = [](int64_t v) {
+        return (v - HALF + ONE - 1) >> SUBPIXEL_BITS;
+    };
+    auto last = [](int64_t v) { return (v - HALF) >> SUBPIXEL_BITS; };
+    Primitive tri { PrimitiveKind::Triangle, encode_bgra(p),
+                    { ax, ay, bx, by, cx, cy },
+                    std::max<int64_t>(first(std::min({ ax, bx, cx })), 0),
+                    std::max<int64_t>(first(std::min({ ay, by, cy })), 0),
+                    std::min<int64_t>(last(std::max({ ax, bx, cx })),
+                                      width - 1),
+                    std::min<int64_t>(last(std::max({ ay, by, cy })),
+                                      height - 1) };
+    if (tri.min_x > tri.max_x || tri.min_y > tri.max_y) return;
+    if (!has_depth) {
+        this->primitives.push_back(tri);
+        return;
+    }
+
+    /* The plane through the snapped vertices. Solving for its slopes in
+     * fixed-point units gives the slopes per pixel once scaled by ONE.
+     */
+    double dz_b = b.z - a.z, dz_c = c.z - a.z;
+    tri.has_depth = true;
+    tri.dzdx  = (dz_b * (cy - ay) - dz_c * (by - ay)) * ONE / area;
+    tri.dzdy  = (dz_c * (bx - ax) - dz_b * (cx - ax)) * ONE / area;
+    tri.z0    = a.z - tri.dzdx * (ax - HALF) / ONE -
+                tri.dzdy * (ay - HALF) / ONE;
+    tri.min_z = std::min({ a.z, b.z, c.z });
+    tri.max_z = std::max({ a.z, b.z, c.z });
+    this->primitives.push_back(tri);
+}
+
+Rasterizer::TileRect Rasterizer::get_tile_rect(size_t tile) const
+{
+    int64_t tx = (tile % this->tiles_x) * TILE;
+    int64_t ty = (tile / this->tiles_x) * TILE;
+    return { tile, tx, ty,
+             std::min<int64_t>(tx + TILE, this->view.get_width()) - 1,
+             std::min<int64_t>(ty + TILE, this->view.get_height()) - 1 };
+}
+
+/* Depth is linear, so its extremes within a rectangle are on the corners.
+ * Clamping to the depths of the vertices makes the range tight for tiles
+ * that only touch a corner of a large triangle, and keeps it exact for the
+ * clamped depths that are actually written.
+ */
+Rasterizer::DepthRange Rasterizer::get_depth_range(const Primitive& tri,
+                                                   int64_t x0, int64_t y0,
+                                                   int64_t x1, int64_t y1)
+{
+    float lo = tri.max_z, hi = tri.min_z;
+    for (int64_t y : { y0, y1 }) {
+        for (int64_t x : { x0, x1 }) {
+            float z = static_cast<float>(tri.z0 + tri.dzdx * x +
+                                         tri.dzdy * y);
+            lo = std::min(lo, z);
+            hi = std::max(hi, z);
+        }
+    }
+    return { std::clamp(lo, tri.min_z, tri.max_z),
+             std::clamp(hi, tri.min_z, tri.max_z) };
+}
+
+/* An edge from (X0, Y0) to (X1, Y1) of a counter-clockwise triangle. E(X, Y)
+ * is positive for points to its left, i.e. inside. BIAS excludes points on
+ * the edge unless it's a top edge (horizontal with the inside below) or a
+ * left edge (going down).
+ */
+struct Edge final {
+    int64_t x0, y0, dx, dy, bias;
+
+    Edge(int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+        : x0 { x0 }, y0 { y0 }, dx { x1 - x0 }, dy { y1 - y0 },
+          bias { (dy < 0 || (dy == 0 && dx < 0)) ? 0 : -1 }
+    {
+    }
+
+    // Evaluated at the center of pixel (X, Y), with the bias applied.
+    inline int64_t at(int64_t x, int64_t y) const
+    {
+        constexpr int64_t ONE  = 1 << Rasterizer::SUBPIXEL_BITS;
+        constexpr int64_t HALF = ONE / 2;
+        return this->dx * (y * ONE + HALF - this->y0) -
+               this->dy * (x * ONE + HALF - this->x0) + this->bias;
+    }
+
+    // The change of E per pixel in X and in Y.
+    inline int64_t step_x(void) const
+    {
+        return -this->dy << Rasterizer::SUBPIXEL_BITS;
+    }
+    inline int64_t step_y(void) const
+    {
+        return this->dx << Rasterizer::SUBPIXEL_BITS;
+    }
+
+    // The smallest and largest value on the corners of a rectangle.
+    inline std::pair<int64_t, int64_t> range(int64_t x0, int64_t y0,
+                                             int64_t x1, int64_t y1) const
+    {
+        int64_t a = this->at(x0, y0), b = this->at(x1, y0);
+        int64_t c = this->at(x0, y1), d = this->at(x1, y1);
+        return { std::min({ a, b, c, d }), std::max({ a, b, c, d }) };
+    }
+};
+
+static std::array<Edge, 3> get_edges(const int64_t* v)
+{
+    return { Edge { v[0], v[1], v[2], v[3] }, Edge { v[2], v[3], v[4], v[5] },
+             Edge { v[4], v[5], v[0], v[1] } };
+}
+
+/* Lines are binned by walking the tile columns (or rows) along the major
+ * axis, so a long diagonal only touches the tiles it actually crosses.
+ * Triangles go into every tile of their bounding box that isn't entirely
+ * outside one of the edges, and, with depth, not hidden behind what the
+ * depth buffer held when binning began. Depths only ever get closer during
+ * a flush, so anything hidden then stays hidden.
+ */
+void Rasterizer::bin_primitives(size_t chunk, size_t begin, size_t end)
+{
+    std::vector<std::vector<uint32_t>>& tile_bins = this->bins[chunk];
+    for (size_t i = begin; i < end; i++) {
+        const Primitive& prim = this->primitives[i];
+        if (prim.kind == PrimitiveKind::Line) {
+            this->bin_line(chunk, i);
+            continue;
+        }
+
+        std::array<Edge, 3> edges = get_edges(prim.coords);
+        for (int64_t ty = prim.min_y / TILE; ty <= prim.max_y / TILE; ty++) {
+            for (int64_t tx = prim.min_x / TILE; tx <= prim.max_x / TILE;
+                 tx++) {
+                size_t   tile = ty * this->tiles_x + tx;
+                TileRect rect = this->get_tile_rect(tile);
+                bool outside = false;
+                for (const Edge& e : edges)
+                    outside |= e.range(rect.x0, rect.y0, rect.x1,
+                                       rect.y1).second < 0;
+                if (outside) continue;
+                if (prim.has_depth && this->depth != nullptr) {
+                    DepthRange z = get_depth_range(prim, rect.x0, rect.y0,
+                                                   rect.x1, rect.y1);
+                    if (z.lo >= this->depth->get_tile_max(tile)) continue;
+                }
+                tile_bins[tile].push_back(i);
+            }
+        }
+    }
+}
+
+void Rasterizer::bin_line(size_t chunk, uint32_t index)
+{
+    const Primitive& line  = this->primitives[index];
+    LineSteps        steps { line.coords };
+    int64_t major_first = steps.x_major ? line.min_x : line.min_y;
+    int64_t major_last  = steps.x_major ? line.max_x : line.max_y;
+    int64_t minor_size  = steps.x_major ? this->view.get_height()
+                                        : this->view.get_width();
+
+    for (int64_t t = major_first / TILE; t <= major_last / TILE; t++) {
+        int64_t k0 = std::max<int64_t>(t * TILE, major_first) -
+                     steps.major0;
+        int64_t k1 = std::min<int64_t>((t + 1) * TILE - 1, major_last) -
+                     steps.major0;
+        int64_t m0 = steps.minor_at(k0), m1 = steps.minor_at(k1);
+        if (m0 > m1) std::swap(m0, m1);
+        if (m1 < 0 || m0 >= minor_size) continue;
+
+        m0 = std::max<int64_t>(m0, 0);
+        m1 = std::min<int64_t>(m1, minor_size - 1);
+        for (int64_t u = m0 / TILE; u <= m1 / TILE; u++) {
+            size_t tile = steps.x_major ? u * this->tiles_x + t
+                                        : t * this->tiles_x + u;
+            this->bins[chunk][tile].push_back(index);
+        }
+    }
+}
+
+void Rasterizer::fill_span(int64_t y, int64_t x0, int64_t x1,
+                           uint32_t color) const
+{
+    uint8_t pixel[4];
+    memcpy(pixel, &color, sizeof(pixel));
+    broadcast_pixel(this->view.row(y) + x0 * 4, pixel, x1 - x0 + 1, 4);
+}
+
+void Rasterizer::render_line(const Primitive& line, const TileRect& rect) const
+{
+    LineSteps steps { line.coords };
+    int64_t major_lo = steps.x_major ? rect.x0 : rect.y0;
+    int64_t major_hi = steps.x_major ? rect.x1 : rect.y1;
+    int64_t minor_lo = steps.x_major ? rect.y0 : rect.x0;
+    int64_t minor_hi = steps.x_major ? rect.y1 : rect.x1;
+
+    int64_t k0 = std::max<int64_t>(major_lo - steps.major0, 0);
+    int64_t k1 = std::min<int64_t>(major_hi - steps.major0, steps.len);
+    if (k0 > k1) return;
+
+    /* From here on, it's the incremental form: Q is the rounded minor offset
+     * and R the remainder of its numerator, 2 * K * AD_MINOR + LEN.
+     */
+    int64_t denom = 2 * std::max<int64_t>(steps.len, 1);
+    auto [q, r]   = steps.offset_at(k0);
+    for (int64_t k = k0; k <= k1; k++) {
+        int64_t minor = steps.minor0 + steps.sign * q;
+        if (minor >= minor_lo && minor <= minor_hi) {
+            int64_t major = steps.major0 + k;
+            int64_t x = steps.x_major ? major : minor;
+            int64_t y = steps.x_major ? minor : major;
+            this->view.row_pixels(y)[x] = line.color;
+        } else if ((steps.sign > 0 && minor > minor_hi) ||
+                   (steps.sign < 0 && minor < minor_lo)) {
+            return; // the line has left the tile for good
+        }
+
+        r += 2 * steps.ad_minor;
+        if (r >= denom) {
+            r -= denom;
+            q++;
+        }
+    }
+}
+
+/* Each row walks the edge functions incrementally. If the whole tile (or
+ * the part of it covered by the bounding box) is inside all edges, which is
+ * common for large triangles, we fill spans without any tests.
+ */
+bool Rasterizer::render_triangle(const Primitive& tri,
+                                 const TileRect& tile) const
+{
+    int64_t x0 = std::max(tile.x0, tri.min_x);
+    int64_t x1 = std::min(tile.x1, tri.max_x);
+    int64_t y0 = std::max(tile.y0, tri.min_y);
+    int64_t y1 = std::min(tile.y1, tri.max_y);
+    if (x0 > x1 || y0 > y1) return false;
+
+    std::array<Edge, 3> edges = get_edges(tri.coords);
+    bool inside = true, narrow = true;
+    for (const Edge& e : edges) {
+        auto [lo, hi] = e.range(x0, y0, x1, y1);
+        if (hi < 0) return false;
+        inside &= lo >= 0;
+        narrow &= lo >= INT32_MIN && hi <= INT32_MAX;
+    }
+    if (tri.has_depth && this->depth != nullptr)
+        return this->render_depth_triangle(tri, tile, { tile.index, x0, y0,
+                                                        x1, y1 }, inside);
+    if (inside) {
+        for (int64_t y = y0; y <= y1; y++)
+            this->fill_span(y, x0, x1, tri.color);
+        return false;
+    }
+
+    /* Edge values are linear, so if they fit into 32 bits on the corners,
+     * they do on every pixel in between, and we can test many pixels at
+     * once. Only huge triangles with large edge slopes take the slow path.
+     */
+    if (narrow) {
+        int32_t values[3], steps_x[3], steps_y[3];
+        for (size_t k = 0; k < 3; k++) {
+            values[k]  = static_cast<int32_t>(edges[k].at(x0, y0));
+            steps_x[k] = static_cast<int32_t>(edges[k].step_x());
+            steps_y[k] = static_cast<int32_t>(edges[k].step_y());
+        }
+        fill_covered(this->view.row_pixels(y0) + x0,
+                     this->view.get_row_step() / 4, x1 - x0 + 1, y1 - y0 + 1,
+                     values, steps_x, steps_y, tri.color);
+        return false;
+    }
+
+    int64_t sx0 = edges[0].step_x(), sx1 = edges[1].step_x(),
+            sx2 = edges[2].step_x();
+    int64_t w0 = edges[0].at(x0, y0), w1 = edges[1].at(x0, y0),
+            w2 = edges[2].at(x0, y0);
+    for (int64_t y = y0; y <= y1; y++) {
+        int64_t   e0 = w0, e1 = w1, e2 = w2;
+        uint32_t* row = this->view.row_pixels(y);
+        for (int64_t x = x0; x <= x1; x++) {
+            if ((e0 | e1 | e2) >= 0) row[x] = tri.color;
+            e0 += sx0;
+            e1 += sx1;
+            e2 += sx2;
+        }
+        w0 += edges[0].step_y();
+        w1 += edges[1].step_y();
+        w2 += edges[2].step_y();
+    }
+    return false;
+}
+
+/* Pixels are tested against the depth buffer one at a time, but a tile is
+ * skipped outright if the triangle is behind all of it, and nothing is
+ * compared if it's in front of all of it. When the triangle covers the whole
+ * tile, every depth ends up at most the triangle's largest depth there,
+ * which tightens the largest depth for free. Otherwise, it's merely kept
+ * conservative, and the caller should recompute it.
+ */
+bool Rasterizer::render_depth_triangle(const Primitive& tri,
+                                       const TileRect& tile,
+                                       const TileRect& rect,
+                                       bool inside) const
+{
+    DepthBuffer& depth = *this->depth;
+    DepthRange   z     = get_depth_range(tri, rect.x0, rect.y0, rect.x1,
+                                         rect.y1);
+    float tile_min = depth.get_tile_min(tile.index);
+    float tile_max = depth.get_tile_max(tile.index);
+    if (z.lo >= tile_max) return false;
+    bool in_front = z.hi < tile_min;
+
+    std::array<Edge, 3> edges = get_edges(tri.coords);
+    int64_t w0 = edges[0].at(rect.x0, rect.y0);
+    int64_t w1 = edges[1].at(rect.x0, rect.y0);
+    int64_t w2 = edges[2].at(rect.x0, rect.y0);
+    float*  data    = depth.tile_data(tile.index);
+    bool    written = false;
+    for (int64_t y = rect.y0; y <= rect.y1; y++) {
+        int64_t   e0 = w0, e1 = w1, e2 = w2;
+        uint32_t* row    = this->view.row_pixels(y);
+        float*    depths = data + (y - tile.y0) * TILE - tile.x0;
+        double    z_row  = tri.z0 + tri.dzdy * y;
+        for (int64_t x = rect.x0; x <= rect.x1; x++) {
+            if ((e0 | e1 | e2) >= 0) {
+                float pz = std::clamp(static_cast<float>(z_row +
+                                                         tri.dzdx * x),
+                                      z.lo, z.hi);
+                if (in_front || pz < depths[x]) {
+                    depths[x] = pz;
+                    row[x]    = tri.color;
+                    written   = true;
+                }
+            }
+            e0 += edges[0].step_x();
+            e1 += edges[1].step_x();
+            e2 += edges[2].step_x();
+        }
+        w0 += edges[0].step_y();
+        w1 += edges[1].step_y();
+        w2 += edges[2].step_y();
+    }
+    if (!written) return false;
+
+    // The smallest depth has to be right at all times, or IN_FRONT isn't.
+    bool covers_tile = inside && rect.x0 == tile.x0 && rect.x1 == tile.x1 &&
+                       rect.y0 == tile.y0 && rect.y1 == tile.y1;
+    depth.set_tile_bounds(tile.index, std::min(tile_min, z.lo),
+                          covers_tile ? std::min(tile_max, z.hi) : tile_max);
+    return !covers_tile;
+}
+
+void Rasterizer::render_tile(size_t tile)
+{
+    TileRect rect  = this->get_tile_rect(tile);
+    bool     stale = false;
+    for (const auto& tile_bins : this->bins) {
+        for (uint32_t index : tile_bins[tile]) {
+            const Primitive& prim = this->primitives[index];
+            if (prim.kind == PrimitiveKind::Line) {
+                this->render_line(prim, rect);
+                continue;
+            }
+            /* Later triangles are culled against stale, but conservative
+             * bounds. Recomputing them after every triangle would cost
+             * more than the pixels it might save.
+             */
+            stale |= this->render_triangle(prim, rect);
+        }
+    }
+    if (stale) this->depth->update_tile_bounds(tile);
+}
+
+/* Binning splits the primitives into one chunk per thread, drawing hands out
+ * tiles through an atomic counter, so that threads which got cheap tiles
+ * simply take more of them.
+ */
+void Rasterizer::flush(void)
+{
+    ScopedTimer timer { Timer::Rasterize };
+    size_t n     = this->primitives.size();
+    size_t tiles = this->get_tile_count();
+    if (n == 0 || tiles == 0) {
+        this->primitives.clear();
+        return;
+    }
+
+    size_t chunks = std::min(this->threads, n);
+    this->bins.resize(chunks);
+    for (auto& tile_bins : this->bins) {
+        tile_bins.resize(tiles);
+        for (auto& bin : tile_bins) bin.clear();
+    }
+    parallel_for(chunks, chunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++)
+            this->bin_primitives(c, c * n / chunks, (c + 1) * n / chunks);
+    });
+
+    std::atomic<size_t> next { 0 };
+    size_t workers = std::min(this->threads, tiles);
+    parallel_for(workers, workers, [&](size_t, size_t) {
+        for (size_t tile = next++; tile < tiles; tile = next++)
+            this->render_tile(tile);
+    });
+
+    for (size_t tile = 0; tile < tiles; tile++) {
+        bool drawn = std::any_of(this->bins.begin(), this->bins.end(),
+                                 [&](const auto& tile_bins) {
+            return !tile_bins[tile].empty();
+        });
+        if (!drawn) continue;
+        TileRect rect = this->get_tile_rect(tile);
+        this->target->mark_dirty(rect.y0, rect.x0, rect.y1 + 1, rect.x1 + 1);
+    }
+
+    if constexpr (INSTRUMENTATION_ON)
+        add_count(Counter::TrianglesRasterized,
+                  std::count_if(this->primitives.begin(),
+                                this->primitives.end(), [](const Primitive& p) {
+                      return p.kind == PrimitiveKind::Triangle;
+                  }));
+    this->primitives.clear();
+}
@@ -0,0 +1,167 @@
+/* A tiled, multi-threaded rasterizer for lines and triangles that draws into
+ * the pixels of a TGA.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _RASTER_HH_
+#define _RASTER_HH_
+
+#include <vector>
+
+#include "common.hh"
+#include "depth.hh"
+#include "tga.hh"
+
+/* Screen coordinates use the same lower-left origin as TGA::GET_PIXEL: pixel
+ * (X, Y) covers [X, X+1) x [Y, Y+1) and is sampled at its center.
+ */
+struct Point2 final {
+    float x = 0.0f;
+    float y = 0.0f;
+};
+
+// Like POINT2, with a depth Z where smaller values are closer.
+struct Point3 final {
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+};
+
+/* A RASTERIZER records primitives and draws all of them on FLUSH. The screen
+ * is cut into tiles of TILE_SIZE by TILE_SIZE pixels. Primitives are first
+ * binned into the tiles they touch, then every tile is drawn by exactly one
+ * thread, which thus owns its pixels and needs no locks. Within a tile,
+ * primitives are drawn in the order they were submitted.
+ *
+ * With a depth buffer, triangles with depth are drawn where they are closer
+ * than what the buffer holds, and whole tiles are skipped by the buffer's
+ * min/max hierarchy. Lines and triangles without depth ignore the buffer.
+ *
+ * The target must be a BGRA8 image. It must outlive the rasterizer and must
+ * not be resized while the rasterizer exists. The same goes for the depth
+ * buffer. Every tile that anything was drawn into is marked dirty in the
+ * target, for TGA::SAVE_INCREMENTAL.
+ */
+class Rasterizer final {
+public:
+    static constexpr size_t TILE_SIZE = 64;
+
+    /* Triangle vertices are snapped to 1/16 of a pixel. Coordinates beyond
+     * the guard band would overflow the edge functions.
+     */
+    static constexpr int64_t SUBPIXEL_BITS = 4;
+    static constexpr float   GUARD_BAND    = 1 << 20;
+
+private:
+    enum class PrimitiveKind : uint8_t {
+        Line,
+        Triangle,
+    };
+
+    /* Lines keep their integer end points in COORDS[0:4], triangles keep
+     * their fixed-point vertices in COORDS[0:6], in counter-clockwise order.
+     * MIN and MAX are the pixel bounding box, clamped to the screen. With
+     * HAS_DEPTH, the depth of pixel (X, Y) is Z0 + DZDX * X + DZDY * Y,
+     * clamped to the depths of the vertices, MIN_Z and MAX_Z.
+     */
+    struct Primitive final {
+        PrimitiveKind kind;
+        uint32_t      color;
+        int64_t       coords[6];
+        int64_t       min_x, min_y, max_x, max_y;
+        bool          has_depth = false;
+        double        z0 = 0.0, dzdx = 0.0, dzdy = 0.0;
+        float         min_z = 0.0f, max_z = 0.0f;
+    };
+
+    // The pixel rectangle of a tile, with inclusive bounds.
+    struct TileRect final {
+        size_t  index;
+        int64_t x0, y0, x1, y1;
+    };
+
+    // The depths of a triangle within a rectangle, as a closed interval.
+    struct DepthRange final {
+        float lo, hi;
+    };
+
+    TGA*                        target;
+    TGAView<PixelFormat::BGRA8> view;
+    size_t                      threads;
+    size_t                      tiles_x;
+    size_t                      tiles_y;
+    DepthBuffer*                depth = nullptr;
+    std::vector<Primitive>      primitives {};
+
+    /* The bins of every chunk of primitives, indexed by tile. Chunks are
+     * binned in parallel and drawn in order, which keeps submission order.
+     */
+    std::vector<std::vector<std::vector<uint32_t>>> bins {};
+
+    TileRect get_tile_rect(size_t) const;
+    void bin_primitives(size_t, size_t, size_t);
+    void bin_line(size_t, uint32_t);
+    void render_tile(size_t);
+    void render_line(const Primitive&, const TileRect&) const;
+    void push_triangle(Point3, Point3, Point3, const Pixel&, bool);
+
+    /* Returns whether depths were written in a way that the bounds of the
+     * tile in the depth buffer weren't kept up to date.
+     */
+    bool render_triangle(const Primitive&, const TileRect&) const;
+    bool render_depth_triangle(const Primitive&, const TileRect&,
+                               const TileRect&, bool) const;
+    static DepthRange get_depth_range(const Primitive&, int64_t, int64_t,
+                                      int64_t, int64_t);
+    void fill_span(int64_t, int64_t, int64_t, uint32_t) const;
+
+public:
+    // THREADS of 0 means one thread per hardware thread.
+    explicit Rasterizer(TGA&, size_t = 0);
+    Rasterizer(const Rasterizer&) = delete;
+    Rasterizer(Rasterizer&&)      = delete;
+    Rasterizer& operator=(const Rasterizer&) = delete;
+    Rasterizer& operator=(Rasterizer&&)      = delete;
+
+    /* Both end points are drawn. Pixels are those of Bresenham's algorithm,
+     * stepping along the longer axis from the end point with the smaller
+     * coordinate on that axis.
+     */
+    void draw_line(int32_t, int32_t, int32_t, int32_t, const Pixel&);
+
+    /* Either winding order is fine. Pixels whose centers lie on an edge are
+     * drawn only for top and left edges, so triangles that share an edge
+     * never both draw a pixel and never leave gaps.
+     */
+    void draw_triangle(Point2, Point2, Point2, const Pixel&);
+    void draw_triangle(Point3, Point3, Point3, const Pixel&);
+
+    /* Test triangles with depth against DEPTH, which must have the size of
+     * the target, or against nothing if it's a nullptr. Primitives that
+     * were drawn but not flushed yet use whatever is set on FLUSH.
+     */
+    void set_depth_buffer(DepthBuffer*);
+
+    // Draw and then drop all primitives recorded so far.
+    void flush(void);
+
+    inline size_t get_tile_count(void) const
+    {
+        return this->tiles_x * this->tiles_y;
+    }
+};
+
+#endif /* _RASTER_HH_ */
@@ -0,0 +1,299 @@
+/* rle.cc implements encoding and decoding of TGA run-length packets.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "io.hh"
+#include "kernels.hh"
+#include "rle.hh"
+
+/* With BPP known at compile time (i.e. for 3 and 4 byte pixels), all the
+ * per-packet size computations fold into constants. BPP = 0 means that the
+ * pixel width is only known at runtime and is passed in BYTES_PER_PIXEL. With
+ * FATAL, malformed data ends the program with a message; otherwise, we return
+ * RLE_DECODE_ERROR and leave DST partially written.
+ */
+template<size_t BPP, bool FATAL>
+static size_t decode_packets(const uint8_t* src, size_t src_len,
+                             uint8_t* dst, size_t dst_len,
+                             size_t bytes_per_pixel)
+{
+    const size_t bpp = BPP != 0 ? BPP : bytes_per_pixel;
+
+    size_t in = 0, out = 0, packets = 0;
+    while (out < dst_len) {
+        if (in >= src_len) {
+            if constexpr (!FATAL) return RLE_DECODE_ERROR;
+            fail("RLE data ends after ", out, " of ", dst_len,
+                 " decoded bytes");
+        }
+
+        uint8_t packet = src[in++];
+        size_t  pixels = rle_packet_pixels(packet);
+        packets++;
+        size_t  n      = pixels * bpp;
+        if (n > dst_len - out) {
+            if constexpr (!FATAL) return RLE_DECODE_ERROR;
+            fail("RLE packet at byte ", in-1, " overflows the image data");
+        }
+
+        if (rle_is_run_packet(packet)) {
+            if (src_len - in < bpp) {
+                if constexpr (!FATAL) return RLE_DECODE_ERROR;
+                fail("RLE run packet at byte ", in-1, " is truncated");
+            }
+            broadcast_pixel(dst + out, src + in, pixels, bpp);
+            in += bpp;
+        } else {
+            if (src_len - in < n) {
+                if constexpr (!FATAL) return RLE_DECODE_ERROR;
+                fail("RLE raw packet at byte ", in-1, " is truncated");
+            }
+            memcpy(dst + out, src + in, n);
+            in += n;
+        }
+        out += n;
+    }
+    add_count(Counter::RlePackets, packets);
+    return in;
+}
+
+template<bool FATAL>
+static size_t decode_any(const uint8_t* src, size_t src_len, uint8_t* dst,
+                         size_t dst_len, size_t bytes_per_pixel)
+{
+    switch (bytes_per_pixel) {
+    case 3:  return decode_packets<3, FATAL>(src, src_len, dst, dst_len, 3);
+    case 4:  return decode_packets<4, FATAL>(src, src_len, dst, dst_len, 4);
+    default: return decode_packets<0, FATAL>(src, src_len, dst, dst_len,
+                                             bytes_per_pixel);
+    }
+}
+
+size_t rle_decode(const uint8_t* src, size_t src_len,
+                  uint8_t* dst, size_t dst_len, size_t bytes_per_pixel)
+{
+    return decode_any<true>(src, src_len, dst, dst_len, bytes_per_pixel);
+}
+
+size_t rle_try_decode(const uint8_t* src, size_t src_len,
+                      uint8_t* dst, size_t dst_len, size_t bytes_per_pixel)
+{
+    return decode_any<false>(src, src_len, dst, dst_len, bytes_per_pixel);
+}
+
+size_t RLEDecoder::decode(const uint8_t* src, size_t src_len, uint8_t* dst,
+                          size_t dst_len, size_t& produced)
+{
+    const size_t bpp = this->bytes_per_pixel;
+
+    size_t in = 0, out = 0, packets = 0;
+    while (out < dst_len) {
+        if (this->raw_left > 0) {
+            size_t n = std::min({ this->raw_left, src_len - in,
+                                  dst_len - out });
+            if (n == 0) break;
+            memcpy(dst + out, src + in, n);
+            this->raw_left -= n;
+            in  += n;
+            out += n;
+        } else if (this->run_left > 0 && this->run_bytes < bpp) {
+            size_t n = std::min(bpp - this->run_bytes, src_len - in);
+            if (n == 0) break;
+            memcpy(this->run_pixel + this->run_bytes, src + in, n);
+            this->run_bytes += n;
+            in += n;
+        } else if (this->run_left > 0) {
+            size_t pixels = std::min(this->run_left, (dst_len - out) / bpp);
+            if (pixels == 0) break;
+            broadcast_pixel(dst + out, this->run_pixel, pixels, bpp);
+            this->run_left -= pixels;
+            out += pixels * bpp;
+        } else {
+            if (in == src_len) break;
+            uint8_t packet = src[in++];
+            packets++;
+            if (rle_is_run_packet(packet)) {
+                this->run_left  = rle_packet_pixels(packet);
+                this->run_bytes = 0;
+            } else {
+                this->raw_left = rle_packet_pixels(packet) * bpp;
+            }
+        }
+    }
+
+    add_count(Counter::RlePackets, packets);
+    produced = out;
+    return in;
+}
+
+size_t RLERowIndexer::scan(const uint8_t* src, size_t len, size_t src_offset)
+{
+    size_t in = 0;
+    while (in < len && !this->is_done()) {
+        if (this->skip > 0) {
+            size_t n = std::min(this->skip, len - in);
+            this->skip -= n;
+            in += n;
+            continue;
+        }
+
+        size_t col = this->decoded % this->bytes_width;
+        if (col == 0) {
+            if (src_offset + in > UINT32_MAX) {
+                this->too_far = true;
+                break;
+            }
+            this->offsets.push_back(src_offset + in);
+        }
+
+        uint8_t packet = src[in++];
+        size_t  n      = rle_packet_pixels(packet) * this->bytes_per_pixel;
+        if (col + n > this->bytes_width) {
+            this->crossed = true;
+            break;
+        }
+
+        this->skip     = rle_is_run_packet(packet) ? this->bytes_per_pixel : n;
+        this->decoded += n;
+    }
+    return in;
+}
+
+template<size_t BPP>
+static inline bool same_pixel(const uint8_t* a, const uint8_t* b, size_t bpp)
+{
+    if constexpr (BPP == 4) {
+        uint32_t x, y;
+        memcpy(&x, a, 4);
+        memcpy(&y, b, 4);
+        return x == y;
+    } else if constexpr (BPP != 0) {
+        return !memcmp(a, b, BPP);
+    } else {
+        return !memcmp(a, b, bpp);
+    }
+}
+
+/* A greedy encoder: two or more equal pixels become a run packet, everything
+ * else is collected into raw packets. A run of two is never longer than the
+ * same pixels in a raw packet (1 + BPP instead of 2 * BPP bytes), so we don't
+ * need any look-ahead. For one byte pixels, cutting a raw packet short still
+ * costs a header, which RLE_MAX_ENCODED_LEN accounts for.
+ */
+template<size_t BPP>
+static size_t encode_row(const uint8_t* src, size_t pixels, uint8_t* dst,
+                         size_t bytes_per_pixel)
+{
+    const size_t bpp = BPP != 0 ? BPP : bytes_per_pixel;
+
+    size_t out = 0, pos = 0;
+    while (pos < pixels) {
+        const uint8_t* px  = src + pos*bpp;
+        size_t         max = std::min(pixels - pos, RLE_MAX_PACKET_PIXELS);
+
+        size_t run = 1;
+        while (run < max && same_pixel<BPP>(px, px + run*bpp, bpp)) run++;
+
+        if (run > 1) {
+            dst[out++] = 0x80 | (run - 1);
+            memcpy(dst + out, px, bpp);
+            out += bpp;
+            pos += run;
+            continue;
+        }
+
+        // Extend the raw packet until the next run of two pixels begins.
+        size_t raw = 1;
+        while (raw < max &&
+               (pos + raw + 1 >= pixels ||
+                !same_pixel<BPP>(px + raw*bpp, px + (raw+1)*bpp, bpp)))
+            raw++;
+
+        dst[out++] = raw - 1;
+        memcpy(dst + out, px, raw * bpp);
+        out += raw * bpp;
+        pos += raw;
+    }
+    return out;
+}
+
+size_t rle_encode_row(const uint8_t* src, size_t pixels, uint8_t* dst,
+                      size_t bytes_per_pixel)
+{
+    switch (bytes_per_pixel) {
+    case 3:  return encode_row<3>(src, pixels, dst, 3);
+    case 4:  return encode_row<4>(src, pixels, dst, 4);
+    default: return encode_row<0>(src, pixels, dst, bytes_per_pixel);
+    }
+}
+
+/* Splitting a raw packet adds one header byte, splitting a run adds a header
+ * and a repeated pixel. We take as many run splits as fit and make up the
+ * rest with raw splits.
+ */
+bool rle_encode_row_exact(const uint8_t* src, size_t pixels, uint8_t* dst,
+                          size_t len, size_t bytes_per_pixel,
+                          uint8_t* scratch)
+{
+    size_t min_len = rle_encode_row(src, pixels, scratch, bytes_per_pixel);
+    if (min_len > len) return false;
+
+    size_t raw_splits = 0, run_splits = 0;
+    for (size_t i = 0; i < min_len;) {
+        size_t n = rle_packet_pixels(scratch[i]);
+        if (rle_is_run_packet(scratch[i])) {
+            run_splits += n - 1;
+            i += 1 + bytes_per_pixel;
+        } else {
+            raw_splits += n - 1;
+            i += 1 + n * bytes_per_pixel;
+        }
+    }
+    size_t extra = len - min_len;
+    size_t runs  = std::min(run_splits, extra / (1 + bytes_per_pixel));
+    size_t raws  = extra - runs * (1 + bytes_per_pixel);
+    if (raws > raw_splits) return false;
+
+    uint8_t* out = dst;
+    for (size_t i = 0; i < min_len;) {
+        size_t         n  = rle_packet_pixels(scratch[i]);
+        const uint8_t* px = scratch + i + 1;
+        bool           is_run = rle_is_run_packet(scratch[i]);
+        size_t         k  = std::min(is_run ? runs : raws, n - 1);
+        for (size_t j = 0; j < k; j++) {
+            *out++ = is_run ? 0x80 : 0x00;
+            memcpy(out, px, bytes_per_pixel);
+            out += bytes_per_pixel;
+            if (!is_run) px += bytes_per_pixel;
+        }
+        size_t rest = is_run ? 1 : n - k;
+        *out++ = static_cast<uint8_t>((is_run ? 0x80 : 0x00) | (n - k - 1));
+        memcpy(out, px, rest * bytes_per_pixel);
+        out += rest * bytes_per_pixel;
+        if (is_run) {
+            runs -= k;
+            i += 1 + bytes_per_pixel;
+        } else {
+            raws -= k;
+            i += 1 + n * bytes_per_pixel;
+        }
+    }
+    assert(out == dst + len);
+    return true;
+}
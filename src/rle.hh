@@ -0,0 +1,158 @@
+/* Kernels for the run-length encoding used by TGA image types 9, 10 and 11.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _RLE_HH_
+#define _RLE_HH_
+
+#include <vector>
+
+#include "common.hh"
+
+/* Every packet starts with a single byte. If the high bit is set, it is a run
+ * packet and a single pixel value follows that is repeated (b & 0x7f) + 1
+ * times. Otherwise, it is a raw packet and (b & 0x7f) + 1 pixels follow.
+ */
+constexpr size_t RLE_MAX_PACKET_PIXELS = 128;
+
+inline bool   rle_is_run_packet(uint8_t b) { return b & 0x80; }
+inline size_t rle_packet_pixels(uint8_t b) { return (b & 0x7f) + 1; }
+
+/* Decode RLE packets from SRC into DST until DST_LEN bytes were written. We
+ * never read past SRC_LEN or write past DST_LEN; malformed input, i.e.
+ * truncated packets or packets that overflow DST, is a fatal error. Returns
+ * the number of bytes consumed from SRC.
+ */
+size_t rle_decode(const uint8_t* src, size_t src_len,
+                  uint8_t* dst, size_t dst_len, size_t bytes_per_pixel);
+
+/* Like RLE_DECODE, but malformed input isn't fatal. Instead, we return
+ * RLE_DECODE_ERROR. This is meant for speculative decoding, e.g. starting at
+ * an offset from an untrusted scan line table.
+ */
+constexpr size_t RLE_DECODE_ERROR = SIZE_MAX;
+
+size_t rle_try_decode(const uint8_t* src, size_t src_len,
+                      uint8_t* dst, size_t dst_len, size_t bytes_per_pixel);
+
+/* A resumable decoder for data that arrives in chunks, e.g. when streaming a
+ * file. In contrast to RLE_DECODE, packets may be split at any byte, both in
+ * the input (a packet header whose pixels are in the next chunk) and in the
+ * output (a packet that covers more pixels than fit into DST).
+ */
+class RLEDecoder final {
+private:
+    size_t  bytes_per_pixel;
+    size_t  raw_left  = 0;   // bytes of the current raw packet not yet copied
+    size_t  run_left  = 0;   // pixels of the current run packet not yet written
+    size_t  run_bytes = 0;   // bytes of the current run pixel read so far
+    uint8_t run_pixel[32] {};
+
+public:
+    explicit RLEDecoder(size_t bytes_per_pixel)
+        : bytes_per_pixel { bytes_per_pixel }
+    {
+        assert(bytes_per_pixel > 0 && bytes_per_pixel <= sizeof(run_pixel));
+    }
+
+    /* Decode from SRC into DST until either is exhausted. DST must end on a
+     * pixel boundary, e.g. at the end of a scanline, but a previous call may
+     * have stopped in the middle of a raw pixel. Returns the number of bytes
+     * consumed from SRC and stores the number of bytes written in PRODUCED.
+     */
+    size_t decode(const uint8_t* src, size_t src_len, uint8_t* dst,
+                  size_t dst_len, size_t& produced);
+};
+
+/* An RLEROWINDEXER finds the offset of each scanline in RLE data by looking
+ * at packet headers only, skipping over pixel data. It works on complete
+ * buffers as well as on data that arrives in chunks. Indexing only works if
+ * no packet crosses a scanline; the spec recommends that, but doesn't require
+ * it, so callers must check IS_INDEXABLE. Offsets are 32 bits, like those of
+ * a scan line table, so rows that start 4 GiB or more into the file can't be
+ * indexed either.
+ */
+class RLERowIndexer final {
+private:
+    size_t                bytes_per_pixel;
+    size_t                bytes_width;
+    size_t                height;
+    size_t                skip    = 0; // payload bytes left in current packet
+    size_t                decoded = 0; // decoded bytes seen so far
+    bool                  crossed = false;
+    bool                  too_far = false;
+    std::vector<uint32_t> offsets {};
+
+public:
+    RLERowIndexer(size_t bytes_per_pixel, size_t bytes_width, size_t height)
+        : bytes_per_pixel { bytes_per_pixel }, bytes_width { bytes_width },
+          height { height }
+    {
+        this->offsets.reserve(height);
+    }
+
+    /* Scan the next LEN bytes of RLE data, where SRC_OFFSET is the offset of
+     * SRC[0] in the file. Returns the number of bytes looked at, which is
+     * less than LEN once indexing is done.
+     */
+    size_t scan(const uint8_t* src, size_t len, size_t src_offset);
+
+    inline bool is_done(void) const
+    {
+        return this->crossed || this->too_far || (this->skip == 0 &&
+               this->decoded == this->bytes_width * this->height);
+    }
+
+    inline bool is_indexable(void) const
+    {
+        return this->is_done() && !this->crossed && !this->too_far;
+    }
+
+    // Only valid if IS_INDEXABLE returned true.
+    inline std::vector<uint32_t>& get_offsets(void) { return this->offsets; }
+};
+
+/* The worst case for encoding a single scanline of PIXELS pixels: nothing but
+ * raw packets, each of which adds one header byte per 128 pixels. A run that
+ * cuts a raw packet short saves at least that byte, unless pixels are just
+ * one byte wide; then, every pixel might need a header.
+ */
+inline size_t rle_max_encoded_len(size_t pixels, size_t bytes_per_pixel)
+{
+    if (bytes_per_pixel == 1) return 2 * pixels;
+    size_t packets = (pixels + RLE_MAX_PACKET_PIXELS - 1) /
+                     RLE_MAX_PACKET_PIXELS;
+    return pixels * bytes_per_pixel + packets;
+}
+
+/* Encode a single scanline of PIXELS pixels at SRC into DST, which must hold
+ * at least RLE_MAX_ENCODED_LEN bytes. Packets never cross the end of the
+ * scanline, as recommended by the spec. Returns the number of bytes written.
+ */
+size_t rle_encode_row(const uint8_t* src, size_t pixels, uint8_t* dst,
+                      size_t bytes_per_pixel);
+
+/* Encode a single scanline like RLE_ENCODE_ROW, but into exactly LEN bytes at
+ * DST, e.g. to overwrite it in place in a file. The shortest encoding is
+ * padded by splitting packets into smaller ones, which decode the same.
+ * SCRATCH must hold RLE_MAX_ENCODED_LEN bytes. Returns false if LEN can't be
+ * reached that way, in which case DST holds garbage.
+ */
+bool rle_encode_row_exact(const uint8_t* src, size_t pixels, uint8_t* dst,
+                          size_t len, size_t bytes_per_pixel,
+                          uint8_t* scratch);
+
+#endif /* _RLE_HH_ */
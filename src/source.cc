@@ -0,0 +1,82 @@
+/* source.cc implements byte sources for files in memory and on disk.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include "io.hh"
+#include "source.hh"
+
+void fail_short_read(size_t n, size_t got, const char* name)
+{
+    char msg[4096];
+    snprintf(msg, 4095, "expected to read 0x%lx bytes in field `%s', "
+             "got only 0x%lx bytes (%g%%)", n, name, got,
+             (float)got / (float)n);
+    fail(msg);
+}
+
+void MemorySource::read(uint8_t* out, size_t n, size_t& pos,
+                        const char* name) const
+{
+    size_t available = this->available(pos);
+    if (available < n) fail_short_read(n, available, name);
+    if (n > 0) memcpy(out, this->bytes.data() + pos, n);
+    pos += n;
+}
+
+const uint8_t* MemorySource::view(size_t pos, size_t n) const
+{
+    assert(n <= this->available(pos));
+    (void) n;
+    return this->bytes.data() + pos;
+}
+
+FileSource::FileSource(std::string_view filepath)
+{
+    // FILEPATH is not guaranteed to be null-terminated, so we make a copy.
+    std::string path { filepath };
+    this->fd = open(path.c_str(), O_RDONLY);
+    if (this->fd < 0) fail("cannot open file `", filepath, '\'');
+
+    struct stat st;
+    if (fstat(this->fd, &st) != 0) fail("cannot stat file `", filepath, '\'');
+    this->len = st.st_size;
+}
+
+FileSource::~FileSource(void)
+{
+    if (this->fd >= 0) close(this->fd);
+}
+
+void FileSource::read(uint8_t* out, size_t n, size_t& pos,
+                      const char* name) const
+{
+    size_t done = 0;
+    while (done < n) {
+        ssize_t ret = pread(this->fd, out + done, n - done, pos + done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) fail_short_read(n, done, name);
+        done += ret;
+    }
+    pos += n;
+}
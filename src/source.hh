@@ -0,0 +1,94 @@
+/* Byte sources that the TGA parser reads complete files from, no matter
+ * whether they are on disk or already in memory.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _SOURCE_HH_
+#define _SOURCE_HH_
+
+#include <span>
+
+#include "common.hh"
+
+// It is a fatal error to read less than N bytes into field NAME.
+[[noreturn]] void fail_short_read(size_t n, size_t got, const char* name);
+
+/* A BYTESOURCE gives random access to the bytes of a single file. There is no
+ * file position: every read names its offset, so a source can be shared by
+ * multiple threads, e.g. to read bands of rows in parallel. Sources that live
+ * in memory also hand out pointers to their bytes, so parsers can work on
+ * them in place instead of copying.
+ */
+class ByteSource {
+public:
+    ByteSource(void) = default;
+    ByteSource(const ByteSource&) = delete;
+    ByteSource(ByteSource&&)      = delete;
+    ByteSource& operator=(const ByteSource&) = delete;
+    ByteSource& operator=(ByteSource&&)      = delete;
+    virtual ~ByteSource(void) = default;
+
+    virtual size_t size(void) const = 0;
+
+    /* Copy N bytes at POS into OUT and advance POS. Reading past the end is
+     * a fatal error that names the field NAME.
+     */
+    virtual void read(uint8_t* out, size_t n, size_t& pos,
+                      const char* name) const = 0;
+
+    /* The N bytes at POS, without a copy. Returns nullptr if the source isn't
+     * in memory. The range must have been bounds-checked by the caller.
+     */
+    virtual const uint8_t* view(size_t pos, size_t n) const = 0;
+
+    // The number of bytes from POS to the end of the source.
+    inline size_t available(size_t pos) const
+    {
+        return pos < this->size() ? this->size() - pos : 0;
+    }
+};
+
+// A file that was loaded or mapped into memory in one piece.
+class MemorySource final : public ByteSource {
+private:
+    std::span<const uint8_t> bytes;
+
+public:
+    explicit MemorySource(std::span<const uint8_t> bytes) : bytes { bytes } {}
+
+    size_t size(void) const override { return this->bytes.size(); }
+    void read(uint8_t*, size_t, size_t&, const char*) const override;
+    const uint8_t* view(size_t, size_t) const override;
+};
+
+/* A file on disk, which is read with PREAD. The file descriptor is closed
+ * when the source is destroyed.
+ */
+class FileSource final : public ByteSource {
+private:
+    int    fd  = -1;
+    size_t len = 0;
+
+public:
+    explicit FileSource(std::string_view);
+    ~FileSource(void) override;
+
+    size_t size(void) const override { return this->len; }
+    void read(uint8_t*, size_t, size_t&, const char*) const override;
+    const uint8_t* view(size_t, size_t) const override { return nullptr; }
+};
+
+#endif /* _SOURCE_HH_ */
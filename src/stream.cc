@@ -0,0 +1,364 @@
+/* stream.cc implements scanline-based reading and writing of TGA files.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "io.hh"
+#include "stream.hh"
+
+TGAReader::TGAReader(std::string_view filepath)
+{
+    // FILEPATH is not guaranteed to be null-terminated, so we make a copy.
+    std::string path { filepath };
+    this->file = fopen(path.c_str(), "rb");
+    if (this->file == nullptr) fail("cannot open file `", filepath, '\'');
+
+    size_t ret = fread(&this->header, sizeof(this->header), 1, this->file);
+    if (ret != 1) fail("cannot read TGA header from file");
+    TGA::check_header(this->header);
+
+    this->image_id_data.resize(this->header.id_length, 0);
+    TGA::read_n_bytes(this->image_id_data.data(), this->image_id_data.size(),
+                      "image id", this->file);
+
+    size_t bytes_per_entry =
+        (this->header.color_map_spec.bits_per_pixel / 8) +
+        (this->header.color_map_spec.bits_per_pixel % 8 == 0 ? 0 : 1);
+    this->color_map.resize(this->header.color_map_spec.length *
+                           bytes_per_entry, 0);
+    TGA::read_n_bytes(this->color_map.data(), this->color_map.size(),
+                      "color map", this->file);
+
+    this->data_offset = ftell(this->file);
+    if (this->header.image_type & 0x8) {
+        this->decoder.emplace(this->get_pixel_width());
+        this->chunk.resize(std::max(TGAReader::CHUNK_SIZE,
+                                    this->get_max_row_len()));
+    }
+}
+
+TGAReader::~TGAReader(void)
+{
+    if (this->file != nullptr) fclose(this->file);
+}
+
+size_t TGAReader::read_rows(uint8_t* out, size_t n)
+{
+    n = std::min(n, this->get_rows_left());
+    if (n == 0) return 0;
+
+    size_t bytes_width = this->get_bytes_width();
+    if (!this->decoder) {
+        size_t ret = fread(out, bytes_width, n, this->file);
+        if (ret != n)
+            fail("image data ends after ", this->rows_read + ret, " of ",
+                 this->get_height(), " rows");
+    } else {
+        for (size_t i = 0; i < n; i++)
+            this->read_rle_row(out + i * bytes_width);
+    }
+
+    this->rows_read += n;
+    return n;
+}
+
+/* Packets may cross scanlines and chunk boundaries, RLEDECODER keeps track of
+ * partial packets for us.
+ */
+void TGAReader::read_rle_row(uint8_t* out)
+{
+    size_t row_len = this->get_bytes_width();
+    size_t total   = 0;
+    while (total < row_len) {
+        if (this->chunk_pos == this->chunk_len) {
+            this->chunk_len = fread(this->chunk.data(), sizeof(uint8_t),
+                                    this->chunk.size(), this->file);
+            this->chunk_pos = 0;
+            if (this->chunk_len == 0)
+                fail("RLE data ends in row ", this->rows_read, " of ",
+                     this->get_height());
+        }
+
+        size_t produced = 0;
+        this->chunk_pos += this->decoder->decode(
+            this->chunk.data() + this->chunk_pos,
+            this->chunk_len - this->chunk_pos,
+            out + total, row_len - total, produced);
+        total += produced;
+    }
+}
+
+void TGAReader::seek_row(size_t row)
+{
+    if (row > this->get_height())
+        fail("cannot seek to row ", row, " of ", this->get_height());
+
+    size_t bytes_width = this->get_bytes_width();
+    if (!this->decoder) {
+        if (fseek(this->file, this->data_offset + row * bytes_width,
+                  SEEK_SET) != 0)
+            fail("cannot seek to row ", row);
+        this->rows_read = row;
+        return;
+    }
+
+    // Seeking always starts decoding from a clean packet boundary.
+    this->decoder.emplace(this->get_pixel_width());
+    this->chunk_pos = this->chunk_len = 0;
+
+    if (row == this->get_height()) {
+        this->rows_read = row;
+        return;
+    }
+
+    // Only the file's table can be wrong, ours is built from the packets.
+    while (this->index_rows()) {
+        if (this->start_row(row)) {
+            this->rows_read = row;
+            return;
+        }
+        if (!this->has_file_tbl)
+            fail("RLE data of row ", row, " is malformed");
+        this->scan_line_tbl.clear();
+        this->has_file_tbl = false;
+    }
+
+    // Packets cross scanlines, so all we can do is decode up to ROW.
+    if (fseek(this->file, this->data_offset, SEEK_SET) != 0)
+        fail("cannot seek to image data");
+    this->rows_read = 0;
+    std::vector<uint8_t> discard(bytes_width);
+    while (this->rows_read < row) this->read_row(discard.data());
+}
+
+/* Read the encoded bytes of ROW into the input buffer, if the scan line
+ * table tells where they are. A row must decode from exactly those bytes,
+ * which it only does if it starts on a packet boundary. The last row has no
+ * end in the table, so it must decode from at most GET_MAX_ROW_LEN bytes,
+ * and the row before it must end where it starts. Otherwise, we return
+ * false.
+ */
+bool TGAReader::start_row(size_t row)
+{
+    if (row + 1 == this->get_height() && row > 0 &&
+        !this->start_row(row - 1))
+        return false;
+
+    size_t start = this->scan_line_tbl[row];
+    size_t len   = row + 1 < this->get_height()
+                 ? this->scan_line_tbl[row + 1] - start
+                 : this->get_max_row_len();
+    if (fseek(this->file, start, SEEK_SET) != 0)
+        fail("cannot seek to row ", row);
+    size_t got = fread(this->chunk.data(), sizeof(uint8_t), len, this->file);
+    if (got < len && row + 1 < this->get_height()) return false;
+
+    std::vector<uint8_t> decoded(this->get_bytes_width());
+    size_t used = rle_try_decode(this->chunk.data(), got, decoded.data(),
+                                 decoded.size(), this->get_pixel_width());
+    if (used == RLE_DECODE_ERROR || (row + 1 < this->get_height() &&
+                                     used != len))
+        return false;
+
+    // READ_RLE_ROW decodes again what we just read.
+    this->chunk_pos = 0;
+    this->chunk_len = got;
+    return true;
+}
+
+/* We prefer the file's own scan line table. Only if there is none, or
+ * START_ROW found it to be wrong, we scan the packet headers of the whole
+ * image once.
+ */
+bool TGAReader::index_rows(void)
+{
+    if (!this->scan_line_tbl.empty()) return true;
+    if (!this->is_indexable) return false;
+    if (this->has_file_tbl && this->read_scan_line_tbl()) return true;
+    this->has_file_tbl = false;
+
+    if (fseek(this->file, this->data_offset, SEEK_SET) != 0)
+        fail("cannot seek to image data");
+
+    RLERowIndexer indexer { this->get_pixel_width(), this->get_bytes_width(),
+                            this->get_height() };
+    size_t offset = this->data_offset;
+    while (!indexer.is_done()) {
+        size_t len = fread(this->chunk.data(), sizeof(uint8_t),
+                           this->chunk.size(), this->file);
+        if (len == 0) fail("RLE data ends before the last row");
+        indexer.scan(this->chunk.data(), len, offset);
+        offset += len;
+    }
+
+    this->is_indexable = indexer.is_indexable();
+    if (this->is_indexable)
+        this->scan_line_tbl = std::move(indexer.get_offsets());
+    return this->is_indexable;
+}
+
+/* Returns false if the file has no scan line table, or one that can't be
+ * right: rows must start in order, the first one where pixel data does, and
+ * all of them before the footer, at most GET_MAX_ROW_LEN bytes apart.
+ */
+bool TGAReader::read_scan_line_tbl(void)
+{
+    TGA::Footer footer {};
+    if (fseek(this->file, -static_cast<long>(sizeof(footer)), SEEK_END) != 0)
+        return false;
+    long footer_pos = ftell(this->file);
+    if (footer_pos < 0 || fread(&footer, sizeof(footer), 1, this->file) != 1)
+        return false;
+    if (strncmp(footer.signature, "TRUEVISION-XFILE.", 18) ||
+        footer.ext_area_offset == 0)
+        return false;
+
+    TGA::ExtensionArea ext_area {};
+    if (fseek(this->file, footer.ext_area_offset, SEEK_SET) != 0 ||
+        fread(&ext_area, sizeof(ext_area), 1, this->file) != 1 ||
+        ext_area.scan_line_tbl_offset == 0)
+        return false;
+
+    std::vector<uint32_t> tbl(this->get_height());
+    if (fseek(this->file, ext_area.scan_line_tbl_offset, SEEK_SET) != 0 ||
+        fread(tbl.data(), sizeof(uint32_t), tbl.size(), this->file) !=
+            tbl.size())
+        return false;
+
+    size_t max_row_len = this->get_max_row_len();
+    if (tbl[0] != this->data_offset ||
+        tbl.back() >= static_cast<size_t>(footer_pos))
+        return false;
+    for (size_t r = 1; r < tbl.size(); r++)
+        if (tbl[r] <= tbl[r-1] || tbl[r] - tbl[r-1] > max_row_len)
+            return false;
+    this->scan_line_tbl = std::move(tbl);
+    return true;
+}
+
+TGAWriter::TGAWriter(std::string_view filepath, uint16_t width,
+                     uint16_t height, PixelFormat format,
+                     const WriteOptions& options)
+    : use_rle { options.use_rle }
+{
+    if (width == 0 || height == 0) fail("cannot write an empty TGA image");
+
+    std::string path { filepath };
+    this->file = fopen(path.c_str(), "wb");
+    if (this->file == nullptr) fail("cannot open file `", filepath, '\'');
+
+    size_t  bytes_per_pixel = 0;
+    uint8_t alpha_bits      = 0;
+    switch (format) {
+    case PixelFormat::BGRA8: bytes_per_pixel = 4; alpha_bits = 0x8; break;
+    case PixelFormat::BGR8:  bytes_per_pixel = 3;                   break;
+    case PixelFormat::Gray8: bytes_per_pixel = 1;                   break;
+    }
+
+    Origin origin = options.origin.value_or(Origin::LowerLeft);
+    this->header.image_type = format == PixelFormat::Gray8 ? 0x3 : 0x2;
+    if (this->use_rle) this->header.image_type |= 0x8;
+    this->header.image_spec.width          = width;
+    this->header.image_spec.height         = height;
+    this->header.image_spec.bits_per_pixel = bytes_per_pixel * 8;
+    this->header.image_spec.descriptor     =
+        alpha_bits | static_cast<uint8_t>(origin);
+
+    if (this->use_rle) {
+        this->rle_row.resize(rle_max_encoded_len(width, bytes_per_pixel));
+        this->scan_line_tbl.reserve(height);
+    }
+
+    if (fwrite(&this->header, sizeof(this->header), 1, this->file) != 1)
+        fail("cannot write TGA header to file `", filepath, '\'');
+    this->offset = sizeof(this->header);
+}
+
+TGAWriter::~TGAWriter(void)
+{
+    this->close();
+}
+
+void TGAWriter::write_rows(const uint8_t* in, size_t n)
+{
+    assert(this->file != nullptr && "writing to a closed TGAWriter");
+    size_t height = this->header.image_spec.height;
+    if (this->rows_written + n > height)
+        fail("cannot write more than ", height, " rows");
+
+    size_t bytes_width = this->get_bytes_width();
+    if (!this->use_rle) {
+        if (fwrite(in, bytes_width, n, this->file) != n)
+            fail("cannot write image data");
+        this->offset += n * bytes_width;
+    } else {
+        size_t width           = this->header.image_spec.width;
+        size_t bytes_per_pixel = this->header.image_spec.bits_per_pixel / 8;
+        for (size_t i = 0; i < n; i++) {
+            size_t len = rle_encode_row(in + i * bytes_width, width,
+                                        this->rle_row.data(), bytes_per_pixel);
+            if (fwrite(this->rle_row.data(), len, 1, this->file) != 1)
+                fail("cannot write image data");
+            // Truncated offsets are never written, see CLOSE.
+            this->scan_line_tbl.push_back(static_cast<uint32_t>(this->offset));
+            this->offset += len;
+        }
+    }
+    this->rows_written += n;
+}
+
+void TGAWriter::close(void)
+{
+    if (this->file == nullptr) return;
+    size_t height = this->header.image_spec.height;
+    if (this->rows_written != height)
+        fail("closing TGA file after ", this->rows_written, " of ", height,
+             " rows");
+
+    /* Offsets in the extension area and footer are 32 bits. If the file is
+     * too large for them, it ends after the pixel data, like a TGA 1.0 file.
+     */
+    size_t tbl_len = this->scan_line_tbl.size() * sizeof(uint32_t);
+    if (this->offset + tbl_len > UINT32_MAX) {
+        bool ok = fclose(this->file) == 0;
+        this->file = nullptr;
+        if (!ok) fail("cannot write image data");
+        return;
+    }
+
+    TGA::ExtensionArea ext_area {};
+    TGA::update_ext_area(ext_area);
+
+    bool ok = true;
+    if (this->use_rle) {
+        ext_area.scan_line_tbl_offset = this->offset;
+        ok &= fwrite(this->scan_line_tbl.data(), tbl_len, 1, this->file) == 1;
+        this->offset += tbl_len;
+    }
+
+    TGA::Footer footer {};
+    footer.ext_area_offset = this->offset;
+    memcpy(footer.signature, "TRUEVISION-XFILE.\0", sizeof(footer.signature));
+
+    ok &= fwrite(&ext_area, sizeof(ext_area), 1, this->file) == 1;
+    ok &= fwrite(&footer, sizeof(footer), 1, this->file) == 1;
+    ok     &= fclose(this->file) == 0;
+    this->file = nullptr;
+    if (!ok) fail("cannot write TGA footer");
+}
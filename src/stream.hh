@@ -0,0 +1,165 @@
+/* Streaming access to TGA files that are too large to keep in memory.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _STREAM_HH_
+#define _STREAM_HH_
+
+#include <optional>
+#include <vector>
+
+#include "common.hh"
+#include "rle.hh"
+#include "tga.hh"
+
+/* A TGAREADER yields the scanlines of a TGA file in the order in which they
+ * are stored, i.e. bottom to top for a lower-left origin. Rows are decoded
+ * from RLE, but otherwise returned as is: they aren't flipped, and
+ * color-mapped images yield color map indices. Memory use is bounded by a
+ * fixed-size input buffer, no matter the size of the image. SEEK_ROW jumps to
+ * any row; for RLE images, it uses the file's scan line table, as long as
+ * that checks out, or builds one by skipping over packets.
+ */
+class TGAReader final {
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    FILE*                     file = nullptr;
+    TGA::Header               header {};
+    std::vector<uint8_t>      color_map {};
+    std::vector<uint8_t>      image_id_data {};
+    std::optional<RLEDecoder> decoder {};
+    std::vector<uint8_t>      chunk {};
+    size_t                    chunk_pos = 0;
+    size_t                    chunk_len = 0;
+    size_t                    rows_read = 0;
+    size_t                    data_offset = 0;
+    std::vector<uint32_t>     scan_line_tbl {};
+    bool                      is_indexable = true;
+    bool                      has_file_tbl = true;
+
+    void read_rle_row(uint8_t*);
+    bool start_row(size_t);
+    bool index_rows(void);
+    bool read_scan_line_tbl(void);
+
+    // The longest a row can be encoded, with a packet for every pixel.
+    inline size_t get_max_row_len(void) const
+    {
+        return this->get_bytes_width() + this->get_width();
+    }
+
+public:
+    explicit TGAReader(std::string_view);
+    TGAReader(const TGAReader&) = delete;
+    TGAReader(TGAReader&&)      = delete;
+    TGAReader& operator=(const TGAReader&) = delete;
+    TGAReader& operator=(TGAReader&&)      = delete;
+    ~TGAReader(void);
+
+    /* Read up to N rows into OUT, which must hold N * GET_BYTES_WIDTH bytes.
+     * Returns the number of rows read, which is less than N only at the end
+     * of the image.
+     */
+    size_t read_rows(uint8_t*, size_t);
+    inline bool read_row(uint8_t* out) { return this->read_rows(out, 1) == 1; }
+
+    // The next call to READ_ROWS starts at ROW (in file order).
+    void seek_row(size_t);
+
+    // Empty until SEEK_ROW needed a table for an RLE image.
+    inline const std::vector<uint32_t>& get_scan_line_table(void) const
+    {
+        return this->scan_line_tbl;
+    }
+
+    inline size_t get_pixel_width(void) const
+    {
+        size_t bpp = this->header.image_spec.bits_per_pixel;
+        return (bpp / 8) + (bpp % 8 == 0 ? 0 : 1);
+    }
+
+    inline size_t get_bytes_width(void) const
+    {
+        return this->header.image_spec.width * this->get_pixel_width();
+    }
+
+    inline size_t get_width(void) const
+    {
+        return this->header.image_spec.width;
+    }
+
+    inline size_t get_height(void) const
+    {
+        return this->header.image_spec.height;
+    }
+
+    inline size_t get_rows_left(void) const
+    {
+        return this->get_height() - this->rows_read;
+    }
+
+    inline Origin get_origin(void) const
+    {
+        return static_cast<Origin>(this->header.image_spec.descriptor & 0x30);
+    }
+
+    inline const std::vector<uint8_t>& get_color_map(void) const
+    {
+        return this->color_map;
+    }
+};
+
+/* A TGAWRITER accepts scanlines in order and writes them out right away, RLE
+ * encoded if requested. WRITE_OPTIONS.ORIGIN describes the order in which rows
+ * are passed in (lower-left if unset). The extension area and footer (and for
+ * RLE, a scan line table) are written by CLOSE, which is also called on
+ * destruction; files that reach 4 GiB have no room for their 32 bit offsets,
+ * so they get neither. It is a fatal error to close a writer before all rows
+ * were written.
+ */
+class TGAWriter final {
+private:
+    FILE*                 file = nullptr;
+    TGA::Header           header {};
+    bool                  use_rle = false;
+    std::vector<uint8_t>  rle_row {};
+    std::vector<uint32_t> scan_line_tbl {};
+    size_t                rows_written = 0;
+    size_t                offset = 0;
+
+public:
+    TGAWriter(std::string_view, uint16_t, uint16_t, PixelFormat,
+              const WriteOptions& = {});
+    TGAWriter(const TGAWriter&) = delete;
+    TGAWriter(TGAWriter&&)      = delete;
+    TGAWriter& operator=(const TGAWriter&) = delete;
+    TGAWriter& operator=(TGAWriter&&)      = delete;
+    ~TGAWriter(void);
+
+    // IN must hold N rows of GET_BYTES_WIDTH bytes each.
+    void write_rows(const uint8_t*, size_t);
+    inline void write_row(const uint8_t* in) { this->write_rows(in, 1); }
+    void close(void);
+
+    inline size_t get_bytes_width(void) const
+    {
+        return this->header.image_spec.width *
+               (this->header.image_spec.bits_per_pixel / 8);
+    }
+};
+
+#endif /* _STREAM_HH_ */
@@ -0,0 +1,101 @@
+/* texture.cc implements conversion of TGAs into textures and batch sampling.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "texture.hh"
+
+/* Every pixel format goes through TGA::GET_PIXEL into a BGRA8 copy first,
+ * which the mip chain is then built from. This is slow compared to the
+ * typed views, but happens only once per texture.
+ */
+Texture::Texture(const TGA& image, size_t max_levels, size_t threads)
+{
+    size_t width  = image.get_width();
+    size_t height = image.get_height();
+    if (width == 0 || height == 0) fail("cannot make a texture without texels");
+
+    TGA base { static_cast<uint16_t>(width), static_cast<uint16_t>(height) };
+    TGAView<PixelFormat::BGRA8> view = base.view<PixelFormat::BGRA8>();
+    for (size_t r = 0; r < height; r++)
+        for (size_t c = 0; c < width; c++)
+            view.set_pixel(r, c, image.get_pixel(r, c));
+
+    std::vector<TGA> mips = base.build_mip_chain(max_levels, threads);
+    this->add_level(base);
+    for (TGA& mip : mips) this->add_level(mip);
+}
+
+void Texture::add_level(TGA& image)
+{
+    Level l { image.get_width(), image.get_height(),
+              (image.get_width() + BLOCK_SIZE - 1) / BLOCK_SIZE,
+              this->texels.size() };
+    size_t blocks_y = (l.height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    this->texels.resize(l.offset + l.blocks_x * blocks_y * BLOCK_SIZE *
+                                   BLOCK_SIZE);
+
+    /* Padding repeats the last row and column, so that it never shows up,
+     * even if a sampler reads it by mistake.
+     */
+    TGAView<PixelFormat::BGRA8> view = image.view<PixelFormat::BGRA8>();
+    uint32_t* block = this->texels.data() + l.offset;
+    for (size_t by = 0; by < blocks_y; by++) {
+        for (size_t bx = 0; bx < l.blocks_x; bx++) {
+            for (size_t y = 0; y < BLOCK_SIZE; y++) {
+                const uint32_t* row = view.row_pixels(
+                    std::min(by * BLOCK_SIZE + y, l.height - 1));
+                for (size_t x = 0; x < BLOCK_SIZE; x++)
+                    block[y * BLOCK_SIZE + x] =
+                        row[std::min(bx * BLOCK_SIZE + x, l.width - 1)];
+            }
+            block += BLOCK_SIZE * BLOCK_SIZE;
+        }
+    }
+    this->levels.push_back(l);
+}
+
+/* The footprint of a pixel is approximated by the longer of its two sides
+ * in texels of level 0. Each level halves it, so the best level is its
+ * base 2 logarithm, rounded to nearest.
+ */
+size_t Texture::select_level(float dudx, float dvdx, float dudy,
+                             float dvdy) const
+{
+    float w  = static_cast<float>(this->get_width());
+    float h  = static_cast<float>(this->get_height());
+    float dx = std::hypot(dudx * w, dvdx * h);
+    float dy = std::hypot(dudy * w, dvdy * h);
+    float lod = std::log2(std::max({ dx, dy, 1.0f }));
+    float max = static_cast<float>(this->levels.size() - 1);
+    return static_cast<size_t>(std::min(lod + 0.5f, max));
+}
+
+void Texture::sample_nearest(const float* u, const float* v, uint32_t* out,
+                             size_t n, size_t level) const
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = this->sample_nearest(u[i], v[i], level);
+}
+
+void Texture::sample_bilinear(const float* u, const float* v, uint32_t* out,
+                              size_t n, size_t level) const
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = this->sample_bilinear(u[i], v[i], level);
+}
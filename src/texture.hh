@@ -0,0 +1,159 @@
+/* Textures with a cache-friendly texel layout and a mip chain for sampling.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _TEXTURE_HH_
+#define _TEXTURE_HH_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "common.hh"
+#include "tga.hh"
+
+/* A TEXTURE holds an image and its mip levels as 32 bit texels B | G << 8 |
+ * R << 16 | A << 24, the layout of BGRA8 rows. Texels aren't stored row by
+ * row, but in blocks of 4 by 4, one block after the other. A block is a
+ * single 64 byte cache line, so a bilinear footprint mostly hits one line,
+ * and walking the texture along any direction touches about the same number
+ * of lines. Levels are padded to whole blocks.
+ *
+ * Texture coordinates U and V run from 0 to 1 across the image, with V = 0 at
+ * the bottom row, like pixel coordinates of a TGA. Coordinates outside of
+ * that wrap around, as long as they are smaller than 2^31 in magnitude.
+ * Sampling has no branches, so loops over many samples vectorize.
+ */
+class Texture final {
+public:
+    static constexpr size_t BLOCK_SIZE = 4;
+
+private:
+    struct Level final {
+        size_t width;
+        size_t height;
+        size_t blocks_x;
+        size_t offset;   // of the first texel in TEXELS
+    };
+
+    std::vector<Level>    levels {};
+    std::vector<uint32_t> texels {};
+
+    void add_level(TGA&);
+
+    inline uint32_t fetch(const Level& l, size_t x, size_t y) const
+    {
+        size_t block = (y / BLOCK_SIZE) * l.blocks_x + x / BLOCK_SIZE;
+        return this->texels[l.offset + block * BLOCK_SIZE * BLOCK_SIZE +
+                            (y % BLOCK_SIZE) * BLOCK_SIZE + x % BLOCK_SIZE];
+    }
+
+    /* Without SSE4.1, std::floor is a library call, which would dominate
+     * the cost of a sample. The comparison must stay in integers, or it
+     * becomes a branch that mispredicts on every other sample.
+     */
+    static inline int32_t floor(float f)
+    {
+        int32_t i = static_cast<int32_t>(f);
+        return i - static_cast<int32_t>(static_cast<float>(i) > f);
+    }
+
+    // Blend two texels by W / 256, two channels at a time.
+    static inline uint32_t lerp(uint32_t a, uint32_t b, uint32_t w)
+    {
+        constexpr uint32_t MASK  = 0x00ff00ff;
+        constexpr uint32_t ROUND = 0x00800080;
+        uint32_t rb = ((a & MASK) * (256 - w) + (b & MASK) * w + ROUND) >> 8;
+        uint32_t ga = ((a >> 8) & MASK) * (256 - w) +
+                      ((b >> 8) & MASK) * w + ROUND;
+        return (rb & MASK) | (ga & ~MASK);
+    }
+
+public:
+    /* Convert IMAGE, which can have any pixel format, and build at most
+     * MAX_LEVELS mip levels on top of it, using THREADS threads.
+     */
+    explicit Texture(const TGA& image, size_t max_levels = SIZE_MAX,
+                     size_t threads = 1);
+
+    // The number of levels, including level 0.
+    inline size_t get_level_count(void) const { return this->levels.size(); }
+    inline size_t get_width(size_t level = 0) const
+    {
+        return this->levels[level].width;
+    }
+    inline size_t get_height(size_t level = 0) const
+    {
+        return this->levels[level].height;
+    }
+
+    inline uint32_t get_texel(size_t x, size_t y, size_t level = 0) const
+    {
+        const Level& l = this->levels[level];
+        assert(x < l.width && y < l.height);
+        return this->fetch(l, x, y);
+    }
+
+    /* The level whose texels are closest to the size of a pixel, given the
+     * change of U and V from one pixel to the next in X and in Y.
+     */
+    size_t select_level(float dudx, float dvdx, float dudy, float dvdy) const;
+
+    inline uint32_t sample_nearest(float u, float v, size_t level = 0) const
+    {
+        const Level& l = this->levels[level];
+        int64_t w = l.width, h = l.height;
+        int64_t x = static_cast<int64_t>((u - floor(u)) * w);
+        int64_t y = static_cast<int64_t>((v - floor(v)) * h);
+        // A fraction just below 1 can round up to the width.
+        return this->fetch(l, std::min(x, w - 1), std::min(y, h - 1));
+    }
+
+    /* The four texels around (U, V), weighted by 1/256 steps. Texel centers
+     * are at half-integer positions. Neighbours wrap around at the edges.
+     */
+    inline uint32_t sample_bilinear(float u, float v, size_t level = 0) const
+    {
+        const Level& l = this->levels[level];
+        int64_t w  = l.width, h = l.height;
+        float   fx = (u - floor(u)) * w - 0.5f;
+        float   fy = (v - floor(v)) * h - 0.5f;
+        int64_t x0 = floor(fx), y0 = floor(fy);
+        auto    wx = static_cast<uint32_t>((fx - x0) * 256.0f);
+        auto    wy = static_cast<uint32_t>((fy - y0) * 256.0f);
+
+        // X0 is in [-1, W - 1] and X1 in [0, W], and likewise for Y.
+        int64_t x1 = x0 + 1, y1 = y0 + 1;
+        x0 += w & -static_cast<int64_t>(x0 < 0);
+        y0 += h & -static_cast<int64_t>(y0 < 0);
+        x1 -= w & -static_cast<int64_t>(x1 >= w);
+        y1 -= h & -static_cast<int64_t>(y1 >= h);
+
+        uint32_t bottom = lerp(this->fetch(l, x0, y0), this->fetch(l, x1, y0),
+                               wx);
+        uint32_t top    = lerp(this->fetch(l, x0, y1), this->fetch(l, x1, y1),
+                               wx);
+        return lerp(bottom, top, wy);
+    }
+
+    // Sample the N coordinates at U and V into OUT.
+    void sample_nearest(const float* u, const float* v, uint32_t* out,
+                        size_t n, size_t level = 0) const;
+    void sample_bilinear(const float* u, const float* v, uint32_t* out,
+                         size_t n, size_t level = 0) const;
+};
+
+#endif /* _TEXTURE_HH_ */
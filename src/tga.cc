@@ -21,48 +21,346 @@
  *  2. We should re-visit the documentation to ensure compliance.
  *  3. We assume less about the input format and program more defensively.
  */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
 #include <cstring>
+#include <filesystem>
 
 #include "tga.hh"
 #include "io.hh"
+#include "kernels.hh"
+#include "parallel.hh"
+#include "rle.hh"
+#include "source.hh"
 
-TGA::TGA(uint16_t width, uint16_t height, const Pixel& bg_pixel)
+TGA::TGA(uint16_t width, uint16_t height, const Pixel& bg_pixel,
+         BufferPool* pool)
 {
-    /* We need to at least setup the header, footer and image data fields.
-     * Everything we don't explicitly set can be left 0-initialized.
-     */
-    this->header.image_type                = 0x2; // unencoded, true-color
-    this->header.image_spec.width          = width;
-    this->header.image_spec.height         = height;
-    this->header.image_spec.bits_per_pixel = 0x20; // 4 bytes per pixel
-    this->header.image_spec.descriptor     = 0x8;  // 1 byte alpha channel
+    this->init_header(width, height, PixelFormat::BGRA8, Origin::LowerLeft);
+    this->image_data.use_pool(pool);
+    this->image_data.resize(this->get_bytes_width() * this->get_height(), 0);
+    this->fill(bg_pixel);
+}
+
+/* These constructors wrap pixel data that the caller already has, e.g. the
+ * color buffer of a renderer, so it can be written to disk without a copy.
+ */
+TGA::TGA(uint16_t width, uint16_t height, PixelFormat format,
+         std::vector<uint8_t>&& pixels, Origin origin)
+{
+    this->init_header(width, height, format, origin);
+    if (pixels.size() != this->get_image_data_len())
+        fail("pixel buffer doesn't match the image size");
+    this->image_data.adopt(std::move(pixels));
+}
+
+TGA::TGA(uint16_t width, uint16_t height, PixelFormat format,
+         std::span<uint8_t> pixels, Origin origin)
+{
+    this->init_header(width, height, format, origin);
+    if (pixels.size() != this->get_image_data_len())
+        fail("pixel buffer doesn't match the image size");
+    this->image_data.borrow(pixels.data(), pixels.size());
+}
+
+/* We need to at least setup the header and footer of a new image. Everything
+ * we don't explicitly set can be left 0-initialized.
+ */
+void TGA::init_header(uint16_t width, uint16_t height, PixelFormat format,
+                      Origin origin)
+{
+    this->header.image_type        = format == PixelFormat::Gray8 ? 0x3 : 0x2;
+    this->header.image_spec.width  = width;
+    this->header.image_spec.height = height;
+    switch (format) {
+    case PixelFormat::BGRA8: this->header.image_spec.bits_per_pixel = 32; break;
+    case PixelFormat::BGR8:  this->header.image_spec.bits_per_pixel = 24; break;
+    case PixelFormat::Gray8: this->header.image_spec.bits_per_pixel = 8;  break;
+    }
+
+    // Only BGRA8 has an alpha channel of 8 bits.
+    uint8_t alpha_bits = format == PixelFormat::BGRA8 ? 0x8 : 0x0;
+    this->header.image_spec.descriptor =
+        alpha_bits | static_cast<uint8_t>(origin);
 
     memcpy(this->footer.signature, "TRUEVISION-XFILE.\0",
            sizeof(this->footer.signature));
+}
 
-    this->image_data.resize(this->get_bytes_width() * this->get_height(), 0);
-    for (size_t row = 0; row < this->get_height(); row++)
-        for (size_t col = 0; col < this->get_width(); col++)
-            this->set_pixel(row, col, bg_pixel);
+/* Hand the pixel data back to the caller, e.g. to reuse it for the next
+ * frame. Borrowed and mapped pixels are copied first. Afterwards, the image
+ * is empty, i.e. 0 by 0 pixels.
+ */
+std::vector<uint8_t> TGA::release(void)
+{
+    this->header.image_spec.width  = 0;
+    this->header.image_spec.height = 0;
+    this->scan_line_tbl.clear();
+    return this->image_data.release();
 }
 
 /* This constructor is used to read a TGA file at FILEPATH into memory. It can
  * then be modified and written back to disk. Note that we keep all data in
- * memory at all times. Right now, it seems like a premature optimization to
- * change that.
+ * memory at all times. Images that don't fit into memory can be processed
+ * scanline by scanline with TGAREADER and TGAWRITER instead (see stream.hh).
+ * With OPTIONS.USE_MMAP, uncompressed pixel data stays in the page cache and
+ * is never copied unless we need to modify its layout.
+ */
+TGA::TGA(std::string_view filepath, const LoadOptions& options)
+{
+    ScopedTimer timer { Timer::Load };
+    this->image_data.use_pool(options.pool);
+    if (options.use_mmap)
+        this->map_file(filepath, options);
+    else
+        this->read_file(filepath, options);
+
+    this->finish_load(options);
+}
+
+/* These constructors parse a file whose bytes were already loaded by someone
+ * else, e.g. the I/O threads of a TGALOADER (see loader.hh).
+ */
+TGA::TGA(MappedFile&& file, const LoadOptions& options)
+{
+    ScopedTimer timer { Timer::Load };
+    this->image_data.use_pool(options.pool);
+    this->load_bytes(std::move(file), options);
+    this->finish_load(options);
+}
+
+TGA::TGA(std::vector<uint8_t>&& file, const LoadOptions& options)
+{
+    ScopedTimer timer { Timer::Load };
+    this->image_data.use_pool(options.pool);
+    this->load_bytes(std::move(file), options);
+    this->finish_load(options);
+}
+
+void TGA::finish_load(const LoadOptions& options)
+{
+    // Now, the image is no longer RLE encoded (even if it was before).
+    this->header.image_type &= 0xf7;
+
+    if (!options.keep_indexed) this->expand_pixels(options.threads);
+
+    /* By default, we guarantee a coordinate system that starts in the
+     * lower-left corner. With OPTIONS.KEEP_ORIGIN, we keep the file's layout
+     * and let the pixel accessors remap coordinates instead.
+     */
+    if (!options.keep_origin)
+        this->set_origin(Origin::LowerLeft, options.threads);
+
+    // The stamp was just parsed, so nobody else shares it yet.
+    if (this->postage_stamp) this->postage_stamp->finish_load(options);
+}
+
+/* Build an image from a complete file that is already in memory, e.g. one
+ * that was received over the network. Everything is parsed in place; only
+ * uncompressed pixel data is copied once, into the image's own buffer.
+ */
+TGA TGA::from_memory(std::span<const uint8_t> bytes,
+                     const LoadOptions& options)
+{
+    ScopedTimer timer { Timer::Load };
+    TGA image {};
+    image.image_data.use_pool(options.pool);
+
+    MemorySource source { bytes };
+    std::optional<size_t> pos = image.parse_source(source, options);
+    if (pos) image.read_image_data(source, *pos, options.threads);
+
+    image.finish_load(options);
+    return image;
+}
+
+TGAInfo TGA::probe(std::string_view filepath)
+{
+    return TGA::probe_source(FileSource { filepath });
+}
+
+TGAInfo TGA::probe(std::span<const uint8_t> bytes)
+{
+    return TGA::probe_source(MemorySource { bytes });
+}
+
+std::vector<TGAInfo> TGA::probe_many(std::span<const std::string> paths,
+                                     size_t threads)
+{
+    // Probing is bound by I/O latency, so we want many reads in flight.
+    std::vector<TGAInfo> infos(paths.size());
+    parallel_for(paths.size(), threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            infos[i] = TGA::probe(paths[i]);
+    });
+    return infos;
+}
+
+std::vector<std::pair<std::string, TGAInfo>>
+TGA::probe_directory(std::string_view dirpath, size_t threads)
+{
+    // We build without exceptions, so we must use the ERROR_CODE overloads.
+    namespace fs = std::filesystem;
+    std::error_code err {};
+    fs::directory_iterator it { fs::path { dirpath }, err };
+    if (err) fail("cannot open directory `", dirpath, '\'');
+
+    std::vector<std::string> paths {};
+    for (; it != fs::directory_iterator {}; it.increment(err)) {
+        if (err) fail("cannot list directory `", dirpath, '\'');
+        std::string ext = it->path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        if (ext == ".tga" && it->is_regular_file(err))
+            paths.push_back(it->path().string());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<TGAInfo> infos = TGA::probe_many(paths, threads);
+    std::vector<std::pair<std::string, TGAInfo>> result {};
+    result.reserve(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+        result.emplace_back(std::move(paths[i]), std::move(infos[i]));
+    return result;
+}
+
+TGAInfo TGA::probe_source(const ByteSource& source)
+{
+    Header header {};
+    if (source.size() < sizeof(header))
+        fail("cannot read TGA header from file");
+    size_t pos = 0;
+    source.read(reinterpret_cast<uint8_t*>(&header), sizeof(header), pos,
+                "header");
+    TGA::check_header(header);
+
+    TGAInfo info {};
+    info.file_size                = source.size();
+    info.width                    = header.image_spec.width;
+    info.height                   = header.image_spec.height;
+    info.bits_per_pixel           = header.image_spec.bits_per_pixel;
+    info.alpha_bits               = header.image_spec.descriptor & 0xf;
+    info.image_type               = header.image_type;
+    info.is_rle                   = header.image_type & 0x8;
+    info.origin = static_cast<Origin>(header.image_spec.descriptor & 0x30);
+    info.color_map_type           = header.color_map_type;
+    info.color_map_length         = header.color_map_spec.length;
+    info.color_map_bits_per_pixel = header.color_map_spec.bits_per_pixel;
+    info.id_length                = header.id_length;
+
+    Footer footer {};
+    if (source.size() < sizeof(header) + sizeof(footer)) return info;
+    pos = source.size() - sizeof(footer);
+    source.read(reinterpret_cast<uint8_t*>(&footer), sizeof(footer), pos,
+                "footer");
+    info.is_new_format = TGA::has_signature(footer);
+
+    pos = footer.ext_area_offset;
+    if (!info.is_new_format || pos == 0 ||
+        source.available(pos) < sizeof(ExtensionArea))
+        return info;
+
+    ExtensionArea ext_area {};
+    source.read(reinterpret_cast<uint8_t*>(&ext_area), sizeof(ext_area), pos,
+                "extension area");
+    info.has_ext_area            = true;
+    info.scan_line_tbl_offset    = ext_area.scan_line_tbl_offset;
+    info.postage_stamp_offset    = ext_area.postage_stamp_offset;
+    info.color_correction_offset = ext_area.color_correction_offset;
+
+    // The strings should be terminated, but we don't rely on it.
+    info.author_name.assign(ext_area.author_name,
+        strnlen(ext_area.author_name, sizeof(ext_area.author_name)));
+    info.software_id.assign(ext_area.software_id,
+        strnlen(ext_area.software_id, sizeof(ext_area.software_id)));
+    return info;
+}
+
+void TGA::read_file(std::string_view filepath, const LoadOptions& options)
+{
+    FileSource source { filepath };
+    std::optional<size_t> pos = this->parse_source(source, options);
+    if (pos) this->read_image_data(source, *pos, options.threads);
+}
+
+/* Like READ_FILE, but we map the whole file into memory and parse it in place.
+ * Only RLE images and images that need an origin flip end up with a private
+ * pixel buffer, all other images alias the mapping.
+ */
+void TGA::map_file(std::string_view filepath, const LoadOptions& options)
+{
+    this->load_bytes(MappedFile { filepath }, options);
+}
+
+/* Parse a complete file that is already in memory. Uncompressed pixel data
+ * isn't copied, the pixel buffer takes over FILE and aliases it instead.
  */
-TGA::TGA(std::string_view filepath)
+void TGA::load_bytes(MappedFile&& file, const LoadOptions& options)
+{
+    MemorySource source { { file.data(), file.size() } };
+    std::optional<size_t> pos = this->parse_source(source, options);
+    if (pos) this->image_data.alias(std::move(file), *pos,
+                                    this->get_image_data_len());
+}
+
+void TGA::load_bytes(std::vector<uint8_t>&& file, const LoadOptions& options)
 {
-    FILE* file_ptr = fopen(filepath.data(), "rb");
-    if (file_ptr == nullptr) fail("cannot open file `", filepath, '\'');
+    MemorySource source { file };
+    std::optional<size_t> pos = this->parse_source(source, options);
+    if (pos) this->image_data.adopt(std::move(file), *pos,
+                                    this->get_image_data_len());
+}
 
+/* Parse a complete file from SOURCE. RLE data is decoded right away, in place
+ * if SOURCE is in memory. Uncompressed pixel data isn't touched. Instead, we
+ * return its offset, so the caller can either read it (READ_IMAGE_DATA) or
+ * attach the bytes to the pixel buffer without a copy.
+ */
+std::optional<size_t> TGA::parse_source(const ByteSource& source,
+                                        const LoadOptions& options)
+{
+    size_t pos    = this->parse_metadata(source);
+    size_t length = this->get_image_data_len();
+    bool   is_rle = this->header.image_type & 0x8;
+    add_count(Counter::BytesDecoded, length);
+    if (!is_rle) return pos;
+
+    /* The encoded data can be larger than the decoded one (raw packets add a
+     * byte), so we decode from everything up to the end of the file. Sources
+     * that aren't in memory are read into scratch memory first.
+     */
+    size_t         buf_len = source.available(pos);
+    const uint8_t* buf     = source.view(pos, buf_len);
+    if (buf == nullptr) {
+        uint8_t* scratch = ScratchArena::for_this_thread().get(buf_len);
+        size_t   buf_pos = pos;
+        source.read(scratch, buf_len, buf_pos, "image data");
+        buf = scratch;
+    }
+    this->read_rle_image_data(buf, buf_len, length, options.threads);
+    return std::nullopt;
+}
+
+/* Parse everything but the pixel data and return the offset of the latter.
+ * For uncompressed images, we also make sure that all pixels are there.
+ */
+size_t TGA::parse_metadata(const ByteSource& source)
+{
     /* TGA is a simple file format with header, footer and variable-sized
      * fields inbetween them. TGA v2.0 defines a developer area and an
      * extension field, but we don't care about those. With warnings enabled,
      * we do print messages if they exist, though.
      */
-    TGA::parse_header(file_ptr);
+    this->parse_header(source);
+    size_t pos = sizeof(this->header);
 
     /* TGA has 3 variable length fields (length in parens), that follow right
      * after the fixed-sized header:
@@ -73,8 +371,7 @@ TGA::TGA(std::string_view filepath)
     {
         size_t length = header.id_length;
         this->image_id_data.resize(length, 0);
-        TGA::read_n_bytes(this->image_id_data.data(), length, "image id",
-                          file_ptr);
+        source.read(this->image_id_data.data(), length, pos, "image id");
     }
 
     {
@@ -85,245 +382,1330 @@ TGA::TGA(std::string_view filepath)
         size_t length = this->header.color_map_spec.length * bytes_per_entry;
 
         this->color_map.resize(length, 0);
-        TGA::read_n_bytes(this->color_map.data(), length, "color map",
-                          file_ptr);
+        source.read(this->color_map.data(), length, pos, "color map");
+    }
+
+    this->check_pixel_format();
+
+    /* The footer might point to a scan line table that we want to have before
+     * decoding, and it must be parsed before the pixel buffer takes the bytes.
+     */
+    this->parse_footer(source);
+
+    size_t length = this->get_image_data_len();
+    bool is_rle = this->header.image_type & 0x8;
+    if (!is_rle && source.available(pos) < length)
+        fail_short_read(length, source.available(pos), "image data");
+    return pos;
+}
+
+/* All the metadata fits into a few small reads, the stamp being the largest
+ * of them. Pixel data is never touched.
+ */
+std::optional<TGA> TGA::load_postage_stamp(std::string_view filepath,
+                                           const LoadOptions& options)
+{
+    TGA image {};
+    FileSource source { filepath };
+    image.parse_metadata(source);
+    if (!image.postage_stamp) return std::nullopt;
+
+    TGA stamp { std::move(*image.postage_stamp) };
+    stamp.finish_load(options);
+    return stamp;
+}
+
+/* Load only the W by H pixels whose lower-left corner is at column X and row
+ * Y (in the same coordinates as GET_PIXEL). The result is an image of its
+ * own, with the pixel format and layout of the file, before LOADOPTIONS are
+ * applied. For uncompressed files, we only read the bytes of the region. For
+ * RLE files, see READ_RLE_REGION. Either way, memory use is bounded by the
+ * region and a few scanlines, not by the image.
+ */
+TGA TGA::load_region(std::string_view filepath, size_t x, size_t y, size_t w,
+                     size_t h, const LoadOptions& options)
+{
+    TGA image {};
+    image.image_data.use_pool(options.pool);
+
+    FileSource source { filepath };
+    size_t data_pos = image.parse_metadata(source);
+
+    size_t width  = image.get_width();
+    size_t height = image.get_height();
+    if (w == 0 || h == 0 || x > width || w > width - x || y > height ||
+        h > height - y)
+        fail("region of ", w, 'x', h, " pixels at (", x, ", ", y,
+             ") is out of bounds");
+
+    // The region is a sub-rectangle of the stored layout, see GET_BYTE_POS.
+    uint8_t origin      = image.header.image_spec.descriptor & 0x30;
+    size_t  first_row   = origin & 0x20 ? height - y - h : y;
+    size_t  first_col   = origin & 0x10 ? width - x - w : x;
+    size_t  bpp         = image.get_pixel_width();
+    size_t  bytes_width = image.get_bytes_width();
+    size_t  region_width = w * bpp;
+
+    image.image_data.resize(region_width * h, 0);
+    uint8_t* out = image.image_data.data();
+    if (!(image.header.image_type & 0x8)) {
+        // Full-width regions are contiguous, so each band is a single read.
+        bool contiguous = region_width == bytes_width;
+        parallel_for(h, options.threads, [&](size_t begin, size_t end) {
+            size_t pos = data_pos + (first_row + begin) * bytes_width +
+                         first_col * bpp;
+            if (contiguous) {
+                source.read(out + begin * region_width,
+                            (end - begin) * region_width, pos, "image data");
+                return;
+            }
+            for (size_t i = begin; i < end; i++) {
+                size_t row_pos = pos + (i - begin) * bytes_width;
+                source.read(out + i * region_width, region_width, row_pos,
+                            "image data");
+            }
+        });
+    } else {
+        image.read_rle_region(source, data_pos, first_row, first_col, w, h);
     }
 
-    // @INCOMPLETE: We must decode color-maps into actual pixel data.
-    if (this->header.color_map_type == 0x1) {
-        assert((this->header.image_type & 0x7) == 0x1);
-        assert(this->color_map.size() > 0);
-        fail("color-mapped images aren't supported");
+    // Neither the file's scan line table nor its stamp describe the region.
+    image.header.image_spec.width  = w;
+    image.header.image_spec.height = h;
+    image.scan_line_tbl.clear();
+    image.postage_stamp.reset();
+
+    image.finish_load(options);
+    return image;
+}
+
+/* Copy uncompressed pixel data at POS of SOURCE into the pixel buffer. Bands
+ * of rows are read by THREADS threads, which is faster for files in the page
+ * cache (or on fast storage) than a single large read.
+ */
+void TGA::read_image_data(const ByteSource& source, size_t pos,
+                          size_t threads)
+{
+    this->image_data.resize(this->get_image_data_len(), 0);
+
+    size_t   bytes_width = this->get_bytes_width();
+    uint8_t* data        = this->image_data.data();
+    parallel_for(this->get_height(), threads, [&](size_t begin, size_t end) {
+        size_t band_pos = pos + begin * bytes_width;
+        source.read(data + begin * bytes_width, (end - begin) * bytes_width,
+                    band_pos, "image data");
+    });
+}
+
+/* This check must run after the color map was read and before any pixel data
+ * is touched. Afterwards, EXPAND_PIXELS can rely on a known layout.
+ */
+void TGA::check_pixel_format(void)
+{
+    uint8_t kind = this->header.image_type & 0x7;
+    int     bpp  = this->header.image_spec.bits_per_pixel;
+    switch (kind) {
+    case 0x1: {
+        int entry_bpp = this->header.color_map_spec.bits_per_pixel;
+        if (this->header.color_map_type != 0x1 || this->color_map.empty())
+            fail("color-mapped image without a color map");
+        if (bpp != 8 && bpp != 16)
+            fail("color map indices with ", bpp, " bits aren't supported");
+        if (entry_bpp != 15 && entry_bpp != 16 && entry_bpp != 24 &&
+            entry_bpp != 32)
+            fail("color map entries with ", entry_bpp,
+                 " bits aren't supported");
+        return;
     }
+    case 0x2:
+        // @INCOMPLETE: We cannot work with 15 or 16 bit true-color images.
+        if (this->get_pixel_width() < 3)
+            fail("other pixel formats than RGB(A) aren't support");
+        return;
+    case 0x3:
+        if (bpp != 8 && bpp != 16)
+            fail("gray-scale images with ", bpp, " bits aren't supported");
+        return;
+    default:
+        fail("images of type ", static_cast<int>(kind), " aren't supported");
+    }
+}
+
+std::optional<PixelFormat> TGA::get_pixel_format(void) const
+{
+    uint8_t kind = this->header.image_type & 0x7;
+    uint8_t bpp  = this->header.image_spec.bits_per_pixel;
+    if (kind == 0x2 && bpp == 32) return PixelFormat::BGRA8;
+    if (kind == 0x2 && bpp == 24) return PixelFormat::BGR8;
+    if (kind == 0x3 && bpp == 8)  return PixelFormat::Gray8;
+    return std::nullopt;
+}
 
-    // @INCOMPLETE: We must decode grayscale images into actual pixel data.
-    if (this->header.color_map_type == 0x0) {
-        if ((this->header.image_type & 0x7) == 0x3)
-            fail("gray-scale images aren't supported");
+/* Stamps are stored in the extension area with a single byte per dimension.
+ * Formats must match exactly, since the file has just one pixel format.
+ */
+void TGA::set_postage_stamp(const TGA& stamp)
+{
+    size_t width  = stamp.get_width();
+    size_t height = stamp.get_height();
+    if (width == 0 || height == 0 || width > 255 || height > 255)
+        fail("postage stamp of ", width, 'x', height, " pixels is too large");
+    if ((stamp.header.image_type & 0x7) != (this->header.image_type & 0x7) ||
+        stamp.get_pixel_width() != this->get_pixel_width())
+        fail("postage stamp must have the same pixel format as the image");
+
+    TGA copy { stamp };
+    copy.header.id_length = 0;
+    copy.image_id_data.clear();
+    copy.scan_line_tbl.clear();
+    copy.postage_stamp.reset();
+    this->postage_stamp = std::make_shared<TGA>(std::move(copy));
+}
+
+/* Levels are built in bands of rows of the image. Every band yields whole
+ * rows of the first BAND_LEVELS levels, and each of those rows is read back
+ * for the next level while it is still in cache. Thus, the bulk of the work
+ * is a single pass over the image, with bands spread across threads. The
+ * remaining levels are at most 1/1024 of the image and follow level by
+ * level.
+ */
+std::vector<TGA> TGA::build_mip_chain(size_t max_levels, size_t threads) const
+{
+    std::optional<PixelFormat> format = this->get_pixel_format();
+    if (!format) fail("cannot build mip levels for this pixel format");
+
+    std::vector<TGA> levels {};
+    size_t width  = this->get_width();
+    size_t height = this->get_height();
+    if (width == 0 || height == 0) return levels;
+
+    while (levels.size() < max_levels && (width > 1 || height > 1)) {
+        width  = std::max(width / 2, size_t { 1 });
+        height = std::max(height / 2, size_t { 1 });
+        TGA level {};
+        level.init_header(width, height, *format, this->get_origin());
+        level.header.image_spec.descriptor = this->header.image_spec.descriptor;
+        level.image_data.resize(level.get_image_data_len());
+        levels.push_back(std::move(level));
     }
+    if (levels.empty()) return levels;
 
-    // @INCOMPLETE: We cannot work with anything than RGB(A) images for now.
-    if (this->get_pixel_width() < 3)
-        fail("other pixel formats than RGB(A) aren't support");
+    size_t bpp = this->get_pixel_width();
+    auto halve = [bpp](TGA& dst, const TGA& src, size_t begin, size_t end) {
+        size_t         bytes_width = src.get_bytes_width();
+        size_t         last        = src.get_height() - 1;
+        const uint8_t* data        = src.image_data.data();
+        for (size_t r = begin; r < end; r++) {
+            const uint8_t* row0 = data + std::min(2*r, last) * bytes_width;
+            const uint8_t* row1 = data + std::min(2*r + 1, last) * bytes_width;
+            downsample_2x2(dst.image_data.data() + r * dst.get_bytes_width(),
+                           row0, row1, dst.get_width(), src.get_width(), bpp);
+        }
+    };
 
-    size_t length = this->header.image_spec.height *
-        this->header.image_spec.width * this->get_pixel_width();
-    bool is_rle = this->header.image_type & 0x8;
-    if (!is_rle) {
-        this->image_data.resize(length, 0);
-        TGA::read_n_bytes(this->image_data.data(), length, "image data",
-                          file_ptr);
-    } else {
-        // For RLE encoded images, we decode them right here.
-        uint8_t* buf = new uint8_t[length];
-        size_t count = fread(buf, sizeof(uint8_t), length, file_ptr);
-        this->read_rle_image_data(buf, count, length);
-        delete[] buf;
+    constexpr size_t BAND_LEVELS = 5;
+    size_t blocked   = std::min(levels.size(), BAND_LEVELS);
+    size_t band_rows = size_t { 1 } << blocked;
+    size_t bands     = (this->get_height() + band_rows - 1) / band_rows;
+    parallel_for(bands, threads, [&](size_t begin, size_t end) {
+        for (size_t band = begin; band < end; band++) {
+            const TGA* src = this;
+            for (size_t l = 0; l < blocked; l++) {
+                TGA&   dst   = levels[l];
+                size_t rows  = band_rows >> (l + 1);
+                size_t first = std::min(band * rows, dst.get_height());
+                halve(dst, *src, first,
+                      std::min(first + rows, dst.get_height()));
+                src = &dst;
+            }
+        }
+    });
+
+    for (size_t l = blocked; l < levels.size(); l++) {
+        TGA&       dst = levels[l];
+        const TGA& src = levels[l-1];
+        parallel_for(dst.get_height(), threads, [&](size_t begin, size_t end) {
+            halve(dst, src, begin, end);
+        });
     }
+    return levels;
+}
 
-    // Now, the image is no longer RLE encoded (even if it was before).
-    this->header.image_type &= 0xf7;
+TGA TGA::make_thumbnail(size_t max_size, size_t threads) const
+{
+    max_size = std::max(max_size, size_t { 1 });
+    size_t width  = this->get_width();
+    size_t height = this->get_height();
+    size_t n      = 0;
+    for (; width > max_size || height > max_size; n++) {
+        width  = std::max(width / 2, size_t { 1 });
+        height = std::max(height / 2, size_t { 1 });
+    }
 
-    /* We guarantee a coordinate system that starts in the lower-left corner.
-     * Thus, we need to flip  some pictures vertically/horizontally.
-     * @BUG: correct??
-     */
-    if (this->header.image_spec.descriptor & 0x20)
-        this->flip_image_vertically();
-    if (this->header.image_spec.descriptor & 0x10)
-        this->flip_image_horizontally();
-    this->header.image_spec.descriptor &= 0xcf;
+    if (n == 0) {
+        TGA copy { *this };
+        copy.postage_stamp.reset();
+        return copy;
+    }
+    std::vector<TGA> levels = this->build_mip_chain(n, threads);
+    return std::move(levels.back());
+}
 
-    TGA::parse_footer(file_ptr);
+/* Physically re-arrange the pixel data so that it starts at ORIGIN. Flipping
+ * must never write through to a mapped file or to borrowed pixels, so we copy
+ * the pixels first.
+ */
+void TGA::set_origin(Origin origin, size_t threads)
+{
+    uint8_t current = this->header.image_spec.descriptor & 0x30;
+    uint8_t diff    = current ^ static_cast<uint8_t>(origin);
+    if (diff == 0) return;
+
+    this->image_data.materialize();
+    if (diff & 0x20) this->flip_image_vertically(threads);
+    if (diff & 0x10) this->flip_image_horizontally(threads);
+    this->header.image_spec.descriptor =
+        (this->header.image_spec.descriptor & 0xcf) |
+        static_cast<uint8_t>(origin);
 
-    fclose(file_ptr);
+    // Dirty spans refer to the stored layout, so they flip along with it.
+    SavedFile& saved = this->saved;
+    size_t     width = this->get_width(), height = this->get_height();
+    if (diff & 0x20 && !saved.rows.empty()) {
+        std::reverse(saved.rows.begin(), saved.rows.end());
+        if (saved.dirty_begin < saved.dirty_end) {
+            size_t begin      = height - saved.dirty_end;
+            saved.dirty_end   = height - saved.dirty_begin;
+            saved.dirty_begin = begin;
+        }
+    }
+    if (diff & 0x10) {
+        for (DirtySpan& span : saved.rows) {
+            if (span.lo >= span.hi) continue;
+            span = { static_cast<uint16_t>(width - span.hi),
+                     static_cast<uint16_t>(width - span.lo) };
+        }
+    }
 }
 
 void TGA::read_n_bytes(uint8_t* out, size_t n, const char* name, FILE* file)
 {
     size_t ret = fread(out, sizeof(uint8_t), n, file);
-    if (ret != n) {
-        char msg[4096];
-        snprintf(msg, 4095, "expected to read 0x%lx bytes in field `%s', "
-                 "got only 0x%lx bytes (%g%%)", n, name, ret,
-                 (float)ret / (float)n);
-        fail(msg);
-    }
+    if (ret != n) fail_short_read(n, ret, name);
 }
 
-/* The caller must ensure that the read pointer of FILE is at the start of the
- * TGA file. After PARSE_HEADER returned, the read pointer will be at the first
- * byte _after_ the header. We perform a few checks to ensure that the header
- * is well formed).
+/* The header is always at the start of the file. We perform a few checks to
+ * ensure that the header is well formed.
  */
-void TGA::parse_header(FILE* file)
+void TGA::parse_header(const ByteSource& source)
 {
     // @NOTE: TGA headers are little-endian, so we don't need to convert ints.
-    size_t ret = fread(&this->header, sizeof(this->header), 1, file);
-    if (ret != 1) fail("cannot read TGA header from file");
+    if (source.size() < sizeof(this->header))
+        fail("cannot read TGA header from file");
+    size_t pos = 0;
+    source.read(reinterpret_cast<uint8_t*>(&this->header),
+                sizeof(this->header), pos, "header");
+    TGA::check_header(this->header);
+}
 
-    if (this->header.color_map_type == 0) {
+void TGA::check_header(const Header& header)
+{
+    if (header.color_map_type == 0) {
         bool malformed = false;
-        malformed |= this->header.color_map_spec.bits_per_pixel != 0;
-        malformed |= this->header.color_map_spec.first_entry_index != 0;
-        malformed |= this->header.color_map_spec.length != 0;
+        malformed |= header.color_map_spec.bits_per_pixel != 0;
+        malformed |= header.color_map_spec.first_entry_index != 0;
+        malformed |= header.color_map_spec.length != 0;
         if (malformed) fail("malformed TGA header");
     }
 
-    if (this->header.image_spec.width  == 0 ||
-        this->header.image_spec.height == 0 ||
-        this->header.image_spec.bits_per_pixel == 0)
+    if (header.image_spec.width  == 0 ||
+        header.image_spec.height == 0 ||
+        header.image_spec.bits_per_pixel == 0)
         fail("in the header, one of image width/height/bpp was set =0");
 }
 
 /* @NOTE: Requires a valid buffer of BUF_LEN length to read from. DATA_LEN is
  * the length of the _decoded_ data that we calculated using width, height and
- * pixel depth values from the header.
+ * pixel depth values from the header. Packets are decoded straight into the
+ * pre-sized pixel buffer, RLE_DECODE checks all reads and writes.
  */
-void TGA::read_rle_image_data(uint8_t* buf, size_t buf_len, size_t data_len)
+void TGA::read_rle_image_data(const uint8_t* buf, size_t buf_len,
+                              size_t data_len, size_t threads)
 {
-    auto is_rle_packet  { [](uint8_t b) -> bool   { return b & 0x80; } };
-    auto get_run_length { [](uint8_t b) -> size_t { return (b & 0x7f) + 1; } };
-    size_t bytes_per_pixel = this->get_pixel_width();
+    this->image_data.resize(data_len);
 
-    /* We're going to use PUSH_BACK for appending, so we RESERVE and don't
-     * RESIZE the vector. Probably an unnecessary optimization.
+    /* Indexing only looks at packet headers, so it's cheap compared to RLE.
+     * With multiple threads, we need the index up front to split the data
+     * into bands. Otherwise, we index only what the decoder consumed.
      */
-    this->image_data.clear();
-    this->image_data.reserve(this->get_bytes_width() * this->get_height());
+    size_t bpp = this->get_pixel_width();
+    if (threads != 1 && this->scan_line_tbl.empty()) {
+        RLERowIndexer indexer { bpp, this->get_bytes_width(),
+                                this->get_height() };
+        indexer.scan(buf, buf_len, this->get_image_data_offset());
+        if (indexer.is_indexable())
+            this->scan_line_tbl = std::move(indexer.get_offsets());
+    }
 
-    // @BUG: We don't check before reading from BUF _within_ the loop.
-    size_t pos = 0;
-    while (data_len > 0 && buf_len > 0) {
-        bool   parse_rle_packet = is_rle_packet(buf[pos]);
-        size_t run_len = get_run_length(buf[pos++]);
-        data_len -= run_len * bytes_per_pixel;
-        if (parse_rle_packet) {
-            while (run_len-- > 0)
-                for (size_t i = 0; i < bytes_per_pixel; i++)
-                    this->image_data.push_back(buf[pos+i]);
-            pos += bytes_per_pixel;
-        } else {
-            while (run_len-- > 0) {
-                for (size_t i = 0; i < bytes_per_pixel; i++)
-                    this->image_data.push_back(buf[pos++]);
+    if (threads != 1 && this->read_rle_bands(buf, buf_len, threads)) return;
+
+    size_t consumed = rle_decode(buf, buf_len, this->image_data.data(),
+                                 data_len, bpp);
+    if (this->scan_line_tbl.empty()) {
+        RLERowIndexer indexer { bpp, this->get_bytes_width(),
+                                this->get_height() };
+        indexer.scan(buf, consumed, this->get_image_data_offset());
+        if (indexer.is_indexable())
+            this->scan_line_tbl = std::move(indexer.get_offsets());
+    }
+}
+
+/* Decode H stored rows of RLE data, starting with FIRST_ROW, and keep the W
+ * pixels from column FIRST_COL of each. We need the offset of every row, so
+ * we try the file's scan line table first, then index the packet headers
+ * without decoding any pixels. Only if packets cross scanlines do we have to
+ * decode everything up to the region.
+ */
+void TGA::read_rle_region(const ByteSource& source, size_t data_pos,
+                          size_t first_row, size_t first_col, size_t w,
+                          size_t h)
+{
+    if (this->read_rle_rows(source, this->scan_line_tbl, first_row, first_col,
+                            w, h, false))
+        return;
+
+    constexpr size_t CHUNK_SIZE = 64 * 1024;
+    size_t bpp         = this->get_pixel_width();
+    size_t bytes_width = this->get_bytes_width();
+    std::vector<uint8_t> chunk(CHUNK_SIZE);
+
+    /* Rows past the region don't matter, except for where the first of
+     * them starts, which is where the last row of the region ends.
+     */
+    size_t rows = std::min(first_row + h + 1, this->get_height());
+    RLERowIndexer indexer { bpp, bytes_width, rows };
+    size_t pos = data_pos;
+    while (!indexer.is_done()) {
+        size_t len = std::min(chunk.size(), source.available(pos));
+        if (len == 0) fail("RLE data ends before the last row");
+        size_t chunk_pos = pos;
+        source.read(chunk.data(), len, pos, "image data");
+        indexer.scan(chunk.data(), len, chunk_pos);
+    }
+    if (indexer.is_indexable()) {
+        this->read_rle_rows(source, indexer.get_offsets(), first_row,
+                            first_col, w, h, true);
+        return;
+    }
+
+    // Packets cross scanlines, so all we can do is decode up to the region.
+    RLEDecoder decoder { bpp };
+    std::vector<uint8_t> row(bytes_width);
+    size_t region_width = w * bpp;
+    size_t chunk_pos = 0, chunk_len = 0;
+    pos = data_pos;
+    for (size_t r = 0; r < first_row + h; r++) {
+        size_t total = 0;
+        while (total < bytes_width) {
+            if (chunk_pos == chunk_len) {
+                chunk_len = std::min(chunk.size(), source.available(pos));
+                chunk_pos = 0;
+                if (chunk_len == 0)
+                    fail("RLE data ends in row ", r, " of ",
+                         this->get_height());
+                source.read(chunk.data(), chunk_len, pos, "image data");
             }
+            size_t produced = 0;
+            chunk_pos += decoder.decode(chunk.data() + chunk_pos,
+                                        chunk_len - chunk_pos,
+                                        row.data() + total,
+                                        bytes_width - total, produced);
+            total += produced;
         }
+        if (r >= first_row)
+            memcpy(this->image_data.data() + (r - first_row) * region_width,
+                   row.data() + first_col * bpp, region_width);
     }
-    assert(data_len == 0 && (pos + sizeof(Footer) == buf_len));
+}
+
+/* Decode the rows of a region via the row offsets TBL, reading only their
+ * encoded bytes. TBL must cover the rows up to the one after the region, if
+ * there is one. Without packets that cross scanlines, no row can encode to
+ * more than one header byte per pixel plus the pixels themselves. A table
+ * that came with the file isn't TRUSTED: each row must decode from exactly
+ * the bytes between its offset and the next one, otherwise we return false.
+ */
+bool TGA::read_rle_rows(const ByteSource& source,
+                        std::span<const uint32_t> tbl, size_t first_row,
+                        size_t first_col, size_t w, size_t h, bool trusted)
+{
+    size_t height      = this->get_height();
+    size_t bpp         = this->get_pixel_width();
+    size_t bytes_width = this->get_bytes_width();
+    size_t max_row_len = bytes_width + this->get_width();
+    size_t last_row    = first_row + h;
+    if (tbl.size() < std::min(last_row + 1, height) ||
+        tbl[0] != this->get_image_data_offset())
+        return false;
+
+    size_t start    = tbl[first_row];
+    for (size_t r = first_row + 1; r < std::min(last_row + 1, height); r++)
+        if (tbl[r] < tbl[r-1] || tbl[r] - tbl[r-1] > max_row_len) return false;
+    size_t stop = last_row < height
+                      ? tbl[last_row]
+                      : tbl[height-1] +
+                        std::min(max_row_len, source.available(tbl[height-1]));
+    if (stop > source.size()) return false;
+
+    uint8_t* encoded = ScratchArena::for_this_thread().get(stop - start);
+    size_t   pos     = start;
+    source.read(encoded, stop - start, pos, "image data");
+
+    std::vector<uint8_t> row(bytes_width);
+    size_t region_width = w * bpp;
+    for (size_t r = first_row; r < last_row; r++) {
+        size_t offset = tbl[r] - start;
+        size_t len    = (r + 1 < height ? tbl[r+1] : stop) - tbl[r];
+        size_t used   = rle_try_decode(encoded + offset, len, row.data(),
+                                       bytes_width, bpp);
+        if (used == RLE_DECODE_ERROR || (r + 1 < height && used != len)) {
+            if (!trusted) return false;
+            fail("RLE data of row ", r, " is malformed");
+        }
+        memcpy(this->image_data.data() + (r - first_row) * region_width,
+               row.data() + first_col * bpp, region_width);
+    }
+    return true;
+}
+
+/* Decode bands of rows in parallel, using the scan line table to find where
+ * each band starts. A table that came with the file might be wrong, so every
+ * band must end exactly where the next one starts. Otherwise, we return false
+ * and the caller decodes serially, which guarantees the same result.
+ */
+bool TGA::read_rle_bands(const uint8_t* buf, size_t buf_len, size_t threads)
+{
+    const std::vector<uint32_t>& tbl = this->scan_line_tbl;
+    size_t height = this->get_height();
+    size_t base   = this->get_image_data_offset();
+    if (tbl.size() != height || tbl[0] != base) return false;
+    for (size_t r = 1; r < height; r++)
+        if (tbl[r] < tbl[r-1] || tbl[r] - base > buf_len) return false;
+
+    size_t   bpp         = this->get_pixel_width();
+    size_t   bytes_width = this->get_bytes_width();
+    uint8_t* data        = this->image_data.data();
+    std::atomic<bool> ok { true };
+    parallel_for(height, threads, [&](size_t begin, size_t end) {
+        size_t start = tbl[begin] - base;
+        size_t stop  = end < height ? tbl[end] - base : buf_len;
+        size_t used  = rle_try_decode(buf + start, stop - start,
+                                      data + begin * bytes_width,
+                                      (end - begin) * bytes_width, bpp);
+        if (used == RLE_DECODE_ERROR || (end < height && used != stop - start))
+            ok = false;
+    });
+    return ok;
 }
 
 /* In case this TGA file doesn't follow the v2 spec, the footer we read is not
- * valid. That fact can be queried via the member IS_NEW_FORMAT. After calling
- * PARSE_FOOTER, the caller can no longer rely on the read pointer of FILE to
- * be at a specific position.
+ * valid. That fact can be queried via the member IS_NEW_FORMAT. The footer and
+ * extension area are read at their own offsets in SOURCE, so the position the
+ * caller parses the rest of the file from is left as it was.
  */
-void TGA::parse_footer(FILE* file)
+void TGA::parse_footer(const ByteSource& source)
 {
-    const size_t seek_pos = -26;
-    assert(!fseek(file, seek_pos, SEEK_END));
+    if (source.size() < sizeof(this->footer))
+        fail("cannot read last ", sizeof(this->footer), " bytes from file");
+    size_t pos = source.size() - sizeof(this->footer);
+    source.read(reinterpret_cast<uint8_t*>(&this->footer),
+                sizeof(this->footer), pos, "footer");
 
-    size_t ret = fread(&this->footer, sizeof(this->footer), 1, file);
-    if (ret != 1) fail("cannot read last ", -seek_pos, " bytes from file");
+    this->check_footer();
+    if (this->footer.ext_area_offset != 0)
+        this->parse_ext_area(source);
+}
 
-    if (!strncmp(this->footer.signature, "TRUEVISION-XFILE.", 18))
-        this->is_new_format = true;
-    else
-        this->is_new_format = false;
+bool TGA::has_signature(const Footer& footer)
+{
+    return !strncmp(footer.signature, "TRUEVISION-XFILE.", 18);
+}
+
+void TGA::check_footer(void)
+{
+    this->is_new_format = TGA::has_signature(this->footer);
+
+    // Without a signature, the last bytes of the file are just pixel data.
+    if (!this->is_new_format) {
+        this->footer.ext_area_offset = 0;
+        this->footer.dev_dir_offset  = 0;
+    }
 
     if (this->footer.dev_dir_offset != 0)
         warn("there is a developer area that we don't parse");
-    if (this->footer.ext_area_offset != 0)
-        this->parse_ext_area(file);
 }
 
-/* After calling PARSE_EXT_AREA, the caller can no longer rely on the read
- * pointer of FILE to be at a specific position.
- */
-void TGA::parse_ext_area(FILE* file)
+void TGA::parse_ext_area(const ByteSource& source)
 {
-    assert(!fseek(file, this->footer.ext_area_offset, SEEK_SET));
+    size_t pos = this->footer.ext_area_offset;
+    if (source.available(pos) < sizeof(ext_area))
+        fail("extension area offset 0x", std::hex, pos, " is out of bounds");
+    source.read(reinterpret_cast<uint8_t*>(&this->ext_area),
+                sizeof(this->ext_area), pos, "extension area");
+    this->check_ext_area();
+    if (this->ext_area.scan_line_tbl_offset != 0)
+        this->read_scan_line_tbl(source);
+    if (this->ext_area.postage_stamp_offset != 0)
+        this->read_postage_stamp(source);
+}
 
-    fread(&this->ext_area, sizeof(ext_area), 1, file);
+void TGA::check_ext_area(void)
+{
     assert(this->ext_area.length == TGA::EXT_AREA_SIZE);
 
     // @NOTE: We aren't using any of the following extension area fields.
     if (this->ext_area.color_correction_offset != 0)
         warn("there is a color correction table that we don't parse");
-    if (this->ext_area.postage_stamp_offset != 0)
-        warn("there is a postage stamp that we don't parse");
-    if (this->ext_area.scan_line_tbl_offset != 0)
-        warn("there is a scan line table that we don't parse");
 }
 
-void TGA::write_to_file(std::string_view filepath)
+// The table has one little-endian 4 byte offset per scanline.
+void TGA::read_scan_line_tbl(const ByteSource& source)
 {
-    FILE* outfile = fopen(filepath.data(), "wb");
-    if (!outfile) fail("cannot open file `", filepath, '\'');
+    size_t pos = this->ext_area.scan_line_tbl_offset;
+    this->scan_line_tbl.resize(this->get_height());
+    source.read(reinterpret_cast<uint8_t*>(this->scan_line_tbl.data()),
+                this->get_height() * sizeof(uint32_t), pos,
+                "scan line table");
+}
 
+/* The stamp starts with its width and height of a single byte each, followed
+ * by uncompressed pixels in the format of the image. It shares the color map
+ * of the image, so the stamp gets a copy to be expanded with.
+ */
+void TGA::read_postage_stamp(const ByteSource& source)
+{
+    size_t  pos = this->ext_area.postage_stamp_offset;
+    uint8_t size[2];
+    source.read(size, sizeof(size), pos, "postage stamp size");
+    if (size[0] == 0 || size[1] == 0) return;
+
+    TGA stamp {};
+    stamp.header                   = this->header;
+    stamp.header.image_type       &= 0xf7;
+    stamp.header.id_length         = 0;
+    stamp.header.image_spec.width  = size[0];
+    stamp.header.image_spec.height = size[1];
+    stamp.color_map                = this->color_map;
+    stamp.image_data.resize(stamp.get_image_data_len());
+    source.read(stamp.image_data.data(), stamp.image_data.size(), pos,
+                "postage stamp");
+    this->postage_stamp = std::make_shared<TGA>(std::move(stamp));
+}
+
+template<typename T>
+static std::span<const uint8_t> as_bytes_of(const T& value)
+{
+    return { reinterpret_cast<const uint8_t*>(&value), sizeof(value) };
+}
+
+/* Lay out the parts of the file that WRITE_TO_FILE or WRITE_TO_MEMORY produce
+ * up to the pixel data. Uncompressed pixel data points straight into the
+ * image, RLE data is encoded by the caller while the file is written.
+ */
+void TGA::prepare_write(const WriteOptions& options, Header& file_header,
+                        FileParts& parts)
+{
     assert((this->get_bytes_width()*this->get_height()) ==
             this->image_data.size());
-    assert(this->header.color_map_spec.length == this->color_map.size());
+    assert(this->get_image_data_offset() == sizeof(this->header) +
+           this->image_id_data.size() + this->color_map.size());
     assert(this->header.id_length == this->image_id_data.size());
+    add_count(Counter::PixelsWritten, this->get_width() * this->get_height());
+
+    if (options.origin) this->set_origin(*options.origin);
+
+    // In memory, pixel data is never encoded. Only the file might be.
+    file_header = this->header;
+    if (options.use_rle) file_header.image_type |= 0x8;
+
+    parts = {};
+    parts[0] = as_bytes_of(file_header);
+    parts[1] = this->image_id_data;
+    parts[2] = this->color_map;
+    if (!options.use_rle)
+        parts[PIXEL_PART] = { this->image_data.data(),
+                              this->image_data.size() };
+}
+
+// The size of the file with PIXELS_LEN bytes of (possibly encoded) pixels.
+size_t TGA::get_file_len(size_t pixels_len, bool use_rle) const
+{
+    size_t len = this->get_image_data_offset() + pixels_len;
+    if (use_rle) len += this->get_height() * sizeof(uint32_t);
+    if (this->postage_stamp)
+        len += this->postage_stamp_size.size() +
+               this->postage_stamp->image_data.size();
+    return len + sizeof(this->ext_area) + sizeof(this->footer);
+}
+
+/* Lay out the parts after PIXELS_LEN bytes of pixel data, with every offset
+ * computed up front. For RLE data, SCAN_LINE_TBL must already describe the
+ * encoded rows; we write it right between pixel data and extension area, so
+ * readers can seek to individual rows. Returns the size of the file.
+ */
+size_t TGA::finish_write(size_t pixels_len, bool use_rle, FileParts& parts)
+{
+    if (!use_rle) this->scan_line_tbl.clear();
+    assert(this->scan_line_tbl.size() == (use_rle ? this->get_height() : 0));
+
+    size_t data_offset = this->get_image_data_offset();
+    this->ext_area.scan_line_tbl_offset =
+        use_rle ? data_offset + pixels_len : 0;
+    std::span<const uint8_t> scan_line_tbl {
+        reinterpret_cast<const uint8_t*>(this->scan_line_tbl.data()),
+        this->scan_line_tbl.size() * sizeof(uint32_t) };
+
+    /* The postage stamp comes next. Its pixels are stored just like the
+     * image's, so if the image was flipped since, the stamp must follow.
+     */
+    size_t stamp_offset = data_offset + pixels_len + scan_line_tbl.size();
+    std::span<const uint8_t> stamp_size {}, stamp_pixels {};
+    this->ext_area.postage_stamp_offset = 0;
+    if (this->postage_stamp) {
+        if (this->postage_stamp->get_origin() != this->get_origin()) {
+            TGA stamp { *this->postage_stamp };
+            stamp.set_origin(this->get_origin());
+            this->postage_stamp = std::make_shared<TGA>(std::move(stamp));
+        }
+        const TGA& stamp = *this->postage_stamp;
+        assert(stamp.get_pixel_width() == this->get_pixel_width());
+        this->postage_stamp_size = {
+            static_cast<uint8_t>(stamp.get_width()),
+            static_cast<uint8_t>(stamp.get_height()) };
+        stamp_size   = this->postage_stamp_size;
+        stamp_pixels = { stamp.image_data.data(), stamp.image_data.size() };
+        this->ext_area.postage_stamp_offset = stamp_offset;
+    }
 
-    fwrite(&this->header, sizeof(this->header), 1, outfile);
-    fwrite(this->color_map.data(), this->color_map.size(), 1, outfile);
-    fwrite(this->image_id_data.data(), this->image_id_data.size(), 1, outfile);
-    fwrite(this->image_data.data(), this->image_data.size(), 1, outfile);
+    // We don't write any of these, so offsets from a parsed file are stale.
+    this->ext_area.color_correction_offset = 0;
 
     this->footer.dev_dir_offset = 0; // if it even existed in the first place
-    this->footer.ext_area_offset = ftell(outfile);
-    this->update_ext_area();
-    fwrite(&this->ext_area, sizeof(this->ext_area), 1, outfile);
-    fwrite(&this->footer, sizeof(this->footer), 1, outfile);
+    this->footer.ext_area_offset =
+        stamp_offset + stamp_size.size() + stamp_pixels.size();
+    TGA::update_ext_area(this->ext_area);
+
+    parts[4] = scan_line_tbl;
+    parts[5] = stamp_size;
+    parts[6] = stamp_pixels;
+    parts[7] = as_bytes_of(this->ext_area);
+    parts[8] = as_bytes_of(this->footer);
+    size_t size = this->footer.ext_area_offset + sizeof(this->ext_area) +
+                  sizeof(this->footer);
+    assert(size == this->get_file_len(pixels_len, use_rle));
+    return size;
+}
+
+// Returns the end of what was copied into OUT.
+uint8_t* TGA::copy_parts(std::span<const std::span<const uint8_t>> parts,
+                         uint8_t* out)
+{
+    for (const auto& part : parts) {
+        if (part.empty()) continue;
+        memcpy(out, part.data(), part.size());
+        out += part.size();
+    }
+    return out;
+}
+
+/* Encode rows FIRST, ..., FIRST+N-1 into OUT, which must hold N times
+ * RLE_MAX_ENCODED_LEN bytes, and record in TBL where each of them starts,
+ * with OFFSET being the file offset of OUT[0]. Returns the bytes written.
+ */
+size_t TGA::encode_rle_rows(size_t first, size_t n, uint8_t* out,
+                            uint32_t* tbl, size_t offset) const
+{
+    size_t width           = this->get_width();
+    size_t bytes_per_pixel = this->get_pixel_width();
+    size_t bytes_width     = this->get_bytes_width();
+    const uint8_t* src     = this->image_data.data();
 
-    fclose(outfile);
+    size_t len = 0;
+    for (size_t r = first; r < first + n; r++) {
+        tbl[r] = offset + len;
+        len += rle_encode_row(src + r*bytes_width, width, out + len,
+                              bytes_per_pixel);
+    }
+    return len;
+}
+
+/* All PARTS are submitted with a single WRITEV. We only loop for short
+ * writes, which regular files don't do in practice.
+ */
+void TGA::write_parts(int fd, std::span<const std::span<const uint8_t>> parts,
+                      std::string_view filepath)
+{
+    std::array<struct iovec, std::tuple_size_v<FileParts>> iov {};
+    assert(parts.size() <= iov.size());
+    size_t size = 0, count = parts.size();
+    for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = const_cast<uint8_t*>(parts[i].data());
+        iov[i].iov_len  = parts[i].size();
+        size += parts[i].size();
+    }
+
+    size_t written = 0, first = 0;
+    while (written < size) {
+        ssize_t ret = writev(fd, iov.data() + first, count - first);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) fail("cannot write file `", filepath, '\'');
+        written += ret;
+
+        // Skip what was written, which may end in the middle of a part.
+        size_t n = ret;
+        while (first < count && n >= iov[first].iov_len)
+            n -= iov[first++].iov_len;
+        if (n > 0) {
+            uint8_t* base = static_cast<uint8_t*>(iov[first].iov_base);
+            iov[first].iov_base = base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+}
+
+/* RLE data is encoded and written in bands of about RLE_BAND_BYTES, so that
+ * we never hold more than that of it, however large the image.
+ */
+static constexpr size_t RLE_BAND_BYTES = size_t { 1 } << 20;
+
+/* Create a file next to PATH that no one else uses, and store its name in
+ * TEMP. If PATH exists, the new file gets its permissions.
+ */
+static int open_temp_file(const std::string& path, std::string& temp)
+{
+    static std::atomic<size_t> counter { 0 };
+    int fd = -1;
+    do {
+        temp = path + ".tmp" + std::to_string(getpid()) + '_' +
+               std::to_string(counter++);
+        fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (fd < 0 && errno == EEXIST);
+
+    struct stat file_stat {};
+    if (fd >= 0 && stat(path.c_str(), &file_stat) == 0)
+        fchmod(fd, file_stat.st_mode & 07777);
+    return fd;
+}
+
+/* An uncompressed file is a single WRITEV. For RLE, the parts before pixel
+ * data go first, then the bands, then the rest, once offsets are known.
+ *
+ * The file is written under a temporary name and then renamed over
+ * FILEPATH. Truncating FILEPATH instead would pull the pages from under an
+ * image that was mapped from it (see LoadOptions::USE_MMAP), e.g. this one.
+ */
+void TGA::write_to_file(std::string_view filepath, const WriteOptions& options)
+{
+    ScopedTimer timer { Timer::Write };
+    Header    file_header {};
+    FileParts parts {};
+    this->prepare_write(options, file_header, parts);
+
+    // FILEPATH is not guaranteed to be null-terminated, so we make a copy.
+    std::string path { filepath }, temp {};
+    int fd = open_temp_file(path, temp);
+    if (fd < 0) fail("cannot open file `", filepath, '\'');
+
+    if (!options.use_rle) {
+        this->finish_write(this->image_data.size(), false, parts);
+        TGA::write_parts(fd, parts, filepath);
+    } else {
+        std::span<const std::span<const uint8_t>> all { parts };
+        TGA::write_parts(fd, all.first(PIXEL_PART), filepath);
+
+        size_t max_row_len = rle_max_encoded_len(this->get_width(),
+                                                 this->get_pixel_width());
+        size_t band_rows   = std::max<size_t>(1, RLE_BAND_BYTES / max_row_len);
+        uint8_t* band = ScratchArena::for_this_thread().get(
+            std::min(band_rows, this->get_height()) * max_row_len);
+
+        std::vector<uint32_t> tbl(this->get_height());
+        size_t data_offset = this->get_image_data_offset(), len = 0;
+        for (size_t r = 0; r < this->get_height(); r += band_rows) {
+            size_t n = std::min(band_rows, this->get_height() - r);
+            std::span<const uint8_t> encoded {
+                band, this->encode_rle_rows(r, n, band, tbl.data(),
+                                            data_offset + len) };
+            TGA::write_parts(fd, { &encoded, 1 }, filepath);
+            len += encoded.size();
+        }
+        this->scan_line_tbl = std::move(tbl);
+        this->finish_write(len, true, parts);
+        TGA::write_parts(fd, all.subspan(PIXEL_PART + 1), filepath);
+    }
+
+    if (close(fd) != 0 || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        fail("cannot write file `", filepath, '\'');
+    }
+}
+
+void TGA::save_incremental(std::string_view filepath,
+                           const WriteOptions& options)
+{
+    if (options.origin) this->set_origin(*options.origin);
+    if (this->patch_saved_file(filepath, options.use_rle)) return;
+    this->write_to_file(filepath, options);
+    this->track_saved_file(filepath, options.use_rle);
+}
+
+// Start tracking changes against the file that was just written.
+void TGA::track_saved_file(std::string_view filepath, bool use_rle)
+{
+    SavedFile& saved = this->saved;
+    saved.path   = filepath;
+    saved.header = this->header;
+    if (use_rle) saved.header.image_type |= 0x8;
+    saved.postage_stamp = this->postage_stamp;
+    saved.data_offset   = this->get_image_data_offset();
+    saved.data_len      = use_rle
+                        ? this->ext_area.scan_line_tbl_offset -
+                          saved.data_offset
+                        : this->image_data.size();
+    saved.scan_line_tbl.clear();
+    if (use_rle) saved.scan_line_tbl = this->scan_line_tbl;
+    if (stat(saved.path.c_str(), &saved.file_stat) != 0)
+        fail("cannot stat file `", filepath, '\'');
+    saved.rows.assign(this->get_height(), {});
+    saved.dirty_begin = SIZE_MAX;
+    saved.dirty_end   = 0;
+}
+
+// A byte range of the file and what to write there.
+struct FilePatch final {
+    const uint8_t* src    = nullptr;
+    size_t         len    = 0;
+    size_t         offset = 0;
+};
+
+static void write_patch(int fd, const FilePatch& patch,
+                        std::string_view filepath)
+{
+    size_t written = 0;
+    while (written < patch.len) {
+        ssize_t ret = pwrite(fd, patch.src + written, patch.len - written,
+                             patch.offset + written);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) fail("cannot write file `", filepath, '\'');
+        written += ret;
+    }
+}
+
+// Adjacent ranges, both in memory and in the file, go out as one write.
+static void add_patch(int fd, FilePatch& pending, const FilePatch& patch,
+                      std::string_view filepath)
+{
+    if (pending.src + pending.len == patch.src &&
+        pending.offset + pending.len == patch.offset) {
+        pending.len += patch.len;
+        return;
+    }
+    if (pending.len > 0) write_patch(fd, pending, filepath);
+    pending = patch;
+}
+
+static bool is_same_file(const struct stat& a, const struct stat& b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+           a.st_size == b.st_size && a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+           a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+/* Returns false, without touching the file, if it must be written in full.
+ * For RLE data, all dirty scanlines are encoded before anything is written,
+ * so that a scanline that doesn't fit leaves the file as it was.
+ */
+bool TGA::patch_saved_file(std::string_view filepath, bool use_rle)
+{
+    SavedFile& saved = this->saved;
+    Header file_header = this->header;
+    if (use_rle) file_header.image_type |= 0x8;
+    if (saved.rows.size() != this->get_height() || saved.path != filepath ||
+        memcmp(&file_header, &saved.header, sizeof(file_header)) != 0 ||
+        saved.postage_stamp != this->postage_stamp ||
+        this->image_data.size() != this->get_image_data_len() ||
+        (use_rle && saved.scan_line_tbl.size() != this->get_height()))
+        return false;
+
+    ScopedTimer timer { Timer::Write };
+    int fd = open(saved.path.c_str(), O_WRONLY);
+    if (fd < 0) return false;
+    struct stat file_stat {};
+    if (fstat(fd, &file_stat) != 0 ||
+        !is_same_file(file_stat, saved.file_stat)) {
+        close(fd);
+        return false;
+    }
+
+    size_t bytes_per_pixel = this->get_pixel_width();
+    size_t bytes_width     = this->get_bytes_width();
+    size_t begin = saved.dirty_begin, end = saved.dirty_end;
+    if (begin >= end) return close(fd) == 0;
+
+    // An RLE row ends where the next one starts, or where pixel data ends.
+    const std::vector<uint32_t>& tbl = saved.scan_line_tbl;
+    auto get_row_end = [&](size_t r) -> size_t {
+        return r + 1 < tbl.size() ? tbl[r + 1]
+                                  : saved.data_offset + saved.data_len;
+    };
+    const uint8_t* encoded = nullptr;
+    if (use_rle) {
+        size_t max_row_len = rle_max_encoded_len(this->get_width(),
+                                                 bytes_per_pixel);
+        size_t total = 0;
+        for (size_t r = begin; r < end; r++)
+            if (saved.rows[r].lo < saved.rows[r].hi)
+                total += get_row_end(r) - tbl[r];
+        uint8_t* out = ScratchArena::for_this_thread().get(total + max_row_len);
+        uint8_t* scratch = out + total;
+        encoded = out;
+
+        const uint8_t* src = this->image_data.data();
+        for (size_t r = begin; r < end; r++) {
+            if (saved.rows[r].lo >= saved.rows[r].hi) continue;
+            size_t len = get_row_end(r) - tbl[r];
+            if (!rle_encode_row_exact(src + r * bytes_width,
+                                      this->get_width(), out, len,
+                                      bytes_per_pixel, scratch)) {
+                close(fd);
+                return false;
+            }
+            out += len;
+        }
+    }
+
+    FilePatch pending {};
+    for (size_t r = begin; r < end; r++) {
+        const DirtySpan& span = saved.rows[r];
+        if (span.lo >= span.hi) continue;
+        FilePatch patch {};
+        if (use_rle) {
+            patch = { encoded, get_row_end(r) - tbl[r], tbl[r] };
+            encoded += patch.len;
+        } else {
+            size_t pos = r * bytes_width + span.lo * bytes_per_pixel;
+            patch = { this->image_data.data() + pos,
+                      (span.hi - span.lo) * bytes_per_pixel,
+                      saved.data_offset + pos };
+        }
+        add_patch(fd, pending, patch, filepath);
+    }
+    if (pending.len > 0) write_patch(fd, pending, filepath);
+
+    if (fstat(fd, &saved.file_stat) != 0 || close(fd) != 0)
+        fail("cannot write file `", filepath, '\'');
+    std::fill(saved.rows.begin() + begin, saved.rows.begin() + end,
+              DirtySpan {});
+    saved.dirty_begin = SIZE_MAX;
+    saved.dirty_end   = 0;
+    return true;
+}
+
+/* Serialize the image into OUT, exactly as WRITE_TO_FILE would write it.
+ * Either way, we return the size of the file, so a caller can retry with a
+ * larger buffer. OPTIONS.ORIGIN is applied first, even if OUT turns out to
+ * be too small; past that, such a call leaves the image as it was, but RLE
+ * data might have been written into OUT already.
+ */
+size_t TGA::write_to_memory(std::span<uint8_t> out,
+                            const WriteOptions& options)
+{
+    ScopedTimer timer { Timer::Write };
+    Header    file_header {};
+    FileParts parts {};
+    this->prepare_write(options, file_header, parts);
+    std::span<const std::span<const uint8_t>> all { parts };
+
+    if (!options.use_rle) {
+        size_t size = this->get_file_len(this->image_data.size(), false);
+        if (out.size() < size) return size;
+        this->finish_write(this->image_data.size(), false, parts);
+        TGA::copy_parts(all, out.data());
+        return size;
+    }
+
+    /* Rows are encoded straight into OUT while they are sure to fit, then
+     * into a row buffer, just to find out how large the file is.
+     */
+    size_t   max_row_len = rle_max_encoded_len(this->get_width(),
+                                               this->get_pixel_width());
+    uint8_t* row = ScratchArena::for_this_thread().get(max_row_len);
+    std::vector<uint32_t> tbl(this->get_height());
+    size_t data_offset = this->get_image_data_offset(), len = 0;
+    for (size_t r = 0; r < this->get_height(); r++) {
+        size_t pos = data_offset + len;
+        if (pos + max_row_len <= out.size()) {
+            len += this->encode_rle_rows(r, 1, out.data() + pos, tbl.data(),
+                                         pos);
+            continue;
+        }
+        size_t n = this->encode_rle_rows(r, 1, row, tbl.data(), pos);
+        if (pos + n <= out.size()) memcpy(out.data() + pos, row, n);
+        len += n;
+    }
+
+    size_t size = this->get_file_len(len, true);
+    if (out.size() < size) return size;
+    this->scan_line_tbl = std::move(tbl);
+    this->finish_write(len, true, parts);
+    TGA::copy_parts(all.first(PIXEL_PART), out.data());
+    TGA::copy_parts(all.subspan(PIXEL_PART + 1),
+                    out.data() + data_offset + len);
+    return size;
+}
+
+// The vector is grown row by row, so it never holds more than the file.
+std::vector<uint8_t> TGA::write_to_memory(const WriteOptions& options)
+{
+    ScopedTimer timer { Timer::Write };
+    Header    file_header {};
+    FileParts parts {};
+    this->prepare_write(options, file_header, parts);
+    std::span<const std::span<const uint8_t>> all { parts };
+
+    if (!options.use_rle) {
+        std::vector<uint8_t> out(
+            this->finish_write(this->image_data.size(), false, parts));
+        TGA::copy_parts(all, out.data());
+        return out;
+    }
+
+    size_t max_row_len = rle_max_encoded_len(this->get_width(),
+                                             this->get_pixel_width());
+    size_t data_offset = this->get_image_data_offset();
+    std::vector<uint8_t>  out(data_offset);
+    std::vector<uint32_t> tbl(this->get_height());
+    for (size_t r = 0; r < this->get_height(); r++) {
+        size_t pos = out.size();
+        out.resize(pos + max_row_len);
+        out.resize(pos + this->encode_rle_rows(r, 1, out.data() + pos,
+                                               tbl.data(), pos));
+    }
+
+    size_t len = out.size() - data_offset;
+    this->scan_line_tbl = std::move(tbl);
+    out.resize(this->finish_write(len, true, parts));
+    TGA::copy_parts(all.first(PIXEL_PART), out.data());
+    TGA::copy_parts(all.subspan(PIXEL_PART + 1),
+                    out.data() + data_offset + len);
+    return out;
 }
 
 // @NOTE: The extension area is actually inspected by the FILE command.
-void TGA::update_ext_area(void)
+void TGA::update_ext_area(ExtensionArea& ext_area)
 {
-    this->ext_area.length   = TGA::EXT_AREA_SIZE;
-    assert(sizeof(this->ext_area) == TGA::EXT_AREA_SIZE);
+    ext_area.length = TGA::EXT_AREA_SIZE;
+    assert(sizeof(ext_area) == TGA::EXT_AREA_SIZE);
     const char* author_name = "Daniel Schuette";
-    memcpy(this->ext_area.author_name, author_name, strlen(author_name)+1);
+    memcpy(ext_area.author_name, author_name, strlen(author_name)+1);
     /* @INCOMPLETE: there are more things we could write here. Also, if we
      * parsed an extension area, we aren't overwriting values that are now
      * wrong, like date of creation, etc.
      */
 }
 
-void TGA::flip_image_vertically(void)
+void TGA::flip_image_vertically(size_t threads)
 {
-    for (size_t row = 0; row < this->get_height() / 2; row++) {
-        size_t flip_row = this->get_height() - row - 1;
-        for (size_t col = 0; col < this->get_bytes_width(); col++)
-            std::swap(
-                this->image_data[row      * this->get_bytes_width() + col],
-                this->image_data[flip_row * this->get_bytes_width() + col]
-            );
-    }
+    ScopedTimer timer { Timer::FlipVertical };
+    size_t   bytes_width = this->get_bytes_width();
+    size_t   height      = this->get_height();
+    uint8_t* data        = this->image_data.data();
+    parallel_for(height / 2, threads, [=](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++) {
+            size_t flip_row = height - row - 1;
+            swap_bytes(data + row * bytes_width,
+                       data + flip_row * bytes_width, bytes_width);
+        }
+    });
 }
 
-void TGA::flip_image_horizontally(void)
+void TGA::flip_image_horizontally(size_t threads)
 {
+    ScopedTimer timer { Timer::FlipHorizontal };
     /* We need to be careful to not pull apart the bytes of the middle pixel in
-     * each line. Thus, we do our calculations on a per-pixel basis and
-     * multiply with the byte stride afterwards.
+     * each line. Thus, REVERSE_PIXELS works on whole pixels and we just walk
+     * the image row by row, which keeps all accesses sequential.
      */
-    uint8_t bpp = this->get_pixel_width();
-    size_t width_in_pixels = this->header.image_spec.width;
-    for (size_t col = 0; col < width_in_pixels / 2; col++) {
-        size_t cis_byte_pos   = col * bpp;
-        size_t trans_byte_pos = (width_in_pixels - 1 - col) * bpp;
-        for (size_t pbyte = 0; pbyte < bpp; pbyte++) {
-            size_t ccol = cis_byte_pos + pbyte;
-            size_t tcol = trans_byte_pos + pbyte;
-            for (size_t row = 0; row < this->get_height(); row++)
-                std::swap(
-                    this->image_data[row * this->get_bytes_width() + ccol],
-                    this->image_data[row * this->get_bytes_width() + tcol]
-                );
+    uint8_t  bpp         = this->get_pixel_width();
+    size_t   bytes_width = this->get_bytes_width();
+    size_t   width       = this->get_width();
+    uint8_t* data        = this->image_data.data();
+    parallel_for(this->get_height(), threads, [=](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++)
+            reverse_pixels(data + row * bytes_width, width, bpp);
+    });
+}
+
+/* Convert a single color map entry of ENTRY_BPP bits to a little-endian BGRA
+ * pixel. 15 and 16 bit entries are packed as A RRRRR GGGGG BBBBB; we only
+ * trust the attribute bit with USE_ALPHA_BIT, i.e. if the image claims to
+ * have alpha bits, because many writers leave it at 0.
+ */
+static uint32_t color_map_entry_to_bgra(const uint8_t* entry, int entry_bpp,
+                                        bool use_alpha_bit)
+{
+    if (entry_bpp == 32)
+        return entry[0] | (entry[1] << 8) | (entry[2] << 16) |
+               (static_cast<uint32_t>(entry[3]) << 24);
+    if (entry_bpp == 24)
+        return entry[0] | (entry[1] << 8) | (entry[2] << 16) | 0xff000000;
+
+    uint16_t v = entry[0] | (entry[1] << 8);
+    auto five_to_eight = [](uint32_t x) { return (x << 3) | (x >> 2); };
+    uint32_t b = five_to_eight(v & 0x1f);
+    uint32_t g = five_to_eight((v >> 5) & 0x1f);
+    uint32_t r = five_to_eight((v >> 10) & 0x1f);
+    uint32_t a = !use_alpha_bit || (v & 0x8000) ? 0xff : 0x00;
+    return b | (g << 8) | (r << 16) | (a << 24);
+}
+
+/* Build a table with an entry for every possible index, so expanding pixels
+ * doesn't need any bounds checks. Indices that aren't covered by the color
+ * map are transparent black.
+ */
+std::vector<uint32_t> TGA::build_color_map_lut(void) const
+{
+    size_t index_bytes = this->get_pixel_width();
+    std::vector<uint32_t> lut(size_t { 1 } << (8 * index_bytes), 0);
+
+    int    entry_bpp     = this->header.color_map_spec.bits_per_pixel;
+    size_t entry_bytes   = (entry_bpp / 8) + (entry_bpp % 8 == 0 ? 0 : 1);
+    size_t first         = this->header.color_map_spec.first_entry_index;
+    bool   use_alpha_bit = (this->header.image_spec.descriptor & 0xf) > 0;
+    for (size_t i = 0; i < this->header.color_map_spec.length; i++) {
+        if (first + i >= lut.size()) break;
+        lut[first + i] = color_map_entry_to_bgra(
+            this->color_map.data() + i * entry_bytes, entry_bpp,
+            use_alpha_bit);
+    }
+    return lut;
+}
+
+/* Replace color map indices and gray-scale values with 32 bit BGRA pixels.
+ * Rows are converted independently, so this works with any origin. The
+ * result has 8 alpha bits and no color map, just like an image that was
+ * true-color in the first place.
+ */
+void TGA::expand_pixels(size_t threads)
+{
+    uint8_t kind = this->header.image_type & 0x7;
+    if (kind != 0x1 && kind != 0x3) return;
+
+    std::vector<uint32_t> lut {};
+    if (kind == 0x1) lut = this->build_color_map_lut();
+
+    size_t src_width = this->get_bytes_width();
+    size_t src_bpp   = this->get_pixel_width();
+    size_t width     = this->get_width();
+    std::vector<uint8_t> expanded =
+        this->image_data.allocate(width * 4 * this->get_height());
+
+    const uint8_t* src = this->image_data.data();
+    uint8_t*       dst = expanded.data();
+    parallel_for(this->get_height(), threads, [&](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++) {
+            const uint8_t* in  = src + row * src_width;
+            uint8_t*       out = dst + row * width * 4;
+            if (kind == 0x1)
+                expand_indexed(out, in, width, lut.data(), src_bpp);
+            else
+                expand_gray(out, in, width, src_bpp == 2);
         }
+    });
+    this->image_data.adopt(std::move(expanded));
+
+    this->color_map.clear();
+    this->header.color_map_type = 0x0;
+    this->header.color_map_spec = {};
+    this->header.image_type     = (this->header.image_type & 0xf8) | 0x2;
+    this->header.image_spec.bits_per_pixel = 32;
+    this->header.image_spec.descriptor =
+        (this->header.image_spec.descriptor & 0xf0) | 0x8;
+}
+
+// Only for color map indices and gray-scale values, see GET_PIXEL.
+Pixel TGA::decode_narrow_pixel(size_t byte_pos) const
+{
+    const uint8_t* px = this->image_data.data() + byte_pos;
+    if ((this->header.image_type & 0x7) == 0x3) {
+        uint8_t a = this->get_pixel_width() == 2 ? px[1] : 0xff;
+        return { px[0], px[0], px[0], a };
     }
+
+    size_t index = px[0];
+    if (this->get_pixel_width() == 2) index |= px[1] << 8;
+    size_t first = this->header.color_map_spec.first_entry_index;
+    if (index < first || index - first >= this->header.color_map_spec.length)
+        return { 0, 0, 0, 0 };
+
+    int    entry_bpp   = this->header.color_map_spec.bits_per_pixel;
+    size_t entry_bytes = (entry_bpp / 8) + (entry_bpp % 8 == 0 ? 0 : 1);
+    uint32_t v = color_map_entry_to_bgra(
+        this->color_map.data() + (index - first) * entry_bytes, entry_bpp,
+        (this->header.image_spec.descriptor & 0xf) > 0);
+    return { static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 8),
+             static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 24) };
+}
+
+// OUT must hold at least GET_PIXEL_WIDTH bytes.
+void TGA::encode_pixel(const Pixel& p, uint8_t* out) const
+{
+    if (this->get_pixel_width() < 3)
+        fail("cannot set pixels narrower than 24 bits");
+    memset(out, 0, this->get_pixel_width());
+    out[0] = p.b;
+    out[1] = p.g;
+    out[2] = p.r;
+    if (this->get_pixel_width() > 3) out[3] = p.a;
+}
+
+void TGA::fill(const Pixel& p)
+{
+    uint8_t pattern[32];
+    this->encode_pixel(p, pattern);
+    broadcast_pixel(this->image_data.data(), pattern,
+                    this->get_width() * this->get_height(),
+                    this->get_pixel_width());
+    this->mark_dirty(0, 0, this->get_height(), this->get_width());
+}
+
+void TGA::fill_row_span(size_t r, size_t c0, size_t c1, const Pixel& p)
+{
+    this->fill_rect(r, c0, r + 1, c1, p);
+}
+
+/* Fill rows R0, ..., R1-1 and columns C0, ..., C1-1. Since the columns of a
+ * row are contiguous in memory for any origin, we only need to find the
+ * leftmost byte of each span in the stored layout.
+ */
+void TGA::fill_rect(size_t r0, size_t c0, size_t r1, size_t c1,
+                    const Pixel& p)
+{
+    assert(r0 <= r1 && r1 <= this->get_height());
+    assert(c0 <= c1 && c1 <= this->get_width());
+    if (r0 == r1 || c0 == c1) return;
+
+    uint8_t pattern[32];
+    this->encode_pixel(p, pattern);
+
+    size_t   bpp = this->get_pixel_width();
+    size_t   n   = c1 - c0;
+    // With a right origin, column C1-1 is the leftmost one in memory.
+    size_t   first_col = this->get_origin() == Origin::LowerRight ||
+                         this->get_origin() == Origin::UpperRight ? c1 - 1 : c0;
+    uint8_t* data = this->image_data.data();
+    for (size_t r = r0; r < r1; r++)
+        broadcast_pixel(data + this->get_byte_pos(r, first_col), pattern, n,
+                        bpp);
+    this->mark_dirty(r0, c0, r1, c1);
 }
@@ -16,10 +16,24 @@
 #ifndef _TGA_HH_
 #define _TGA_HH_
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "buffer.hh"
 #include "common.hh"
+#include "io.hh"
+#include "pool.hh"
+#include "source.hh"
 
 // Get the byte representation of a word W as a STD::STRING.
 template<typename T>
@@ -42,8 +56,207 @@ public:
     }
 };
 
-class TGA {
+/* The in-memory pixel formats that can be accessed through a typed TGAVIEW.
+ * Names list the channels in memory order, so BGRA8 is what TGA calls 32 bit
+ * true-color with an 8 bit alpha channel.
+ */
+enum class PixelFormat : uint8_t {
+    BGRA8,
+    BGR8,
+    Gray8,
+};
+
+template<PixelFormat F>
+struct PixelFormatTraits;
+
+template<>
+struct PixelFormatTraits<PixelFormat::BGRA8> final {
+    using value_type = Pixel;
+    static constexpr size_t stride = 4;
+};
+
+template<>
+struct PixelFormatTraits<PixelFormat::BGR8> final {
+    using value_type = Pixel;
+    static constexpr size_t stride = 3;
+};
+
+template<>
+struct PixelFormatTraits<PixelFormat::Gray8> final {
+    using value_type = uint8_t;
+    static constexpr size_t stride = 1;
+};
+
+/* A TGAVIEW is a non-owning, typed window onto the pixels of a TGA. Since the
+ * format is a template parameter, strides and channel offsets are constants
+ * and SET_PIXEL/GET_PIXEL compile down to a plain load or store. Rows always
+ * run left to right; the row order of the underlying image is folded into a
+ * (possibly negative) ROW_STEP, so lower-left coordinates work for any
+ * vertical origin. Views are obtained via TGA::VIEW, which validates the
+ * format once, and become invalid when the image is resized or destroyed.
+ */
+template<PixelFormat F>
+class TGAView final {
+public:
+    using value_type = typename PixelFormatTraits<F>::value_type;
+    static constexpr size_t STRIDE = PixelFormatTraits<F>::stride;
+
 private:
+    uint8_t*  base     = nullptr; // first byte of row 0
+    ptrdiff_t row_step = 0;
+    size_t    width    = 0;
+    size_t    height   = 0;
+
+public:
+    TGAView(uint8_t* base, ptrdiff_t row_step, size_t width, size_t height)
+        : base { base }, row_step { row_step }, width { width },
+          height { height }
+    {
+    }
+
+    inline size_t get_width(void) const  { return this->width; }
+    inline size_t get_height(void) const { return this->height; }
+
+    // The distance from one row to the next, in bytes.
+    inline ptrdiff_t get_row_step(void) const { return this->row_step; }
+
+    inline uint8_t* row(size_t r) const
+    {
+        assert(r < this->height);
+        return this->base + static_cast<ptrdiff_t>(r) * this->row_step;
+    }
+
+    /* Row R of a BGRA8 view as 32 bit words B | G << 8 | R << 16 | A << 24,
+     * for loops that write whole pixels at once.
+     */
+    inline uint32_t* row_pixels(size_t r) const
+    {
+        static_assert(F == PixelFormat::BGRA8, "only BGRA8 pixels are words");
+        uint8_t* px = this->row(r);
+        assert(reinterpret_cast<uintptr_t>(px) % alignof(uint32_t) == 0);
+        return reinterpret_cast<uint32_t*>(px);
+    }
+
+    inline void set_pixel(size_t r, size_t c, const value_type& p) const
+    {
+        assert(c < this->width);
+        uint8_t* px = this->row(r) + c * STRIDE;
+        if constexpr (F == PixelFormat::BGRA8) {
+            // TGA is little-endian, so is every target we care about.
+            uint32_t v = p.b | (p.g << 8) | (p.r << 16) |
+                         (static_cast<uint32_t>(p.a) << 24);
+            memcpy(px, &v, sizeof(v));
+        } else if constexpr (F == PixelFormat::BGR8) {
+            px[0] = p.b;
+            px[1] = p.g;
+            px[2] = p.r;
+        } else {
+            px[0] = p;
+        }
+    }
+
+    inline value_type get_pixel(size_t r, size_t c) const
+    {
+        assert(c < this->width);
+        const uint8_t* px = this->row(r) + c * STRIDE;
+        if constexpr (F == PixelFormat::BGRA8) {
+            uint32_t v;
+            memcpy(&v, px, sizeof(v));
+            return { static_cast<uint8_t>(v >> 16),
+                     static_cast<uint8_t>(v >> 8),
+                     static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 24) };
+        } else if constexpr (F == PixelFormat::BGR8) {
+            return { px[2], px[1], px[0], 0xff };
+        } else {
+            return px[0];
+        }
+    }
+};
+
+// The corner of the image that holds the first pixel (descriptor bits 4:5).
+enum class Origin : uint8_t {
+    LowerLeft  = 0x00,
+    LowerRight = 0x10,
+    UpperLeft  = 0x20,
+    UpperRight = 0x30,
+};
+
+/* Options that control how TGA files are loaded from disk. With USE_MMAP, the
+ * file is mapped into memory instead of being read via stdio. Uncompressed
+ * images then use the mapped pixel bytes directly, without any copy. With
+ * KEEP_ORIGIN, pixel data isn't flipped into a lower-left layout. Color-mapped
+ * and gray-scale images are expanded into 32 bit BGRA pixels, unless
+ * KEEP_INDEXED is set; then, they keep their 8 or 16 bit pixels (and color
+ * map), which uses a fraction of the memory. THREADS splits reading, RLE
+ * decoding, expanding and flipping into bands of rows (0 means one thread per
+ * hardware thread); the result is the same for any thread count. If POOL is
+ * set, pixel data is allocated from and later returned to it.
+ */
+struct LoadOptions final {
+    bool        use_mmap     = false;
+    bool        keep_origin  = false;
+    bool        keep_indexed = false;
+    size_t      threads      = 1;
+    BufferPool* pool         = nullptr;
+};
+
+/* Options that control how TGA files are written to disk. With USE_RLE, pixel
+ * data is run-length encoded one scanline at a time (image types 9-11). If
+ * ORIGIN is set, the image is re-arranged to start at that corner first,
+ * otherwise the current layout is written as is.
+ */
+struct WriteOptions final {
+    bool                  use_rle = false;
+    std::optional<Origin> origin  {};
+};
+
+/* Options for loading many files at once (see loader.hh). IO_THREADS read or
+ * map whole files, DECODE_THREADS parse and decode them (0 means one thread
+ * per hardware thread). At most MAX_BYTES_IN_FLIGHT bytes of files are held
+ * between reading and decoding, though a single larger file is still loaded
+ * on its own. LOAD applies to every file.
+ */
+struct BatchOptions final {
+    LoadOptions load                = {};
+    size_t      io_threads          = 4;
+    size_t      decode_threads      = 0;
+    size_t      max_bytes_in_flight = size_t { 256 } << 20;
+};
+
+/* What TGA::PROBE finds out about a file without touching its pixels. Fields
+ * are as stored in the file, i.e. IMAGE_TYPE still has the RLE bit and
+ * BITS_PER_PIXEL is that of color map indices for color-mapped images. The
+ * extension area fields are only set if HAS_EXT_AREA is true.
+ */
+struct TGAInfo final {
+    size_t   file_size                 = 0;
+    uint16_t width                     = 0;
+    uint16_t height                    = 0;
+    uint8_t  bits_per_pixel            = 0;
+    uint8_t  alpha_bits                = 0;
+    uint8_t  image_type                = 0;
+    bool     is_rle                    = false;
+    Origin   origin                    = Origin::LowerLeft;
+    uint8_t  color_map_type            = 0;
+    uint16_t color_map_length          = 0;
+    uint8_t  color_map_bits_per_pixel  = 0;
+    uint8_t  id_length                 = 0;
+    bool     is_new_format             = false;
+    bool     has_ext_area              = false;
+    uint32_t scan_line_tbl_offset      = 0;
+    uint32_t postage_stamp_offset      = 0;
+    uint32_t color_correction_offset   = 0;
+    std::string author_name            {};
+    std::string software_id            {};
+};
+
+class TGA final {
+private:
+    // The streaming reader and writer share the on-disk structures below.
+    friend class TGAReader;
+    friend class TGAWriter;
+    friend class TGALoader;
+
     static constexpr uint16_t EXT_AREA_SIZE = 495;
 
     // Refer to the spec for a detailed description of these fields.
@@ -95,41 +308,234 @@ private:
 
     bool is_new_format = false;
     std::vector<uint8_t> color_map  {};
-    std::vector<uint8_t> image_data {};
+    ImageBuffer          image_data {};
     std::vector<uint8_t> image_id_data {};
 
+    /* The file offset of every scanline, in the order they are stored. The
+     * table refers to the file that this image was last read from or written
+     * to. For RLE images without a table in the file, we build it while
+     * decoding, if packets don't cross scanlines.
+     */
+    std::vector<uint32_t> scan_line_tbl {};
+
+    /* A small preview image in the same pixel format and layout as the image
+     * itself, which is never RLE encoded in the file. Copies of an image
+     * share it, so it is replaced but never modified in place.
+     */
+    std::shared_ptr<TGA>   postage_stamp {};
+    std::array<uint8_t, 2> postage_stamp_size {}; // as written to the file
+
     // @TODO: not yet implemented.
-    // std::vector<uint32_t> scan_line_tbl {};
-    // std::vector<uint8_t>  postage_stamp {};
     // std::array<uint16_t, 4096> color_correction_tbl {};
 
+    // The half-open range of stored columns of a row that changed, if LO < HI.
+    struct DirtySpan final {
+        uint16_t lo = UINT16_MAX, hi = 0;
+    };
+
+    /* The file that SAVE_INCREMENTAL last wrote, and which pixels changed
+     * since, as one span per row of the stored layout and the range of rows
+     * DIRTY_BEGIN, ..., DIRTY_END-1 that has any. For RLE files, we keep our
+     * own copy of the scan line table, since any other write rebuilds
+     * SCAN_LINE_TBL for whatever it wrote. Tracking is off until the
+     * first incremental save, so SET_PIXEL pays a single branch otherwise. A
+     * copy of an image starts out without any of this, because it would
+     * otherwise patch a file that it never wrote.
+     */
+    struct SavedFile final {
+        std::string            path {};
+        Header                 header {};       // as written to the file
+        std::shared_ptr<TGA>   postage_stamp {};
+        size_t                 data_offset = 0;
+        size_t                 data_len    = 0; // of pixel data in the file
+        std::vector<uint32_t>  scan_line_tbl {};
+        struct stat            file_stat {};
+        std::vector<DirtySpan> rows {};
+        size_t                 dirty_begin = SIZE_MAX;
+        size_t                 dirty_end   = 0;
+
+        SavedFile(void) = default;
+        SavedFile(const SavedFile&) : SavedFile {} {}
+        SavedFile(SavedFile&&) noexcept = default;
+        SavedFile& operator=(SavedFile&&) noexcept = default;
+        SavedFile& operator=(const SavedFile&)
+        {
+            *this = SavedFile {};
+            return *this;
+        }
+    } saved {};
+
     /* @NOTE: We explicitely _do not_ associate an instance of this class with
      * a particular file for reading/writing. All methods that work on files
-     * take either a path or a FILE* as an input parameter.
+     * take either a path or a BYTESOURCE (see source.hh) as an input
+     * parameter, which is either a file on disk or a complete file that was
+     * loaded or mapped into memory.
      */
-    void parse_header(FILE*);
-    void parse_footer(FILE*);
-    void parse_ext_area(FILE*);
-    void read_rle_image_data(uint8_t*, size_t, size_t);
-    void update_ext_area(void);
-    void flip_image_horizontally(void);
-    void flip_image_vertically(void);
+    TGA(void) = default;
+    void read_file(std::string_view, const LoadOptions&);
+    void map_file(std::string_view, const LoadOptions&);
+    void load_bytes(MappedFile&&, const LoadOptions&);
+    void load_bytes(std::vector<uint8_t>&&, const LoadOptions&);
+    std::optional<size_t> parse_source(const ByteSource&, const LoadOptions&);
+    size_t parse_metadata(const ByteSource&);
+    void read_rle_region(const ByteSource&, size_t, size_t, size_t, size_t,
+                         size_t);
+    bool read_rle_rows(const ByteSource&, std::span<const uint32_t>, size_t,
+                       size_t, size_t, size_t, bool);
+    void read_image_data(const ByteSource&, size_t, size_t);
+    void finish_load(const LoadOptions&);
+    void parse_header(const ByteSource&);
+    void parse_footer(const ByteSource&);
+    void parse_ext_area(const ByteSource&);
+    void check_footer(void);
+    void check_ext_area(void);
+    void check_pixel_format(void);
+    void read_scan_line_tbl(const ByteSource&);
+    void read_postage_stamp(const ByteSource&);
+    void read_rle_image_data(const uint8_t*, size_t, size_t, size_t);
+    bool read_rle_bands(const uint8_t*, size_t, size_t);
+    size_t encode_rle_rows(size_t, size_t, uint8_t*, uint32_t*, size_t) const;
+    bool patch_saved_file(std::string_view, bool);
+    void track_saved_file(std::string_view, bool);
+    void flip_image_horizontally(size_t);
+    void flip_image_vertically(size_t);
+    void expand_pixels(size_t);
+    std::vector<uint32_t> build_color_map_lut(void) const;
+    void encode_pixel(const Pixel&, uint8_t*) const;
+    Pixel decode_narrow_pixel(size_t) const;
 
+    // The offset of the first byte of pixel data in the file.
+    inline size_t get_image_data_offset(void) const
+    {
+        size_t bytes_per_entry =
+            (this->header.color_map_spec.bits_per_pixel / 8) +
+            (this->header.color_map_spec.bits_per_pixel % 8 == 0 ? 0 : 1);
+        return sizeof(this->header) + this->header.id_length +
+               this->header.color_map_spec.length * bytes_per_entry;
+    }
+
+    // The number of bytes of decoded pixel data.
+    inline size_t get_image_data_len(void) const
+    {
+        return this->get_bytes_width() * this->get_height();
+    }
+
+    void init_header(uint16_t, uint16_t, PixelFormat, Origin);
+
+    /* The parts of a file in the order they are written: header, image id,
+     * color map, pixel data, scan line table, postage stamp size and pixels,
+     * extension area and footer. RLE data is encoded while the file is
+     * written, so for RLE files, the pixel data part stays empty.
+     */
+    using FileParts = std::array<std::span<const uint8_t>, 9>;
+    static constexpr size_t PIXEL_PART = 3;
+    void prepare_write(const WriteOptions&, Header&, FileParts&);
+    size_t get_file_len(size_t, bool) const;
+    size_t finish_write(size_t, bool, FileParts&);
+    static uint8_t* copy_parts(std::span<const std::span<const uint8_t>>,
+                               uint8_t*);
+    static void write_parts(int, std::span<const std::span<const uint8_t>>,
+                            std::string_view);
+
+    // Used by TGALOADER, after its I/O threads have loaded the whole file.
+    TGA(MappedFile&&, const LoadOptions&);
+    TGA(std::vector<uint8_t>&&, const LoadOptions&);
+
+    static void check_header(const Header&);
+    static bool has_signature(const Footer&);
+    static TGAInfo probe_source(const ByteSource&);
+    static void update_ext_area(ExtensionArea&);
     static void read_n_bytes(uint8_t*, size_t, const char*, FILE*);
 
 public:
-    /* We have two options for working with TGA files:
+    /* We have three options for working with TGA files:
      *  1. Open an existing file via its path and modify it to our liking
      *  2. Create an TGA file with a desired set of parameters and write
      *     individual pixels into it
-     * Both types of TGA files can be flushed to disk, of course.
+     *  3. Wrap pixel data that we already have in memory
+     * All types of TGA files can be flushed to disk, of course.
+     */
+    explicit TGA(std::string_view, const LoadOptions& = {});
+    explicit TGA(uint16_t, uint16_t, const Pixel& = { 0, 0, 0, 0xff},
+                 BufferPool* = nullptr);
+
+    /* Wrap existing pixels of a given format (3.), stored row by row from
+     * ORIGIN, without copying them. The vector is adopted; the span is
+     * borrowed, so it must outlive the image and SET_PIXEL writes through to
+     * it. Anything that changes the layout, e.g. SET_ORIGIN, copies it first,
+     * and so does a BGRA8 view of pixels that aren't word aligned.
      */
-    explicit TGA(std::string_view);
-    explicit TGA(uint16_t, uint16_t, const Pixel& = { 0, 0, 0, 0xff});
+    TGA(uint16_t, uint16_t, PixelFormat, std::vector<uint8_t>&&,
+        Origin = Origin::LowerLeft);
+    TGA(uint16_t, uint16_t, PixelFormat, std::span<uint8_t>,
+        Origin = Origin::LowerLeft);
 
-    virtual ~TGA(void) = default;
+    /* Images are often handed between threads (e.g. through the futures of
+     * a TGALOADER), so moves must be cheap and never copy pixel data.
+     */
+    TGA(const TGA&)                = default;
+    TGA(TGA&&) noexcept            = default;
+    TGA& operator=(const TGA&)     = default;
+    TGA& operator=(TGA&&) noexcept = default;
+
+    // Nothing derives from TGA, so we don't pay for a vtable.
+    ~TGA(void) = default;
+
+    std::vector<uint8_t> release(void);
+
+    /* Load all files at PATHS with a temporary TGALOADER and return them in
+     * the same order. Reading and decoding overlap across files.
+     */
+    static std::vector<TGA> load_many(std::span<const std::string>,
+                                      const BatchOptions& = {});
+
+    static TGA from_memory(std::span<const uint8_t>, const LoadOptions& = {});
 
-    void write_to_file(std::string_view);
+    /* Load the W by H pixels at column X and row Y of a file, without
+     * reading or decoding much more than that region.
+     */
+    static TGA load_region(std::string_view, size_t x, size_t y, size_t w,
+                           size_t h, const LoadOptions& = {});
+
+    /* Load only the postage stamp of a file, which is far cheaper than
+     * loading and shrinking the image. Returns nothing if there is none.
+     */
+    static std::optional<TGA> load_postage_stamp(std::string_view,
+                                                 const LoadOptions& = {});
+
+    /* Read only the header, footer and extension area of a file, which are
+     * at most three small reads. Just like loading, a malformed header is a
+     * fatal error, but an extension area that is out of bounds is ignored.
+     * PROBE_MANY probes files on THREADS threads (0 means one per hardware
+     * thread) and PROBE_DIRECTORY does so for all *.tga files in a directory,
+     * sorted by path.
+     */
+    static TGAInfo probe(std::string_view);
+    static TGAInfo probe(std::span<const uint8_t>);
+    static std::vector<TGAInfo> probe_many(std::span<const std::string>,
+                                           size_t = 0);
+    static std::vector<std::pair<std::string, TGAInfo>>
+    probe_directory(std::string_view, size_t = 0);
+
+    /* Writing applies WRITEOPTIONS.ORIGIN to the image itself, so it may be
+     * flipped afterwards. WRITE_TO_MEMORY gives the bytes of the file that
+     * WRITE_TO_FILE writes; the span version returns the size of the file,
+     * which is more than the span if it was too small to hold it.
+     */
+    void write_to_file(std::string_view, const WriteOptions& = {});
+    size_t write_to_memory(std::span<uint8_t>, const WriteOptions& = {});
+    std::vector<uint8_t> write_to_memory(const WriteOptions& = {});
+
+    /* Write the image like WRITE_TO_FILE, but if SAVE_INCREMENTAL last wrote
+     * it to the same path with the same options, and the file wasn't changed
+     * since (judged by its inode, size and modification time), only patch
+     * what changed in place. Uncompressed files get the dirty byte ranges of
+     * every changed row. RLE files get whole scanlines, re-encoded to exactly
+     * the length that the scan line table gives them, by splitting packets;
+     * if the new pixels don't fit, the whole file is written after all. So
+     * the cost of a save scales with the size of the edit, not the image.
+     */
+    void save_incremental(std::string_view, const WriteOptions& = {});
 
     /* The width of an individual pixel in bytes. This might _not_ be the same
      * as ``IMAGE_SPEC.BITS_PER_PIXEL / 8'', because pixels can use e.g. just
@@ -162,24 +568,168 @@ public:
         return this->header.image_spec.height;
     }
 
+    inline Origin get_origin(void) const
+    {
+        return static_cast<Origin>(this->header.image_spec.descriptor & 0x30);
+    }
+
+    void set_origin(Origin, size_t = 1);
+
+    // Empty, if the image has no (known) scan line table.
+    inline const std::vector<uint32_t>& get_scan_line_table(void) const
+    {
+        return this->scan_line_tbl;
+    }
+
+    // Returns nothing if the pixel data matches none of the typed formats.
+    std::optional<PixelFormat> get_pixel_format(void) const;
+
+    /* The postage stamp is written along with the image. It must have the
+     * same pixel format and be at most 255 by 255 pixels. Loading an image
+     * keeps the stamp of the file, but changing pixels doesn't update it.
+     */
+    inline const TGA* get_postage_stamp(void) const
+    {
+        return this->postage_stamp.get();
+    }
+
+    void set_postage_stamp(const TGA&);
+    void clear_postage_stamp(void) { this->postage_stamp.reset(); }
+
+    /* Successively halve the image down to 1 by 1 pixels, or at most
+     * MAX_LEVELS times, using THREADS threads. Each pixel of a level is the
+     * rounded average of a 2 by 2 block of the previous one, which is also
+     * what bilinear sampling at the block center gives. Odd rows and
+     * columns at the end of the pixel data are dropped. The image must have
+     * one of the typed pixel formats. Level 0, the image itself, is not
+     * part of the result.
+     */
+    std::vector<TGA> build_mip_chain(size_t = SIZE_MAX, size_t = 1) const;
+
+    /* The largest mip level whose width and height are at most MAX_SIZE,
+     * e.g. for a postage stamp (the spec suggests 64 by 64 pixels).
+     */
+    TGA make_thumbnail(size_t = 64, size_t = 1) const;
+
+    /* Hand out a typed view after validating the pixel format once. It is a
+     * fatal error to ask for a format that doesn't match the image. Views
+     * need rows that run left to right, so an image with a right origin is
+     * flipped horizontally first. BGRA8 rows are read and written as words,
+     * so pixels that don't start on a word boundary, e.g. those of a mapped
+     * file, are copied into owned memory first.
+     */
+    template<PixelFormat F>
+    TGAView<F> view(void)
+    {
+        if (this->get_pixel_format() != F)
+            fail("requested pixel format doesn't match the image");
+
+        Origin origin = this->get_origin();
+        if (origin == Origin::LowerRight) this->set_origin(Origin::LowerLeft);
+        if (origin == Origin::UpperRight) this->set_origin(Origin::UpperLeft);
+        if constexpr (F == PixelFormat::BGRA8)
+            this->image_data.align(alignof(uint32_t));
+
+        ptrdiff_t bytes_width = this->get_bytes_width();
+        uint8_t*  base        = this->image_data.data();
+        if (this->get_origin() == Origin::UpperLeft) {
+            base += (this->get_height() - 1) * bytes_width;
+            bytes_width = -bytes_width;
+        }
+        return { base, bytes_width, this->get_width(), this->get_height() };
+    }
+
+    /* Pixel coordinates always refer to a lower-left origin, no matter how
+     * the pixel data is laid out in memory. GET_BYTE_POS maps them to the
+     * offset of the pixel in IMAGE_DATA.
+     */
+    inline size_t get_byte_pos(size_t r, size_t c) const
+    {
+        uint8_t origin = this->header.image_spec.descriptor & 0x30;
+        if (origin & 0x20) r = this->get_height() - 1 - r;
+        if (origin & 0x10) c = this->get_width() - 1 - c;
+        return this->get_bytes_width() * r + this->get_pixel_width() * c;
+    }
+
+    /* Record that rows R0, ..., R1-1 and columns C0, ..., C1-1 changed, for
+     * SAVE_INCREMENTAL. SET_PIXEL and the fills do so on their own; writes
+     * through views must be marked by hand (RASTERIZER does it per tile).
+     * Ranges are clamped to the image.
+     */
+    inline void mark_dirty(size_t r0, size_t c0, size_t r1, size_t c1)
+    {
+        r1 = std::min(r1, this->get_height());
+        c1 = std::min(c1, this->get_width());
+        SavedFile& saved = this->saved;
+        if (saved.rows.empty() || r0 >= r1 || c0 >= c1) return;
+
+        uint8_t origin = this->header.image_spec.descriptor & 0x30;
+        if (origin & 0x20) {
+            size_t top = this->get_height() - r0;
+            r0 = this->get_height() - r1;
+            r1 = top;
+        }
+        if (origin & 0x10) {
+            size_t right = this->get_width() - c0;
+            c0 = this->get_width() - c1;
+            c1 = right;
+        }
+        for (size_t r = r0; r < r1; r++) {
+            DirtySpan& span = saved.rows[r];
+            span.lo = static_cast<uint16_t>(std::min<size_t>(span.lo, c0));
+            span.hi = static_cast<uint16_t>(std::max<size_t>(span.hi, c1));
+        }
+        saved.dirty_begin = std::min(saved.dirty_begin, r0);
+        saved.dirty_end   = std::max(saved.dirty_end, r1);
+    }
+
     /* For now, we can only do pixel formats RGB and RGBA. For some reason,
      * TGA actually stores them as BGR (probably endianess?). The alpha channel
      * is optional and we can savely skip it, if the original image didn't have
      * one. If we create our own image "from scratch", we just do RGBA. At some
-     * point, an option to adjust that might be useful, though.
+     * point, an option to adjust that might be useful, though. Narrower
+     * pixels, like those of LOADOPTIONS.KEEP_INDEXED, can't be set at all.
      */
     inline void set_pixel(size_t r, size_t c, const Pixel& p)
     {
-        assert(this->get_pixel_width() >= 3 && "currently, we cannot work "
-               "with other pixel formats than RGB(A)");
-        size_t byte_pos = this->get_bytes_width() * r +
-                          this->get_pixel_width() * c;
+        if (this->get_pixel_width() < 3)
+            fail("cannot set pixels narrower than 24 bits");
+        size_t byte_pos = this->get_byte_pos(r, c);
         this->image_data[byte_pos+0] = p.b;
         this->image_data[byte_pos+1] = p.g;
         this->image_data[byte_pos+2] = p.r;
         if ((this->header.image_spec.descriptor & 0xf) > 0)
             this->image_data[byte_pos+3] = p.a;
+        this->mark_dirty(r, c, r + 1, c + 1);
+    }
+
+    /* Bulk fills encode P once and broadcast it with wide stores. Column and
+     * row ranges are half-open, i.e. FILL_ROW_SPAN(R, C0, C1, P) writes the
+     * pixels C0, ..., C1-1 of row R. For 32 bit pixels without alpha bits,
+     * the padding byte is set to P.A.
+     */
+    void fill(const Pixel&);
+    void fill_row_span(size_t, size_t, size_t, const Pixel&);
+    void fill_rect(size_t, size_t, size_t, size_t, const Pixel&);
+
+    /* Images without an alpha channel are reported as fully opaque. Images
+     * that were loaded with LOADOPTIONS.KEEP_INDEXED can still be read, but
+     * their pixels are looked up one at a time.
+     */
+    inline Pixel get_pixel(size_t r, size_t c) const
+    {
+        size_t byte_pos = this->get_byte_pos(r, c);
+        if (this->get_pixel_width() < 3)
+            return this->decode_narrow_pixel(byte_pos);
+        uint8_t a = (this->header.image_spec.descriptor & 0xf) > 0
+                  ? this->image_data[byte_pos+3] : 0xff;
+        return { this->image_data[byte_pos+2], this->image_data[byte_pos+1],
+                 this->image_data[byte_pos+0], a };
     }
 };
 
+// Handing images between threads relies on moves that never copy or throw.
+static_assert(std::is_nothrow_move_constructible_v<TGA> &&
+              std::is_nothrow_move_assignable_v<TGA>);
+
 #endif /* _TGA_HH_ */
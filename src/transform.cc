@@ -0,0 +1,170 @@
+/* transform.cc implements the vertex stage and clipping of triangles.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "io.hh"
+#include "kernels.hh"
+#include "parallel.hh"
+#include "transform.hh"
+
+/* Vertices are handed out to threads in batches of this many, which keeps
+ * every batch a whole number of SIMD vectors.
+ */
+static constexpr size_t BATCH_SIZE = 4096;
+
+static constexpr size_t PLANES = 6;
+
+void TransformedVertices::resize(size_t n)
+{
+    for (std::vector<float>* v : { &this->cx, &this->cy, &this->cz, &this->cw,
+                                   &this->sx, &this->sy, &this->sz })
+        v->resize(n);
+    this->outcodes.resize(n);
+}
+
+VertexStage::VertexStage(const Mat4f& m, size_t width, size_t height,
+                         size_t threads)
+    : matrix {}, width { static_cast<float>(width) },
+      height { static_cast<float>(height) }, threads { threads }
+{
+    if (width == 0 || height == 0)
+        fail("cannot transform onto an empty screen");
+    this->set_matrix(m);
+}
+
+void VertexStage::set_matrix(const Mat4f& m)
+{
+    for (size_t r = 0; r < 4; r++)
+        for (size_t c = 0; c < 4; c++) this->matrix[4 * r + c] = m[r][c];
+}
+
+void VertexStage::transform(const float* x, const float* y, const float* z,
+                            size_t n, TransformedVertices& out) const
+{
+    out.resize(n);
+    out.width  = this->width;
+    out.height = this->height;
+    size_t batches = (n + BATCH_SIZE - 1) / BATCH_SIZE;
+    parallel_for(batches, this->threads, [&](size_t begin, size_t end) {
+        size_t first = begin * BATCH_SIZE;
+        size_t count = std::min(end * BATCH_SIZE, n) - first;
+        const float* position[3] = { x + first, y + first, z + first };
+        float* clip[4]   = { out.cx.data() + first, out.cy.data() + first,
+                             out.cz.data() + first, out.cw.data() + first };
+        float* screen[3] = { out.sx.data() + first, out.sy.data() + first,
+                             out.sz.data() + first };
+        transform_vertices(this->matrix, position, count, this->width,
+                           this->height, clip, screen,
+                           out.outcodes.data() + first);
+    });
+}
+
+struct ClipPoint final {
+    float c[4];   // X, Y, Z, W
+};
+
+// How far inside of the frustum plane PLANE the point P is, in clip space.
+static inline float get_distance(const ClipPoint& p, size_t plane)
+{
+    float coord = p.c[plane / 2];
+    return plane % 2 == 0 ? p.c[3] + coord : p.c[3] - coord;
+}
+
+/* Sutherland-Hodgman against a single plane. New corners are always
+ * interpolated from the inside end of an edge towards the outside one, so
+ * that two triangles that share an edge cut it at the very same point.
+ */
+static size_t clip_polygon(const ClipPoint* in, size_t n, size_t plane,
+                           ClipPoint* out)
+{
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const ClipPoint& a  = in[i];
+        const ClipPoint& b  = in[(i + 1) % n];
+        float            da = get_distance(a, plane);
+        float            db = get_distance(b, plane);
+        if (da >= 0.0f) out[m++] = a;
+        if ((da >= 0.0f) == (db >= 0.0f)) continue;
+
+        const ClipPoint& inside  = da >= 0.0f ? a : b;
+        const ClipPoint& outside = da >= 0.0f ? b : a;
+        float di = std::max(da, db), dout = std::min(da, db);
+        float t  = di / (di - dout);
+        ClipPoint p {};
+        for (size_t k = 0; k < 4; k++)
+            p.c[k] = inside.c[k] + (outside.c[k] - inside.c[k]) * t;
+        out[m++] = p;
+    }
+    return m;
+}
+
+// Twice the signed area of the polygon, positive if counter-clockwise.
+static float get_area(const Point3* p, size_t n)
+{
+    float area = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        const Point3& a = p[i];
+        const Point3& b = p[(i + 1) % n];
+        area += a.x * b.y - b.x * a.y;
+    }
+    return area;
+}
+
+size_t assemble_triangle(const TransformedVertices& v, const uint32_t* indices,
+                         Cull cull, Point3 (&out)[MAX_CLIPPED_CORNERS])
+{
+    uint32_t a = indices[0], b = indices[1], c = indices[2];
+    uint8_t  all = v.outcodes[a] & v.outcodes[b] & v.outcodes[c];
+    uint8_t  any = v.outcodes[a] | v.outcodes[b] | v.outcodes[c];
+    if (all != 0) return 0;
+
+    size_t n = 3;
+    if (any == 0) {
+        for (size_t k = 0; k < 3; k++)
+            out[k] = { v.sx[indices[k]], v.sy[indices[k]], v.sz[indices[k]] };
+    } else {
+        ClipPoint polygon[2][MAX_CLIPPED_CORNERS];
+        for (size_t k = 0; k < 3; k++) {
+            uint32_t i = indices[k];
+            polygon[0][k] = { { v.cx[i], v.cy[i], v.cz[i], v.cw[i] } };
+        }
+        size_t cur = 0;
+        for (size_t plane = 0; plane < PLANES && n >= 3; plane++) {
+            if (!(any & (1 << plane))) continue;
+            n   = clip_polygon(polygon[cur], n, plane, polygon[1 - cur]);
+            cur = 1 - cur;
+        }
+        if (n < 3) return 0;
+
+        // The same arithmetic as TRANSFORM_VERTICES, for identical corners.
+        float half_w = v.width / 2.0f, half_h = v.height / 2.0f;
+        for (size_t k = 0; k < n; k++) {
+            const float* p     = polygon[cur][k].c;
+            float        inv_w = 1.0f / p[3];
+            out[k] = { p[0] * inv_w * half_w + half_w,
+                       p[1] * inv_w * half_h + half_h,
+                       p[2] * inv_w * 0.5f + 0.5f };
+        }
+    }
+
+    float area = get_area(out, n);
+    if (!(area != 0.0f)) return 0;
+    if (cull == Cull::BACK && area < 0.0f) return 0;
+    if (cull == Cull::FRONT && area > 0.0f) return 0;
+    return n;
+}
@@ -0,0 +1,121 @@
+/* The vertex stage: batched transforms of meshes and assembly of triangles.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _TRANSFORM_HH_
+#define _TRANSFORM_HH_
+
+#include <vector>
+
+#include "common.hh"
+#include "linalg.hh"
+#include "mesh.hh"
+#include "raster.hh"
+
+/* Vertices after the transform, one array per coordinate like in MESH. Clip
+ * space coordinates CX, CY, CZ and CW are kept for triangles that must be
+ * clipped, screen space coordinates SX, SY and SZ are what the rasterizer
+ * gets and only valid for vertices whose OUTCODES are zero, i.e. that are
+ * inside the view frustum. WIDTH and HEIGHT are those of the screen.
+ */
+struct TransformedVertices final {
+    std::vector<float>   cx {}, cy {}, cz {}, cw {};
+    std::vector<float>   sx {}, sy {}, sz {};
+    std::vector<uint8_t> outcodes {};
+    float                width = 0.0f, height = 0.0f;
+
+    inline size_t size(void) const { return this->outcodes.size(); }
+    void resize(size_t);
+};
+
+// Which triangles to drop, by their winding order on screen.
+enum class Cull {
+    NONE,
+    BACK,   // clockwise, with the lower-left origin of the screen
+    FRONT,  // counter-clockwise
+};
+
+/* A VERTEX_STAGE maps positions through a matrix, usually projection * view
+ * * model, into clip space and onto a WIDTH by HEIGHT screen, with depths
+ * from 0 at the near plane to 1 at the far plane.
+ *
+ * All vertices of a mesh are transformed in one batch, several at a time
+ * with SIMD, before any triangle is assembled. The transformed vertices are
+ * the post-transform cache: every vertex is transformed once, however many
+ * triangles share it, and triangles only look up their corners by index.
+ * Since the OBJ loader merges equal vertices, that's as little work as it
+ * gets, and none of it is on the per-triangle path into the rasterizer.
+ */
+class VertexStage final {
+private:
+    float  matrix[16];   // row-major
+    float  width;
+    float  height;
+    size_t threads;
+
+public:
+    // THREADS of 0 means one thread per hardware thread.
+    VertexStage(const Mat4f&, size_t width, size_t height, size_t threads = 1);
+
+    void set_matrix(const Mat4f&);
+
+    // Transform the N positions (X[i], Y[i], Z[i]) into OUT.
+    void transform(const float* x, const float* y, const float* z, size_t n,
+                   TransformedVertices& out) const;
+
+    inline void transform(const Mesh& mesh, TransformedVertices& out) const
+    {
+        this->transform(mesh.x.data(), mesh.y.data(), mesh.z.data(),
+                        mesh.get_vertex_count(), out);
+    }
+};
+
+/* A convex polygon has at most this many corners after a triangle is clipped
+ * against all six planes of the view frustum.
+ */
+static constexpr size_t MAX_CLIPPED_CORNERS = 9;
+
+/* Turn the triangle with corners INDICES[0] to INDICES[2] of VERTICES into
+ * a polygon on screen, stored in OUT as a fan around OUT[0]. Returns the
+ * number of corners, or 0 if the triangle is culled, degenerate or outside
+ * of the view frustum. Triangles that are partly outside are clipped in clip
+ * space, so the rasterizer never sees points behind the camera.
+ */
+size_t assemble_triangle(const TransformedVertices& vertices,
+                         const uint32_t* indices, Cull cull,
+                         Point3 (&out)[MAX_CLIPPED_CORNERS]);
+
+/* Submit all triangles of INDICES to RASTERIZER. SHADE(T) gives the color of
+ * triangle T, and is only called for triangles that are drawn.
+ */
+template<typename F>
+void draw_triangles(Rasterizer& rasterizer,
+                    const TransformedVertices& vertices,
+                    const std::vector<uint32_t>& indices, Cull cull,
+                    F&& shade)
+{
+    Point3 polygon[MAX_CLIPPED_CORNERS];
+    for (size_t t = 0; t < indices.size() / 3; t++) {
+        size_t n = assemble_triangle(vertices, &indices[3 * t], cull, polygon);
+        if (n == 0) continue;
+        Pixel color = shade(t);
+        for (size_t k = 2; k < n; k++)
+            rasterizer.draw_triangle(polygon[0], polygon[k - 1], polygon[k],
+                                     color);
+    }
+}
+
+#endif /* _TRANSFORM_HH_ */
@@ -0,0 +1,138 @@
+/* Tests of TGA::SAVE_INCREMENTAL against writing the whole file.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <vector>
+
+#include "../src/raster.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+/* Change pixels through every API that marks them dirty. STEP varies the
+ * edits, so that consecutive saves patch different rows.
+ */
+static void edit(TGA& image, size_t step)
+{
+    size_t w = image.get_width(), h = image.get_height();
+    uint8_t v = static_cast<uint8_t>(step * 40);
+    image.set_pixel(step % h, (step * 7) % w, { v, 1, 2, 3 });
+    image.fill_rect(h / 4, w / 8 + step, h / 2, w / 2, { 9, v, 9, 0xff });
+    image.fill_row_span(h - 1 - step, 0, w / 3, { v, v, 0, 0x80 });
+    image.mark_dirty(h - 2, w - 3, SIZE_MAX, SIZE_MAX); // clamped
+
+    if (image.get_pixel_format() != PixelFormat::BGRA8) return;
+    Rasterizer raster { image, 1 };
+    float x = static_cast<float>(step * 5);
+    raster.draw_triangle(Point2 { x, 2 }, Point2 { x + 60, 10 },
+                         Point2 { x + 20, 50 }, { 0, v, 0xff, 0xff });
+    raster.draw_line(0, static_cast<int32_t>(step), static_cast<int32_t>(w),
+                     static_cast<int32_t>(h), { 0xff, 0, v, 0xff });
+    raster.flush();
+}
+
+/* Uncompressed files are patched byte for byte, so they must be identical to
+ * a fresh write. RLE rows are padded to their old length instead, so those
+ * files may differ in their bytes, but not in their pixels.
+ */
+static void check_saved(TGA& image, const std::string& path,
+                        const WriteOptions& options, std::string_view what)
+{
+    if (!options.use_rle)
+        check(read_bytes(path) == image.write_to_memory(options), what);
+    TGA loaded { path };
+    check(same_pixels(image, loaded), what);
+
+    // Loading a row through the scan line table needs the patched offsets.
+    size_t h = image.get_height();
+    TGA row = TGA::load_region(path, 0, h / 3, image.get_width(), 1);
+    bool same = true;
+    for (size_t c = 0; c < image.get_width(); c++) {
+        Pixel p = row.get_pixel(0, c), q = image.get_pixel(h / 3, c);
+        same = same && p.r == q.r && p.g == q.g && p.b == q.b && p.a == q.a;
+    }
+    check(same, what);
+}
+
+static void test_saves(void)
+{
+    std::string path = temp_path("incremental.tga");
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::BGR8 }) {
+        for (bool rle : { false, true }) {
+            for (Origin origin : { Origin::LowerLeft, Origin::LowerRight,
+                                   Origin::UpperLeft, Origin::UpperRight }) {
+                WriteOptions options { rle, origin };
+                TGA image = make_test_image(157, 93, format, 3);
+                image.save_incremental(path, options);
+                check_saved(image, path, options, "the first save is whole");
+                for (size_t step = 0; step < 4; step++) {
+                    edit(image, step);
+                    image.save_incremental(path, options);
+                    check_saved(image, path, options,
+                                "an incremental save matches a full write");
+                }
+            }
+        }
+    }
+    remove(path.c_str());
+}
+
+/* Writes that SAVE_INCREMENTAL didn't do must neither confuse its tracking
+ * nor be patched over: writing the image elsewhere rebuilds its scan line
+ * table, another writer may replace the file, and a copy of the image has
+ * never written the file.
+ */
+static void test_other_writes(void)
+{
+    std::string path = temp_path("incremental.tga");
+    std::string other = temp_path("incremental_other.tga");
+    WriteOptions rle { true, {} };
+
+    /* The fill shortens the encoded rows, so the table of OTHER no longer
+     * matches the file. Row 60 is set to what it was, so its encoding keeps
+     * its length, because a row that doesn't fit makes the save write the
+     * whole file.
+     */
+    TGA image = make_test_image(120, 80, PixelFormat::BGRA8, 5);
+    image.save_incremental(path, rle);
+    image.fill_rect(0, 0, 40, 90, { 1, 1, 1, 0xff });
+    image.write_to_file(other, rle);
+    image.set_pixel(60, 20, image.get_pixel(60, 20));
+    image.save_incremental(path, rle);
+    check_saved(image, path, rle, "writing elsewhere doesn't stale the table");
+
+    make_test_image(120, 80, PixelFormat::BGRA8, 6).write_to_file(path, rle);
+    edit(image, 3);
+    image.save_incremental(path, rle);
+    check_saved(image, path, rle, "a file changed by others is rewritten");
+
+    TGA copy { image };
+    copy.fill({ 1, 2, 3, 0xff });
+    copy.save_incremental(path, rle);
+    check_saved(copy, path, rle, "a copy rewrites the file");
+    edit(image, 0);
+    image.save_incremental(path, rle);
+    check_saved(image, path, rle, "the original rewrites it again");
+
+    remove(path.c_str());
+    remove(other.c_str());
+}
+
+void test_incremental(void)
+{
+    test_saves();
+    test_other_writes();
+}
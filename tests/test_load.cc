@@ -0,0 +1,213 @@
+/* Tests of loading the files in assets/test_images in every way there is.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../src/tga.hh"
+#include "tests.hh"
+
+// Whether A and B would be written to the very same file.
+static bool same_file(TGA& a, TGA& b)
+{
+    return a.get_origin() == b.get_origin() &&
+           a.get_pixel_format() == b.get_pixel_format() &&
+           a.get_scan_line_table() == b.get_scan_line_table() &&
+           same_pixels(a, b) && a.write_to_memory() == b.write_to_memory();
+}
+
+// Mapped files give the same image as read ones, pixels and metadata alike.
+static void test_mapped(void)
+{
+    std::vector<std::string> paths = list_assets();
+    check(paths.size() == 48, "all test images are there");
+    for (const std::string& path : paths) {
+        for (bool keep_origin : { false, true }) {
+            LoadOptions options {};
+            options.keep_origin = keep_origin;
+            TGA read { path, options };
+            options.use_mmap = true;
+            TGA mapped { path, options };
+            check(same_file(read, mapped),
+                  "a mapped file loads like a read one");
+        }
+    }
+}
+
+/* An image that was mapped from a file can be written back to that file,
+ * although its pixels may still be the pages of the file that's replaced.
+ */
+static void test_write_back(void)
+{
+    std::string path = temp_path("write_back.tga");
+    for (std::string_view name : { "rgb_LL.tga", "rgb_a_rle_UR.tga" }) {
+        for (bool use_rle : { false, true }) {
+            write_bytes(path, read_bytes(asset_path(name)));
+            LoadOptions options {};
+            options.use_mmap = true;
+            TGA image { path, options };
+            image.set_pixel(3, 5, { 1, 2, 3, 0xff });
+            TGA expected { image };
+            image.write_to_file(path, { use_rle, {} });
+
+            TGA loaded { path };
+            check(same_pixels(loaded, expected),
+                  "a mapped image can be written over its file");
+            check(read_bytes(path) == expected.write_to_memory({ use_rle, {} }),
+                  "the file is written whole");
+
+            // Patching in place writes the pages of the file onto themselves.
+            TGA patched { path, options };
+            patched.save_incremental(path, { use_rle, {} });
+            patched.set_pixel(7, 2, { 4, 5, 6, 0xff });
+            patched.save_incremental(path, { use_rle, {} });
+            check(same_pixels(TGA { path }, patched),
+                  "a mapped image can be saved over its file incrementally");
+        }
+    }
+    remove(path.c_str());
+}
+
+/* A plain decoder for the color-mapped and gray-scale test images, which
+ * gives their pixels in lower-left order, one row after the other. Color
+ * map entries are 24 or 32 bits, gray pixels may have an alpha byte.
+ */
+static std::vector<Pixel> decode(const std::vector<uint8_t>& file)
+{
+    auto u16 = [&](size_t pos) { return file[pos] | file[pos + 1] << 8; };
+    size_t  first = static_cast<size_t>(u16(3)), count = u16(5);
+    size_t  entry = file[7] / 8, w = u16(12), h = u16(14);
+    size_t  bpp = file[16] / 8, kind = file[2] & 0x7;
+    uint8_t descriptor = file[17];
+    size_t  cmap = 18 + file[0], pos = cmap + count * entry;
+
+    std::vector<uint8_t> data {};
+    if (!(file[2] & 0x8))
+        data.assign(file.begin() + pos, file.begin() + pos + w * h * bpp);
+    while (data.size() < w * h * bpp) {
+        uint8_t packet = file[pos++];
+        size_t  n = (packet & 0x7f) + 1;
+        if (packet & 0x80) {
+            for (size_t i = 0; i < n; i++)
+                data.insert(data.end(), file.begin() + pos,
+                            file.begin() + pos + bpp);
+            pos += bpp;
+        } else {
+            data.insert(data.end(), file.begin() + pos,
+                        file.begin() + pos + n * bpp);
+            pos += n * bpp;
+        }
+    }
+
+    std::vector<Pixel> pixels(w * h);
+    for (size_t i = 0; i < w * h; i++) {
+        const uint8_t* v = data.data() + i * bpp;
+        size_t r = i / w, c = i % w;
+        if (descriptor & 0x20) r = h - 1 - r;
+        if (descriptor & 0x10) c = w - 1 - c;
+        Pixel& p = pixels[r * w + c];
+        if (kind == 1) {
+            const uint8_t* e = file.data() + cmap + (v[0] - first) * entry;
+            p = { e[2], e[1], e[0], entry == 4 ? e[3] : uint8_t { 0xff } };
+        } else {
+            p = { v[0], v[0], v[0], bpp == 2 ? v[1] : uint8_t { 0xff } };
+        }
+    }
+    return pixels;
+}
+
+// Whether IMAGE has the pixels from column X and row Y of the 256 wide PIXELS.
+static bool has_pixels(const TGA& image, const std::vector<Pixel>& pixels,
+                       size_t x = 0, size_t y = 0)
+{
+    for (size_t r = 0; r < image.get_height(); r++) {
+        for (size_t c = 0; c < image.get_width(); c++) {
+            Pixel p = image.get_pixel(r, c), q = pixels[(y + r) * 256 + x + c];
+            if (p.r != q.r || p.g != q.g || p.b != q.b || p.a != q.a)
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Color-mapped and gray-scale images (types 1, 3, 9 and 11) decode to the
+ * same pixels however they are loaded. The test images were converted on
+ * their own, so they don't quite match their true-color counterparts; the
+ * decoder above is what they are checked against instead.
+ */
+static void test_decoded(void)
+{
+    for (const std::string& path : list_assets()) {
+        if (path.find("/rgb_") != std::string::npos) continue;
+        std::vector<uint8_t> file   = read_bytes(path);
+        std::vector<Pixel>   pixels = decode(file);
+        check(pixels.size() == 256 * 256, "the test images are 256 by 256");
+
+        for (bool use_mmap : { false, true }) {
+            for (size_t threads : { size_t { 1 }, size_t { 4 } }) {
+                LoadOptions options {};
+                options.use_mmap = use_mmap;
+                options.threads  = threads;
+                check(has_pixels(TGA { path, options }, pixels),
+                      "a file loads with the pixels of its color map");
+                check(has_pixels(TGA::from_memory(file, options), pixels),
+                      "a file in memory loads the same");
+                TGA region = TGA::load_region(path, 30, 100, 51, 70, options);
+                check(has_pixels(region, pixels, 30, 100),
+                      "a region of a file loads the same");
+            }
+        }
+
+        /* Kept pixels are looked up one at a time, only 8 bit gray pixels
+         * are a typed format. Writing keeps the color map as it was.
+         */
+        LoadOptions options {};
+        options.keep_indexed = true;
+        TGA kept { path, options };
+        bool indexed = path.find("/indexed") != std::string::npos;
+        bool alpha   = path.find("_a_") != std::string::npos;
+        check(kept.get_pixel_width() == (!indexed && alpha ? 2 : 1) &&
+              kept.get_pixel_format() ==
+              (indexed || alpha ? std::nullopt
+                                : std::optional { PixelFormat::Gray8 }),
+              "kept pixels have the file's format");
+        check(has_pixels(kept, pixels), "kept pixels decode the same");
+
+        std::vector<uint8_t> written = kept.write_to_memory();
+        TGAInfo info = TGA::probe(written);
+        size_t  cmap = 18 + file[0];
+        size_t  len  = info.color_map_length * (info.color_map_bits_per_pixel
+                                                / 8);
+        check(info.color_map_type == (indexed ? 1 : 0) &&
+              info.bits_per_pixel == file[16] &&
+              std::equal(file.begin() + cmap, file.begin() + cmap + len,
+                         written.begin() + 18 + written[0]),
+              "writing kept pixels keeps the color map");
+        check(has_pixels(TGA::from_memory(written), pixels),
+              "kept pixels are written as they were");
+    }
+}
+
+void test_load(void)
+{
+    test_mapped();
+    test_write_back();
+    test_decoded();
+}
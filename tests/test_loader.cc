@@ -0,0 +1,133 @@
+/* Tests of TGA::LOAD_MANY and the TGALOADER behind it.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "../src/io.hh"
+#include "../src/loader.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+// Whether IMAGE is what loading PATH on its own with OPTIONS gives.
+static bool loads_like(TGA& image, const std::string& path,
+                       const LoadOptions& options)
+{
+    TGA direct { path, options };
+    return image.get_origin() == direct.get_origin() &&
+           same_pixels(image, direct) &&
+           image.write_to_memory() == direct.write_to_memory();
+}
+
+/* A loader that never finishes would hang the suite, so it gets a generous
+ * deadline instead.
+ */
+static TGA get_in_time(std::future<TGA>& future)
+{
+    if (future.wait_for(std::chrono::seconds { 60 }) !=
+        std::future_status::ready)
+        fail("a TGALoader made no progress");
+    return future.get();
+}
+
+// Every test image, in input order, through both kinds of I/O.
+static void test_load_many(void)
+{
+    std::vector<std::string> paths = list_assets();
+    for (bool use_mmap : { false, true }) {
+        for (bool keep_origin : { false, true }) {
+            BatchOptions options {};
+            options.load.use_mmap    = use_mmap;
+            options.load.keep_origin = keep_origin;
+            options.io_threads       = 3;
+            options.decode_threads   = 2;
+            std::vector<TGA> images = TGA::load_many(paths, options);
+            bool same = images.size() == paths.size();
+            for (size_t i = 0; same && i < paths.size(); i++)
+                same = loads_like(images[i], paths[i], options.load);
+            check(same, "load_many gives every image in input order");
+        }
+    }
+}
+
+/* Futures belong to the path they were made for, also when a path comes up
+ * more than once and files are submitted one at a time or in batches.
+ */
+static void test_futures(void)
+{
+    std::vector<std::string> assets = list_assets();
+    std::vector<std::string> paths {};
+    for (size_t i = 0; i < 40; i++)
+        paths.push_back(assets[(i * 7) % assets.size()]);
+
+    BatchOptions options {};
+    options.io_threads     = 4;
+    options.decode_threads = 4;
+    TGALoader loader { options };
+    std::future<TGA> first = loader.load(paths[0]);
+    std::vector<std::future<TGA>> futures = loader.load_many(paths);
+    std::string      padded = paths[1] + ".bak"; // a view of a part of it
+    std::future<TGA> last   = loader.load(std::string_view { padded }
+                                          .substr(0, paths[1].size()));
+
+    TGA image = get_in_time(first);
+    check(loads_like(image, paths[0], options.load),
+          "a single load gives its image");
+    bool same = futures.size() == paths.size();
+    for (size_t i = 0; same && i < paths.size(); i++) {
+        image = get_in_time(futures[i]);
+        same  = loads_like(image, paths[i], options.load);
+    }
+    check(same, "every future gives the image of its path");
+    image = get_in_time(last);
+    check(loads_like(image, paths[1], options.load),
+          "a load after a batch gives its image");
+}
+
+/* Files larger than the whole budget are loaded one at a time, rather than
+ * not at all, and smaller files still get in next to each other.
+ */
+static void test_budget(void)
+{
+    std::vector<std::string> paths = list_assets();
+    for (size_t budget : { size_t { 1 }, size_t { 100 } << 10 }) {
+        for (bool use_mmap : { false, true }) {
+            BatchOptions options {};
+            options.load.use_mmap       = use_mmap;
+            options.io_threads          = 4;
+            options.decode_threads      = 2;
+            options.max_bytes_in_flight = budget;
+            TGALoader loader { options };
+            std::vector<std::future<TGA>> futures = loader.load_many(paths);
+            bool same = true;
+            for (size_t i = 0; i < paths.size(); i++) {
+                TGA image = get_in_time(futures[i]);
+                same = same && loads_like(image, paths[i], options.load);
+            }
+            check(same, "files larger than the budget are still loaded");
+        }
+    }
+}
+
+void test_loader(void)
+{
+    test_load_many();
+    test_futures();
+    test_budget();
+}
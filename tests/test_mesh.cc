@@ -0,0 +1,160 @@
+/* Tests of the OBJ parser.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "../src/mesh.hh"
+#include "tests.hh"
+
+static bool same_mesh(const Mesh& a, const Mesh& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z && a.nx == b.nx &&
+           a.ny == b.ny && a.nz == b.nz && a.u == b.u && a.v == b.v &&
+           a.indices == b.indices;
+}
+
+/* A quad, a pentagon and a triangle that share positions, written with
+ * every kind of face corner. Corners that differ in any index become
+ * vertices of their own, in the order they first appear.
+ */
+static void test_faces(void)
+{
+    std::string_view text = "# a quad, a pentagon and a triangle\n"
+                            "v 0 0 0\n"
+                            "v 1 0 0\n"
+                            "v 1 1 0\r\n"
+                            "v +0 1 0   # comment after the values\n"
+                            "v 0.5 1.5 0 1.0\n"
+                            "\n"
+                            "   \t\n"
+                            "vt 0.5\n"
+                            "vt 0.25 0.75 0.0\n"
+                            "vn 0 0 1\n"
+                            "g quad\n"
+                            "usemtl none\n"
+                            "f 1/1/1 2/2/1 3/1/1 4/2/1\n"
+                            "f 1//1 2//1 3//1 4//1 5//1\n"
+                            "\tf -5 -3 -2";
+    Mesh mesh = Mesh::parse_obj(text);
+
+    check(mesh.get_vertex_count() == 12 && mesh.get_triangle_count() == 6,
+          "every distinct face corner is a vertex");
+    check(mesh.indices == std::vector<uint32_t> { 0, 1, 2, 0, 2, 3,
+                                                  4, 5, 6, 4, 6, 7, 4, 7, 8,
+                                                  9, 10, 11 },
+          "polygons are split into fans");
+    check(mesh.x == std::vector<float> { 0, 1, 1, 0, 0, 1, 1, 0, 0.5f,
+                                         0, 1, 0 } &&
+          mesh.y == std::vector<float> { 0, 0, 1, 1, 0, 0, 1, 1, 1.5f,
+                                         0, 1, 1 } &&
+          mesh.z == std::vector<float>(12, 0.0f),
+          "vertices have the positions of their corners");
+    check(mesh.has_uvs() &&
+          mesh.u == std::vector<float> { 0.5f, 0.25f, 0.5f, 0.25f,
+                                         0, 0, 0, 0, 0, 0, 0, 0 } &&
+          mesh.v == std::vector<float> { 0, 0.75f, 0, 0.75f,
+                                         0, 0, 0, 0, 0, 0, 0, 0 },
+          "texture coordinates may have U only, and are 0 where missing");
+    check(mesh.has_normals() &&
+          mesh.nz == std::vector<float> { 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                          0, 0, 0 } &&
+          mesh.nx == std::vector<float>(12, 0.0f) &&
+          mesh.ny == std::vector<float>(12, 0.0f),
+          "normals are 0 where missing");
+
+    Mesh bare = Mesh::parse_obj("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n");
+    check(bare.get_triangle_count() == 1 && !bare.has_uvs() &&
+          !bare.has_normals(), "a mesh without attributes has none");
+}
+
+/* A grid of unit squares, written one row at a time. Faces refer to the
+ * current and the previous row, every other one with negative indices, so
+ * that some of those reach back into the chunk before theirs.
+ */
+static std::string make_grid(size_t n)
+{
+    std::string text {};
+    for (size_t r = 0; r < n; r++) {
+        for (size_t c = 0; c < n; c++) {
+            text += "v " + std::to_string(c) + ' ' + std::to_string(r) +
+                    " 0\n";
+            text += "vt " + std::to_string(c) + ' ' + std::to_string(r) + '\n';
+        }
+        for (size_t c = 0; r > 0 && c + 1 < n; c++) {
+            std::string corners[4];
+            if (c % 2 == 0) {
+                size_t i = (r - 1) * n + c + 1;
+                size_t k[4] = { i, i + 1, i + n + 1, i + n };
+                for (size_t j = 0; j < 4; j++)
+                    corners[j] = std::to_string(k[j]);
+            } else {
+                long long i = -static_cast<long long>(2 * n - c);
+                long long k[4] = { i, i + 1, i + static_cast<long long>(n) + 1,
+                                   i + static_cast<long long>(n) };
+                for (size_t j = 0; j < 4; j++)
+                    corners[j] = std::to_string(k[j]);
+            }
+            text += 'f';
+            for (const std::string& corner : corners)
+                text += ' ' + corner + '/' + corner;
+            text += '\n';
+        }
+    }
+    return text;
+}
+
+// Large files are parsed in chunks, which must not change the result.
+static void test_chunks(void)
+{
+    constexpr size_t N    = 300;
+    std::string      text = make_grid(N);
+    Mesh             mesh = Mesh::parse_obj(text);
+    check(mesh.get_vertex_count() == N * N &&
+          mesh.get_triangle_count() == 2 * (N - 1) * (N - 1),
+          "a grid has a vertex per point and two triangles per square");
+
+    bool halves = true, mapped = true;
+    for (size_t t = 0; t < mesh.get_triangle_count(); t++) {
+        const uint32_t* i = &mesh.indices[t * 3];
+        float area = (mesh.x[i[1]] - mesh.x[i[0]]) *
+                     (mesh.y[i[2]] - mesh.y[i[0]]) -
+                     (mesh.y[i[1]] - mesh.y[i[0]]) *
+                     (mesh.x[i[2]] - mesh.x[i[0]]);
+        halves = halves && area == 1.0f;
+    }
+    for (size_t i = 0; i < mesh.get_vertex_count(); i++)
+        mapped = mapped && mesh.u[i] == mesh.x[i] && mesh.v[i] == mesh.y[i];
+    check(halves, "every triangle is half a square of the grid");
+    check(mapped, "vertices have the texture coordinates of their corners");
+
+    check(same_mesh(Mesh::parse_obj(text, 4), mesh),
+          "meshes are the same on several threads");
+
+    std::string path = temp_path("grid.obj");
+    write_bytes(path, { text.begin(), text.end() });
+    check(same_mesh(Mesh::load_obj(path, 3), mesh),
+          "a loaded file is the same as parsed text");
+    remove(path.c_str());
+}
+
+void test_mesh(void)
+{
+    test_faces();
+    test_chunks();
+}
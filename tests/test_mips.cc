@@ -0,0 +1,128 @@
+/* Tests of mip chains, thumbnails and postage stamps.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../src/tga.hh"
+#include "tests.hh"
+
+/* Whether LEVEL is the rounded 2 by 2 average of SRC. Where SRC is a single
+ * pixel high or wide, the block is clamped to it.
+ */
+static bool is_halved(const TGA& level, const TGA& src)
+{
+    size_t last_r = src.get_height() - 1, last_c = src.get_width() - 1;
+    for (size_t r = 0; r < level.get_height(); r++) {
+        for (size_t c = 0; c < level.get_width(); c++) {
+            size_t r0 = 2 * r, r1 = std::min(2 * r + 1, last_r);
+            size_t c0 = 2 * c, c1 = std::min(2 * c + 1, last_c);
+            Pixel  block[4] = { src.get_pixel(r0, c0), src.get_pixel(r0, c1),
+                                src.get_pixel(r1, c0), src.get_pixel(r1, c1) };
+            auto average = [&](uint8_t Pixel::* channel) {
+                size_t sum = 2;
+                for (const Pixel& p : block) sum += p.*channel;
+                return static_cast<uint8_t>(sum / 4);
+            };
+            Pixel p = level.get_pixel(r, c);
+            if (p.r != average(&Pixel::r) || p.g != average(&Pixel::g) ||
+                p.b != average(&Pixel::b) || p.a != average(&Pixel::a))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void test_mip_chain(void)
+{
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::BGR8,
+                                PixelFormat::Gray8 }) {
+        TGA image = make_test_image(157, 93, format, 11);
+        std::vector<TGA> levels = image.build_mip_chain();
+        check(levels.size() == 7, "157 by 93 pixels have 7 more levels");
+
+        const TGA* src = &image;
+        for (const TGA& level : levels) {
+            size_t w = std::max<size_t>(src->get_width() / 2, 1);
+            size_t h = std::max<size_t>(src->get_height() / 2, 1);
+            check(level.get_width() == w && level.get_height() == h,
+                  "every level halves the one before");
+            check(level.get_pixel_format() == format,
+                  "levels keep the pixel format");
+            check(is_halved(level, *src), "levels average 2 by 2 blocks");
+            src = &level;
+        }
+        check(src->get_width() == 1 && src->get_height() == 1,
+              "the last level is 1 by 1 pixels");
+
+        std::vector<TGA> threaded = image.build_mip_chain(SIZE_MAX, 4);
+        bool same = threaded.size() == levels.size();
+        for (size_t l = 0; same && l < levels.size(); l++)
+            same = same_pixels(levels[l], threaded[l]);
+        check(same, "levels are the same on several threads");
+        check(image.build_mip_chain(2).size() == 2,
+              "the number of levels can be limited");
+    }
+
+    TGA thumbnail = make_test_image(300, 20, PixelFormat::BGRA8, 12)
+                    .make_thumbnail(64);
+    check(thumbnail.get_width() == 37 && thumbnail.get_height() == 2,
+          "a thumbnail is the largest level that fits");
+    TGA small = make_test_image(30, 20, PixelFormat::BGRA8, 12);
+    check(same_pixels(small.make_thumbnail(64), small),
+          "an image that fits is its own thumbnail");
+}
+
+static void test_postage_stamp(void)
+{
+    std::string path = temp_path("stamp.tga");
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::Gray8 }) {
+        TGA image = make_test_image(200, 120, format, 13);
+        image.write_to_file(path);
+        check(!TGA::load_postage_stamp(path),
+              "a file without a stamp has none to load");
+
+        TGA stamp = image.make_thumbnail();
+        image.set_postage_stamp(stamp);
+        for (bool rle : { false, true }) {
+            image.write_to_file(path, { rle, {} });
+            check(TGA::probe(path).postage_stamp_offset != 0,
+                  "the file has a postage stamp");
+            std::optional<TGA> loaded = TGA::load_postage_stamp(path);
+            check(loaded && same_pixels(*loaded, stamp),
+                  "the stamp loads on its own");
+
+            TGA full { path };
+            check(full.get_postage_stamp() &&
+                  same_pixels(*full.get_postage_stamp(), stamp),
+                  "loading the image keeps its stamp");
+            check(same_pixels(full, image), "the stamp leaves the image be");
+        }
+        image.clear_postage_stamp();
+        image.write_to_file(path);
+        check(!TGA::load_postage_stamp(path), "a cleared stamp is gone");
+    }
+    remove(path.c_str());
+}
+
+void test_mips(void)
+{
+    test_mip_chain();
+    test_postage_stamp();
+}
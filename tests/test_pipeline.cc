@@ -0,0 +1,194 @@
+/* Tests of the FRAMEPIPELINE and the BOUNDEDQUEUES between its stages.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/parallel.hh"
+#include "../src/pipeline.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+static constexpr size_t FRAMES = 40;
+
+static std::string get_path(size_t frame)
+{
+    return temp_path("frame_" + std::to_string(frame) + ".tga");
+}
+
+// Render FRAME into TARGET by overwriting all of it, like a renderer would.
+static void render(TGA& target, const TGA& frame)
+{
+    for (size_t r = 0; r < frame.get_height(); r++)
+        for (size_t c = 0; c < frame.get_width(); c++)
+            target.set_pixel(r, c, frame.get_pixel(r, c));
+}
+
+// Whether the files of frames BEGIN to END are those FRAMES are written to.
+static bool were_written(const std::vector<TGA>& frames, size_t begin,
+                         size_t end, const WriteOptions& options)
+{
+    for (size_t i = begin; i < end; i++) {
+        TGA frame { frames[i] };
+        if (read_bytes(get_path(i)) != frame.write_to_memory(options))
+            return false;
+    }
+    return true;
+}
+
+/* Frames go through 2 targets and 2 writers, so rendering waits for writing
+ * and frames finish out of order, and each file still has exactly its
+ * frame. WAIT_IDLE returns only once every submitted frame is written, and
+ * the pipeline goes on as before afterwards.
+ */
+static void test_frames(void)
+{
+    std::vector<TGA> frames {};
+    for (size_t i = 0; i < FRAMES; i++)
+        frames.push_back(make_test_image(67, 45, PixelFormat::BGRA8,
+                                         static_cast<uint32_t>(60 + i)));
+
+    for (bool use_rle : { false, true }) {
+        WriteOptions options { use_rle, Origin::UpperLeft };
+        {
+            FramePipeline pipeline { frames[0], options, 2, 2 };
+            for (size_t i = 0; i < FRAMES / 2; i++) {
+                render(pipeline.begin_frame(), frames[i]);
+                pipeline.submit_frame(get_path(i));
+            }
+            pipeline.wait_idle();
+            check(were_written(frames, 0, FRAMES / 2, options),
+                  "every file has its frame once the pipeline is idle");
+
+            // The frame that was just submitted is the one still written.
+            bool same = true;
+            for (size_t i = FRAMES / 2; i < FRAMES; i++) {
+                render(pipeline.begin_frame(), frames[i]);
+                pipeline.submit_frame(get_path(i));
+                pipeline.wait_idle();
+                same = same && were_written(frames, i, i + 1, options);
+            }
+            pipeline.wait_idle();
+            check(same, "a pipeline goes on after it was idle");
+        }
+
+        // Destroying the pipeline writes the frames that are still queued.
+        {
+            FramePipeline pipeline { frames[0], options, 2, 2 };
+            for (size_t i = 0; i < 5; i++) {
+                render(pipeline.begin_frame(), frames[FRAMES - 1 - i]);
+                pipeline.submit_frame(get_path(i));
+            }
+        }
+        bool same = true;
+        for (size_t i = 0; i < 5; i++) {
+            TGA frame { frames[FRAMES - 1 - i] };
+            same = same &&
+                   read_bytes(get_path(i)) == frame.write_to_memory(options);
+        }
+        check(same, "a pipeline writes all frames before it's destroyed");
+    }
+    for (size_t i = 0; i < FRAMES; i++) remove(get_path(i).c_str());
+}
+
+/* Targets never fill up the queues of a pipeline, so more producers and
+ * consumers than slots go through a queue of their own. Every item arrives
+ * exactly once, and those of one producer in the order they were pushed.
+ */
+static void test_queue(void)
+{
+    constexpr size_t THREADS = 4, ITEMS = 20000;
+    BoundedQueue<size_t> queue { 2 };
+    std::vector<std::vector<size_t>> popped(THREADS);
+    std::vector<std::thread> threads {};
+    for (size_t t = 0; t < THREADS; t++) {
+        threads.emplace_back([&queue, t] {
+            for (size_t i = 1; i <= ITEMS; i++)
+                queue.push(t * ITEMS + i);
+        });
+        threads.emplace_back([&queue, &popped, t] {
+            for (size_t item; (item = queue.pop()) != 0;)
+                popped[t].push_back(item);
+        });
+    }
+    for (size_t t = 0; t < THREADS; t++) threads[2 * t].join();
+    for (size_t t = 0; t < THREADS; t++) queue.push(0);
+    for (size_t t = 0; t < THREADS; t++) threads[2 * t + 1].join();
+
+    std::vector<size_t> count(THREADS * ITEMS + 1);
+    bool ordered = true;
+    for (const std::vector<size_t>& items : popped) {
+        std::vector<size_t> last(THREADS);
+        for (size_t item : items) {
+            size_t producer = (item - 1) / ITEMS;
+            ordered = ordered && item > last[producer];
+            last[producer] = item;
+            count[item]++;
+        }
+    }
+    bool once = count[0] == 0;
+    for (size_t i = 1; i < count.size(); i++) once = once && count[i] == 1;
+    check(once, "every item of a queue is popped exactly once");
+    check(ordered, "items of one producer are popped in order");
+}
+
+// Frames that are begun and submitted out of turn are fatal errors.
+static void test_misuse(void)
+{
+    TGA prototype = make_test_image(8, 8, PixelFormat::BGRA8, 61);
+    std::string path = get_path(0);
+    check(is_fatal([&] {
+        FramePipeline pipeline { prototype };
+        pipeline.begin_frame();
+        pipeline.begin_frame();
+    }), "beginning a frame twice is fatal");
+    check(is_fatal([&] {
+        FramePipeline pipeline { prototype };
+        pipeline.submit_frame(path);
+    }), "submitting a frame that wasn't begun is fatal");
+    check(is_fatal([&] {
+        FramePipeline pipeline { prototype };
+        pipeline.begin_frame();
+        pipeline.wait_idle();
+    }), "waiting with a frame that wasn't submitted is fatal");
+    check(is_fatal([&] {
+        FramePipeline pipeline { prototype };
+        pipeline.finish();
+        pipeline.begin_frame();
+    }), "beginning a frame after finishing is fatal");
+    check(is_fatal([&] { FramePipeline pipeline { prototype, {}, 0, 1 }; }) &&
+          is_fatal([&] { FramePipeline pipeline { prototype, {}, 1, 0 }; }),
+          "a pipeline without targets or writers is fatal");
+    check(!is_fatal([&] {
+        FramePipeline pipeline { prototype, {}, 1, 1 };
+        for (size_t i = 0; i < 3; i++) {
+            pipeline.begin_frame();
+            pipeline.submit_frame(path);
+        }
+        pipeline.wait_idle();
+        pipeline.finish();
+    }), "frames in turn are fine");
+    remove(path.c_str());
+}
+
+void test_pipeline(void)
+{
+    test_queue();
+    test_frames();
+    test_misuse();
+}
@@ -0,0 +1,340 @@
+/* Tests of the rasterizer and the depth buffer.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "../src/depth.hh"
+#include "../src/raster.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+// Lines far apart need more than 64 bits for Bresenham's closed form.
+__extension__ typedef __int128 wide;
+
+static constexpr uint16_t WIDTH  = 300;
+static constexpr uint16_t HEIGHT = 200;
+
+static const Pixel BLACK { 0, 0, 0, 0xff };
+static const Pixel WHITE { 0xff, 0xff, 0xff, 0xff };
+
+static bool is_white(const TGA& image, size_t x, size_t y)
+{
+    return image.get_pixel(y, x).r == 0xff;
+}
+
+// Random coordinates on the subpixel grid, so that snapping doesn't move them.
+static float random_coord(uint32_t& state, float lo, float hi)
+{
+    state = state * 1664525 + 1013904223;
+    float t = static_cast<float>(state >> 8) / static_cast<float>(1 << 24);
+    return std::round((lo + t * (hi - lo)) * 16.0f) / 16.0f;
+}
+
+static int64_t to_fixed(float v)
+{
+    return std::lround(v * 16);
+}
+
+/* On which side of the edge from A to B the point (PX, PY) lies, all in
+ * 1/16 of a pixel. Positive is to the left.
+ */
+static int64_t orient(Point2 a, Point2 b, int64_t px, int64_t py)
+{
+    int64_t ax = to_fixed(a.x), ay = to_fixed(a.y);
+    int64_t bx = to_fixed(b.x), by = to_fixed(b.y);
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+// Like ORIENT, for the center of pixel (X, Y).
+static int64_t edge(Point2 a, Point2 b, size_t x, size_t y)
+{
+    return orient(a, b, static_cast<int64_t>(x) * 16 + 8,
+                  static_cast<int64_t>(y) * 16 + 8);
+}
+
+/* The number of pixels of IMAGE that disagree with the triangle V: those
+ * with centers strictly inside must be drawn and those strictly outside
+ * mustn't. Centers on an edge are up to the fill rule, which the shared edge
+ * test below checks.
+ */
+static size_t count_wrong(const TGA& image, Point2 v[3])
+{
+    int64_t area = orient(v[0], v[1], to_fixed(v[2].x), to_fixed(v[2].y));
+    if (area < 0) std::swap(v[1], v[2]);
+    size_t wrong = 0;
+    for (size_t y = 0; y < image.get_height(); y++) {
+        for (size_t x = 0; x < image.get_width(); x++) {
+            int64_t e0 = edge(v[0], v[1], x, y);
+            int64_t e1 = edge(v[1], v[2], x, y);
+            int64_t e2 = edge(v[2], v[0], x, y);
+            bool inside  = area != 0 && e0 > 0 && e1 > 0 && e2 > 0;
+            bool outside = area == 0 || e0 < 0 || e1 < 0 || e2 < 0;
+            bool drawn   = is_white(image, x, y);
+            if ((inside && !drawn) || (outside && drawn)) wrong++;
+        }
+    }
+    return wrong;
+}
+
+// Random triangles cover the same pixels no matter how many threads draw.
+static void test_triangle_coverage(void)
+{
+    uint32_t state = 17;
+    size_t   wrong = 0;
+    for (size_t i = 0; i < 100; i++) {
+        Point2 v[3];
+        for (Point2& p : v) {
+            p = { random_coord(state, -40.0f, WIDTH + 40.0f),
+                  random_coord(state, -40.0f, HEIGHT + 40.0f) };
+        }
+        std::vector<TGA> images {};
+        for (size_t threads : { size_t { 1 }, size_t { 3 } }) {
+            TGA image { WIDTH, HEIGHT, BLACK };
+            Rasterizer raster { image, threads };
+            raster.draw_triangle(v[0], v[1], v[2], WHITE);
+            raster.flush();
+            images.push_back(std::move(image));
+        }
+        check(same_pixels(images[0], images[1]),
+              "triangles are the same on several threads");
+        wrong += count_wrong(images[0], v);
+    }
+    check(wrong == 0, "triangles cover the pixels inside their edges");
+}
+
+/* Spans are tested many pixels at a time where the edge values fit into 32
+ * bits, and one at a time where they don't. An odd sized target leaves
+ * spans of every length at the tile edges, thin slivers leave partly covered
+ * groups of pixels, and triangles reaching far off screen take the 64 bit
+ * path.
+ */
+static void test_triangle_traversal(void)
+{
+    constexpr uint16_t W = 67, H = 45;
+    uint32_t state = 19;
+    size_t   wrong = 0;
+    for (size_t i = 0; i < 150; i++) {
+        float  far = i % 3 == 0 ? 1e6f : 0.0f;
+        Point2 v[3];
+        v[0] = { random_coord(state, -far, W + far),
+                 random_coord(state, -far, H + far) };
+        v[1] = { random_coord(state, -10.0f, W + 10.0f),
+                 random_coord(state, -10.0f, H + 10.0f) };
+        if (i % 3 == 1) {
+            // A sliver along the edge from V0 to V1, at most a pixel wide.
+            v[2] = { (v[0].x + v[1].x) / 2 + random_coord(state, -1, 1),
+                     (v[0].y + v[1].y) / 2 + random_coord(state, -1, 1) };
+            v[2] = { std::round(v[2].x * 16) / 16,
+                     std::round(v[2].y * 16) / 16 };
+        } else {
+            v[2] = { random_coord(state, -10.0f, W + 10.0f),
+                     random_coord(state, -10.0f, H + 10.0f) };
+        }
+        TGA image { W, H, BLACK };
+        Rasterizer raster { image, 1 };
+        raster.draw_triangle(v[0], v[1], v[2], WHITE);
+        raster.flush();
+        wrong += count_wrong(image, v);
+    }
+    check(wrong == 0, "every traversal covers the pixels inside the edges");
+}
+
+/* The triangles of a fan around a convex polygon share their edges. Every
+ * pixel with its center strictly inside the polygon must be drawn by
+ * exactly one of them, including those on the shared edges.
+ */
+static void test_shared_edges(void)
+{
+    uint32_t state = 23;
+    size_t   overlaps = 0, gaps = 0;
+    for (size_t i = 0; i < 25; i++) {
+        float  cx = random_coord(state, 60.0f, WIDTH - 60.0f);
+        float  cy = random_coord(state, 60.0f, HEIGHT - 60.0f);
+        Point2 center { cx, cy };
+        constexpr size_t SIDES = 7;
+        Point2 ring[SIDES];
+        for (size_t k = 0; k < SIDES; k++) {
+            float angle = static_cast<float>(k) * 6.2831853f / SIDES +
+                          random_coord(state, 0.0f, 0.5f);
+            float r = random_coord(state, 20.0f, 55.0f);
+            ring[k] = { std::round((cx + r * std::cos(angle)) * 16) / 16,
+                        std::round((cy + r * std::sin(angle)) * 16) / 16 };
+        }
+
+        std::vector<uint8_t> count(size_t { WIDTH } * HEIGHT, 0);
+        for (size_t k = 0; k < SIDES; k++) {
+            TGA image { WIDTH, HEIGHT, BLACK };
+            Rasterizer raster { image, 1 };
+            raster.draw_triangle(center, ring[k], ring[(k + 1) % SIDES],
+                                 WHITE);
+            raster.flush();
+            for (size_t y = 0; y < HEIGHT; y++)
+                for (size_t x = 0; x < WIDTH; x++)
+                    count[y * WIDTH + x] += is_white(image, x, y);
+        }
+        for (size_t y = 0; y < HEIGHT; y++) {
+            for (size_t x = 0; x < WIDTH; x++) {
+                bool inside = true;
+                for (size_t k = 0; k < SIDES; k++)
+                    inside &= edge(ring[k], ring[(k + 1) % SIDES], x, y) > 0;
+                overlaps += count[y * WIDTH + x] > 1;
+                gaps     += inside && count[y * WIDTH + x] == 0;
+            }
+        }
+    }
+    check(overlaps == 0, "triangles that share an edge never overlap");
+    check(gaps == 0, "triangles that share an edge leave no gaps");
+}
+
+/* Lines are compared with Bresenham's algorithm in closed form, also for
+ * end points far outside the screen.
+ */
+static void test_lines(void)
+{
+    uint32_t state = 31;
+    size_t   wrong = 0;
+    for (size_t i = 0; i < 150; i++) {
+        float range = i % 3 == 0 ? 2e9f : 400.0f;
+        int32_t p[4];
+        for (int32_t& v : p)
+            v = static_cast<int32_t>(random_coord(state, -range, range));
+        TGA image { WIDTH, HEIGHT, BLACK };
+        Rasterizer raster { image, 3 };
+        raster.draw_line(p[0], p[1], p[2], p[3], WHITE);
+        raster.flush();
+
+        int64_t x0 = p[0], y0 = p[1], x1 = p[2], y1 = p[3];
+        bool    x_major = std::abs(x1 - x0) >= std::abs(y1 - y0);
+        if ((x_major && x1 < x0) || (!x_major && y1 < y0)) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+        int64_t major0 = x_major ? x0 : y0, minor0 = x_major ? y0 : x0;
+        int64_t len    = x_major ? x1 - x0 : y1 - y0;
+        int64_t d      = x_major ? y1 - y0 : x1 - x0;
+        for (size_t y = 0; y < HEIGHT; y++) {
+            for (size_t x = 0; x < WIDTH; x++) {
+                int64_t k = (x_major ? x : y) - major0;
+                int64_t m = (x_major ? y : x) - minor0;
+                bool    on = false;
+                if (k >= 0 && k <= len) {
+                    // The minor offset K * |D| / LEN, rounded half up.
+                    wide    num = 2 * static_cast<wide>(std::abs(d)) * k + len;
+                    int64_t off = len == 0 ? 0
+                                : static_cast<int64_t>(num / (2 * len));
+                    on = m == (d < 0 ? -off : off);
+                }
+                wrong += on != is_white(image, x, y);
+            }
+        }
+    }
+    check(wrong == 0, "lines have the pixels of Bresenham's algorithm");
+}
+
+/* Two overlapping triangles at different depths give the color of the
+ * closer one in either order, and the depth buffer keeps the closer depth
+ * within conservative tile bounds.
+ */
+static void test_depth(void)
+{
+    const Pixel RED { 0xff, 0, 0, 0xff }, BLUE { 0, 0, 0xff, 0xff };
+    for (bool near_first : { false, true }) {
+        TGA         image { WIDTH, HEIGHT, BLACK };
+        DepthBuffer depth { WIDTH, HEIGHT };
+        Rasterizer  raster { image, 3 };
+        raster.set_depth_buffer(&depth);
+
+        // A tilted plane in front, a flat one behind it.
+        auto draw_near = [&] {
+            raster.draw_triangle(Point3 { 10, 10, 0.2f },
+                                 Point3 { 290, 20, 0.4f },
+                                 Point3 { 150, 190, 0.3f }, RED);
+        };
+        auto draw_far = [&] {
+            raster.draw_triangle(Point3 { 0, 0, 0.5f },
+                                 Point3 { 300, 0, 0.5f },
+                                 Point3 { 300, 200, 0.5f }, BLUE);
+        };
+        if (near_first) {
+            draw_near();
+            draw_far();
+        } else {
+            draw_far();
+            draw_near();
+        }
+        raster.flush();
+
+        TGA near_only { WIDTH, HEIGHT, BLACK }, far_only { WIDTH, HEIGHT,
+                                                           BLACK };
+        {
+            Rasterizer only { near_only, 1 };
+            only.draw_triangle(Point2 { 10, 10 }, Point2 { 290, 20 },
+                               Point2 { 150, 190 }, RED);
+            only.flush();
+        }
+        {
+            Rasterizer only { far_only, 1 };
+            only.draw_triangle(Point2 { 0, 0 }, Point2 { 300, 0 },
+                               Point2 { 300, 200 }, BLUE);
+            only.flush();
+        }
+
+        size_t wrong = 0, bad_depth = 0;
+        for (size_t y = 0; y < HEIGHT; y++) {
+            for (size_t x = 0; x < WIDTH; x++) {
+                bool  is_near = near_only.get_pixel(y, x).r == 0xff;
+                bool  is_far  = far_only.get_pixel(y, x).b == 0xff;
+                Pixel want    = is_near ? RED : is_far ? BLUE : BLACK;
+                Pixel got     = image.get_pixel(y, x);
+                wrong += got.r != want.r || got.b != want.b;
+
+                float z     = depth.get_depth(x, y);
+                bool  ok    = is_near ? z < 0.5f : is_far ? z == 0.5f
+                                                          : z == 1.0f;
+                size_t tile = depth.get_tile(x, y);
+                ok &= depth.get_tile_min(tile) <= z &&
+                      z <= depth.get_tile_max(tile);
+                bad_depth += !ok;
+            }
+        }
+        check(wrong == 0, "the closer triangle is visible in either order");
+        check(bad_depth == 0, "the depth buffer holds the closer depths");
+    }
+
+    DepthBuffer depth { 100, 70 };
+    depth.clear(0.25f);
+    bool cleared = true;
+    for (size_t y = 0; y < 70; y++)
+        for (size_t x = 0; x < 100; x++)
+            cleared &= depth.get_depth(x, y) == 0.25f;
+    for (size_t t = 0; t < depth.get_tile_count(); t++)
+        cleared &= depth.get_tile_min(t) == 0.25f &&
+                   depth.get_tile_max(t) == 0.25f;
+    check(cleared, "clearing sets all depths and tile bounds");
+}
+
+void test_raster(void)
+{
+    test_triangle_coverage();
+    test_triangle_traversal();
+    test_shared_edges();
+    test_lines();
+    test_depth();
+}
@@ -0,0 +1,108 @@
+/* Tests of TGA::LOAD_REGION against loading the whole file.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../src/rle.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+// Whether REGION has the pixels at column X and row Y of FULL.
+static bool matches(const TGA& region, const TGA& full, size_t x, size_t y)
+{
+    for (size_t r = 0; r < region.get_height(); r++) {
+        for (size_t c = 0; c < region.get_width(); c++) {
+            Pixel p = region.get_pixel(r, c), q = full.get_pixel(y + r, x + c);
+            if (p.r != q.r || p.g != q.g || p.b != q.b || p.a != q.a)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Load a few regions of the file at PATH, including all of its edges.
+static void check_regions(const std::string& path, std::string_view what)
+{
+    TGA    full { path };
+    size_t w = full.get_width(), h = full.get_height();
+    struct Rect final {
+        size_t x, y, w, h;
+    };
+    for (Rect rect : { Rect { 0, 0, w, h }, Rect { 0, 0, 1, 1 },
+                       Rect { w - 1, h - 1, 1, 1 }, Rect { 0, 5, w, 9 },
+                       Rect { 3, 0, 17, h }, Rect { 70, 40, 33, 21 },
+                       Rect { w - 40, 2, 40, 3 } }) {
+        for (size_t threads : { size_t { 1 }, size_t { 3 } }) {
+            LoadOptions options {};
+            options.threads = threads;
+            TGA region = TGA::load_region(path, rect.x, rect.y, rect.w,
+                                          rect.h, options);
+            check(region.get_width() == rect.w &&
+                  region.get_height() == rect.h &&
+                  matches(region, full, rect.x, rect.y), what);
+        }
+    }
+}
+
+/* RLE files without a usable scan line table: one whose table offset was
+ * cleared, and one in the old format (no footer at all) whose packets run
+ * across scanlines, so rows can't be indexed either.
+ */
+static void check_without_table(TGA& image, const std::string& path)
+{
+    std::vector<uint8_t> file = image.write_to_memory({ true, {} });
+    uint32_t ext_area = 0;
+    memcpy(&ext_area, file.data() + file.size() - 26, sizeof(ext_area));
+    memset(file.data() + ext_area + 490, 0, sizeof(uint32_t));
+    write_bytes(path, file);
+    check(TGA::probe(path).scan_line_tbl_offset == 0,
+          "the scan line table is gone");
+    check_regions(path, "an RLE region without a table matches");
+
+    std::vector<uint8_t> raw = image.write_to_memory({ false, {} });
+    size_t bpp    = image.get_pixel_width();
+    size_t pixels = image.get_width() * image.get_height();
+    size_t offset = 18 + raw[0];
+    std::vector<uint8_t> crossing(offset + rle_max_encoded_len(pixels, bpp));
+    memcpy(crossing.data(), raw.data(), offset);
+    crossing[2] |= 0x8;
+    size_t len = rle_encode_row(raw.data() + offset, pixels,
+                                crossing.data() + offset, bpp);
+    crossing.resize(offset + len);
+    write_bytes(path, crossing);
+    check_regions(path, "an RLE region with packets across rows matches");
+}
+
+void test_region(void)
+{
+    std::string path = temp_path("region.tga");
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::BGR8,
+                                PixelFormat::Gray8 }) {
+        TGA image = make_test_image(131, 77, format, 7);
+        for (Origin origin : { Origin::LowerLeft, Origin::LowerRight,
+                               Origin::UpperLeft, Origin::UpperRight }) {
+            image.write_to_file(path, { false, origin });
+            check_regions(path, "an uncompressed region matches");
+            image.write_to_file(path, { true, origin });
+            check_regions(path, "an RLE region matches");
+        }
+        check_without_table(image, path);
+    }
+    remove(path.c_str());
+}
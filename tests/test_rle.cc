@@ -0,0 +1,167 @@
+/* Tests of RLE encoding and decoding, on single scanlines and whole files.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "../src/rle.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+/* A scanline of PIXELS pixels whose bytes are drawn from the first COLORS
+ * values only. With few colors, there are many short runs, which is the
+ * worst case for one byte pixels.
+ */
+static std::vector<uint8_t> make_row(size_t pixels, size_t bpp,
+                                     uint32_t colors, uint32_t& state)
+{
+    std::vector<uint8_t> row(pixels * bpp);
+    for (size_t i = 0; i < pixels; i++) {
+        state = state * 1664525 + 1013904223;
+        uint8_t v = static_cast<uint8_t>((state >> 16) % colors);
+        for (size_t k = 0; k < bpp; k++)
+            row[i * bpp + k] = static_cast<uint8_t>(v + k);
+    }
+    return row;
+}
+
+// Encode and decode a row in one piece, in chunks and padded to a length.
+static void check_row(const std::vector<uint8_t>& row, size_t bpp)
+{
+    size_t pixels = row.size() / bpp;
+    size_t max_len = rle_max_encoded_len(pixels, bpp);
+    std::vector<uint8_t> encoded(max_len), decoded(row.size());
+    size_t len = rle_encode_row(row.data(), pixels, encoded.data(), bpp);
+    check(len <= max_len, "encoding fits into rle_max_encoded_len");
+
+    size_t used = rle_decode(encoded.data(), len, decoded.data(),
+                             decoded.size(), bpp);
+    check(used == len, "decoding consumes the whole row");
+    check(decoded == row, "decoding gives back the row");
+
+    // Every split of the packets must decode the same.
+    for (size_t chunk : { size_t { 1 }, size_t { 3 }, size_t { 7 } }) {
+        RLEDecoder decoder { bpp };
+        std::fill(decoded.begin(), decoded.end(), 0);
+        size_t in = 0, out = 0;
+        while (in < len && out < decoded.size()) {
+            size_t n        = std::min(chunk, len - in);
+            size_t produced = 0;
+            in  += decoder.decode(encoded.data() + in, n, decoded.data() + out,
+                                  decoded.size() - out, produced);
+            out += produced;
+        }
+        check(in == len && out == row.size() && decoded == row,
+              "decoding in chunks gives back the row");
+    }
+
+    if (len > 0) {
+        size_t err = rle_try_decode(encoded.data(), len - 1, decoded.data(),
+                                    decoded.size(), bpp);
+        check(err == RLE_DECODE_ERROR, "truncated rows are an error");
+    }
+
+    std::vector<uint8_t> scratch(max_len), exact(max_len);
+    for (size_t pad : { size_t { 0 }, size_t { 1 }, size_t { 5 } }) {
+        if (len + pad > max_len) break;
+        bool ok = rle_encode_row_exact(row.data(), pixels, exact.data(),
+                                       len + pad, bpp, scratch.data());
+        if (pad == 0) check(ok, "the shortest length can be encoded exactly");
+        if (!ok) continue;
+        std::fill(decoded.begin(), decoded.end(), 0);
+        used = rle_decode(exact.data(), len + pad, decoded.data(),
+                          decoded.size(), bpp);
+        check(used == len + pad && decoded == row,
+              "an exact encoding decodes the same");
+    }
+}
+
+static void test_rows(void)
+{
+    uint32_t state = 1;
+    for (size_t bpp = 1; bpp <= 4; bpp++) {
+        for (size_t pixels : { 1, 2, 127, 128, 129, 300, 1000 }) {
+            for (uint32_t colors : { 1, 2, 3, 256 })
+                check_row(make_row(pixels, bpp, colors, state), bpp);
+        }
+    }
+}
+
+/* Rows are indexed from their packet headers only, which must find where
+ * each of them starts, but not rows that start where 32 bits can't reach.
+ */
+static void test_indexer(void)
+{
+    uint32_t state = 2;
+    std::vector<uint8_t> data {};
+    std::vector<uint32_t> starts {};
+    for (size_t r = 0; r < 5; r++) {
+        std::vector<uint8_t> row = make_row(100, 3, 3, state);
+        std::vector<uint8_t> encoded(rle_max_encoded_len(100, 3));
+        encoded.resize(rle_encode_row(row.data(), 100, encoded.data(), 3));
+        starts.push_back(1000 + data.size());
+        data.insert(data.end(), encoded.begin(), encoded.end());
+    }
+
+    for (size_t chunk : { size_t { 1 }, size_t { 5 }, data.size() }) {
+        RLERowIndexer indexer { 3, 300, 5 };
+        for (size_t pos = 0; pos < data.size() && !indexer.is_done();
+             pos += chunk)
+            indexer.scan(data.data() + pos, std::min(chunk, data.size() - pos),
+                         1000 + pos);
+        check(indexer.is_indexable() && indexer.get_offsets() == starts,
+              "indexing finds where rows start");
+    }
+
+    RLERowIndexer far { 3, 300, 5 };
+    far.scan(data.data(), data.size(), UINT32_MAX - starts[2] + 1001);
+    check(far.is_done() && !far.is_indexable(),
+          "rows beyond 32 bit offsets can't be indexed");
+}
+
+/* Whole images, with packets that must not cross scanlines, written and read
+ * back in each of the typed formats (4, 3 and 1 bytes per pixel).
+ */
+static void test_images(void)
+{
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::BGR8,
+                                PixelFormat::Gray8 }) {
+        TGA image = make_test_image(301, 67, format, 42);
+        std::vector<uint8_t> file = image.write_to_memory({ true, {} });
+        TGAInfo info = TGA::probe(file);
+        check(info.is_rle, "the file is RLE encoded");
+
+        TGA loaded = TGA::from_memory(file);
+        check(same_pixels(image, loaded), "an RLE file loads the same");
+        check(loaded.get_scan_line_table().size() == loaded.get_height(),
+              "an RLE file that we wrote has a scan line table");
+
+        LoadOptions threads {};
+        threads.threads = 4;
+        TGA banded = TGA::from_memory(file, threads);
+        check(same_pixels(image, banded),
+              "an RLE file loads the same on several threads");
+    }
+}
+
+void test_rle(void)
+{
+    test_rows();
+    test_indexer();
+    test_images();
+}
@@ -0,0 +1,205 @@
+/* Tests of the streaming TGAREADER and TGAWRITER.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../src/rle.hh"
+#include "../src/stream.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+// The rows of IMAGE as a file with ORIGIN stores them, one after the other.
+static std::vector<uint8_t> get_rows(TGA image, Origin origin)
+{
+    image.set_origin(origin);
+    return image.release();
+}
+
+// Whether the rows that SEEK_ROW lands on are those of ROWS, in any order.
+static bool seeks_right(TGAReader& reader, const std::vector<uint8_t>& rows)
+{
+    size_t bytes_width = reader.get_bytes_width(), h = reader.get_height();
+    std::vector<uint8_t> row(bytes_width);
+    for (size_t r : { h - 1, size_t { 0 }, h / 2, size_t { 1 }, h / 2 - 1 }) {
+        reader.seek_row(r);
+        if (reader.get_rows_left() != h - r || !reader.read_row(row.data()) ||
+            memcmp(row.data(), rows.data() + r * bytes_width, bytes_width))
+            return false;
+    }
+    reader.seek_row(h);
+    return !reader.read_row(row.data());
+}
+
+/* Rows written one at a time, or several at once, are read back the same,
+ * and the file loads like any other.
+ */
+static void test_round_trip(void)
+{
+    std::string path = temp_path("stream.tga");
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::BGR8,
+                                PixelFormat::Gray8 }) {
+        TGA image = make_test_image(157, 61, format, 21);
+        for (bool use_rle : { false, true }) {
+            for (Origin origin : { Origin::LowerLeft, Origin::UpperLeft }) {
+                std::vector<uint8_t> rows = get_rows(image, origin);
+                size_t bytes_width = image.get_bytes_width();
+                {
+                    TGAWriter writer { path, 157, 61, format,
+                                       { use_rle, origin } };
+                    check(writer.get_bytes_width() == bytes_width,
+                          "a writer takes rows of the image's width");
+                    writer.write_row(rows.data());
+                    writer.write_rows(rows.data() + bytes_width, 60);
+                }
+                TGA loaded { path };
+                check(same_pixels(loaded, image), "a written file loads");
+                check(TGA::probe(path).is_rle == use_rle &&
+                      loaded.get_scan_line_table().size() ==
+                      (use_rle ? 61 : 0), "a written file has its format");
+
+                TGAReader reader { path };
+                check(reader.get_width() == 157 && reader.get_height() == 61 &&
+                      reader.get_origin() == origin,
+                      "a reader has the size and origin of the file");
+                std::vector<uint8_t> read(rows.size());
+                size_t n = reader.read_rows(read.data(), 20);
+                n += reader.read_rows(read.data() + n * bytes_width, 100);
+                check(n == 61 && read == rows && reader.get_rows_left() == 0,
+                      "a reader yields the rows in file order");
+                check(seeks_right(reader, rows), "a reader seeks to any row");
+                check(reader.get_scan_line_table().size() ==
+                      (use_rle ? 61 : 0),
+                      "seeking uses the file's scan line table");
+            }
+        }
+    }
+    remove(path.c_str());
+}
+
+/* RLE files without a scan line table, with a table that's wrong, and with
+ * packets across rows, which can only be read from the start.
+ */
+static void test_seek(void)
+{
+    std::string path = temp_path("stream.tga");
+    TGA image = make_test_image(131, 50, PixelFormat::BGR8, 22);
+    std::vector<uint8_t> rows = get_rows(image, Origin::LowerLeft);
+    std::vector<uint8_t> file = image.write_to_memory({ true, {} });
+    std::vector<uint32_t> tbl = image.get_scan_line_table();
+    uint32_t ext_area = 0, tbl_offset = 0;
+    memcpy(&ext_area, file.data() + file.size() - 26, sizeof(ext_area));
+    memcpy(&tbl_offset, file.data() + ext_area + 490, sizeof(tbl_offset));
+
+    auto seek_with = [&](std::vector<uint8_t>& bytes, std::string_view what) {
+        write_bytes(path, bytes);
+        TGAReader reader { path };
+        check(seeks_right(reader, rows), what);
+        check(reader.get_scan_line_table() == tbl,
+              "a table that isn't the file's is built from the packets");
+    };
+
+    std::vector<uint8_t> changed = file;
+    memset(changed.data() + ext_area + 490, 0, sizeof(uint32_t));
+    seek_with(changed, "a reader seeks without a scan line table");
+
+    // The row that is seeked to first starts in the middle of a packet.
+    changed = file;
+    uint32_t wrong = tbl[49] + 1;
+    memcpy(changed.data() + tbl_offset + 49 * 4, &wrong, sizeof(wrong));
+    seek_with(changed, "a reader seeks past a row that starts mid-packet");
+
+    // Each row's offset is that of the next one.
+    changed = file;
+    memcpy(changed.data() + tbl_offset, tbl.data() + 1, 49 * 4);
+    seek_with(changed, "a reader seeks past offsets that are off by a row");
+
+    changed = file;
+    wrong = static_cast<uint32_t>(file.size());
+    memcpy(changed.data() + tbl_offset + 25 * 4, &wrong, sizeof(wrong));
+    seek_with(changed, "a reader seeks past offsets beyond the file");
+
+    // An old-format file whose packets run across scanlines.
+    size_t offset = 18, len = rows.size();
+    std::vector<uint8_t> crossing(offset + rle_max_encoded_len(len / 3, 3));
+    memcpy(crossing.data(), file.data(), offset);
+    len = rle_encode_row(rows.data(), len / 3, crossing.data() + offset, 3);
+    crossing.resize(offset + len);
+    write_bytes(path, crossing);
+    TGAReader reader { path };
+    check(seeks_right(reader, rows),
+          "a reader seeks in packets that cross scanlines");
+    check(reader.get_scan_line_table().empty(),
+          "packets that cross scanlines have no table");
+    remove(path.c_str());
+}
+
+/* Every RLE test image reads like it loads, as stored and with color map
+ * indices. The files have packets across scanlines and a table.
+ */
+static void test_assets(void)
+{
+    for (const std::string& path : list_assets()) {
+        if (path.find("_rle_") == std::string::npos) continue;
+        LoadOptions options {};
+        options.keep_origin  = true;
+        options.keep_indexed = true;
+        std::vector<uint8_t> rows = TGA { path, options }.release();
+
+        TGAReader reader { path };
+        std::vector<uint8_t> read(rows.size());
+        check(reader.read_rows(read.data(), reader.get_height()) ==
+              reader.get_height() && read == rows,
+              "a reader yields the same rows as a load");
+        check(seeks_right(reader, rows), "a reader seeks in a test image");
+    }
+}
+
+// A writer that is closed before it got all rows is a fatal error.
+static void test_early_close(void)
+{
+    std::string path = temp_path("stream.tga");
+    std::vector<uint8_t> row(10 * 4);
+    for (bool use_rle : { false, true }) {
+        check(is_fatal([&] {
+            TGAWriter writer { path, 10, 3, PixelFormat::BGRA8,
+                               { use_rle, {} } };
+            writer.write_rows(row.data(), 2);
+        }), "closing a writer early is fatal");
+        check(is_fatal([&] {
+            TGAWriter writer { path, 10, 1, PixelFormat::BGRA8,
+                               { use_rle, {} } };
+            writer.write_rows(row.data(), 1);
+            writer.write_rows(row.data(), 1);
+        }), "writing too many rows is fatal");
+    }
+    check(!is_fatal([&] {
+        TGAWriter writer { path, 10, 1, PixelFormat::BGRA8 };
+        writer.write_row(row.data());
+        writer.close();
+    }), "closing a complete writer is fine");
+    remove(path.c_str());
+}
+
+void test_stream(void)
+{
+    test_round_trip();
+    test_seek();
+    test_assets();
+    test_early_close();
+}
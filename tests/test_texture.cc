@@ -0,0 +1,146 @@
+/* Tests of textures, their block layout and sampling.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdlib>
+#include <vector>
+
+#include "../src/texture.hh"
+#include "../src/tga.hh"
+#include "tests.hh"
+
+static uint32_t pack(const Pixel& p)
+{
+    return p.b | p.g << 8 | p.r << 16 | static_cast<uint32_t>(p.a) << 24;
+}
+
+// Whether every channel of A and B differs by at most TOLERANCE.
+static bool is_close(uint32_t a, uint32_t b, int tolerance)
+{
+    for (size_t shift = 0; shift < 32; shift += 8) {
+        int x = (a >> shift) & 0xff, y = (b >> shift) & 0xff;
+        if (std::abs(x - y) > tolerance) return false;
+    }
+    return true;
+}
+
+// The rounded average of A and B, channel by channel.
+static uint32_t average(uint32_t a, uint32_t b)
+{
+    uint32_t out = 0;
+    for (size_t shift = 0; shift < 32; shift += 8)
+        out |= ((((a >> shift) & 0xff) + ((b >> shift) & 0xff) + 1) / 2)
+               << shift;
+    return out;
+}
+
+/* Texels are stored in 4 by 4 blocks, so sizes that aren't a multiple of 4
+ * have padded blocks at the right and top, which must never be addressed.
+ * Level 0 has the pixels of the image, in any pixel format, and the others
+ * those of its mip chain.
+ */
+static void test_layout(void)
+{
+    struct Size final {
+        uint16_t w, h;
+    };
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::BGR8,
+                                PixelFormat::Gray8 }) {
+        for (Size size : { Size { 1, 1 }, Size { 4, 4 }, Size { 5, 9 },
+                           Size { 37, 23 }, Size { 64, 3 } }) {
+            TGA     image = make_test_image(size.w, size.h, format, 41);
+            Texture texture { image, SIZE_MAX, 2 };
+            std::vector<TGA> mips = image.build_mip_chain();
+            check(texture.get_level_count() == mips.size() + 1,
+                  "a texture has every mip level");
+
+            bool same = true;
+            for (size_t l = 0; l < texture.get_level_count(); l++) {
+                const TGA& src = l == 0 ? image : mips[l - 1];
+                same = same && texture.get_width(l) == src.get_width() &&
+                       texture.get_height(l) == src.get_height();
+                for (size_t y = 0; same && y < src.get_height(); y++)
+                    for (size_t x = 0; same && x < src.get_width(); x++)
+                        same = texture.get_texel(x, y, l) ==
+                               pack(src.get_pixel(y, x));
+            }
+            check(same, "texels of each level are those of its image");
+        }
+    }
+}
+
+/* At texel centers, nearest sampling gives the texel and bilinear sampling
+ * does too, up to the rounding of the weights. Halfway between texels,
+ * bilinear sampling averages them, across the edges as well, and
+ * coordinates outside of [0, 1] wrap around.
+ */
+static void test_sampling(void)
+{
+    TGA     image = make_test_image(37, 23, PixelFormat::BGRA8, 42);
+    Texture texture { image };
+    float   w = 37.0f, h = 23.0f;
+    bool nearest = true, bilinear = true, half = true, wrap = true;
+    for (size_t y = 0; y < 23; y++) {
+        for (size_t x = 0; x < 37; x++) {
+            uint32_t texel = texture.get_texel(x, y);
+            float    u = (static_cast<float>(x) + 0.5f) / w;
+            float    v = (static_cast<float>(y) + 0.5f) / h;
+            nearest  = nearest && texture.sample_nearest(u, v) == texel;
+            bilinear = bilinear &&
+                       is_close(texture.sample_bilinear(u, v), texel, 1);
+            wrap = wrap && texture.sample_nearest(u + 1.0f, v - 2.0f) == texel
+                        && texture.sample_nearest(u - 3.0f, v + 1.0f) == texel;
+
+            // Between this texel and the next one to the right.
+            uint32_t next = texture.get_texel((x + 1) % 37, y);
+            float    uh   = static_cast<float>(x + 1) / w;
+            half = half && is_close(texture.sample_bilinear(uh, v),
+                                    average(texel, next), 1);
+        }
+    }
+    check(nearest, "nearest samples at texel centers are the texels");
+    check(bilinear, "bilinear samples at texel centers are the texels");
+    check(half, "bilinear samples between texels are their average");
+    check(wrap, "coordinates outside of the texture wrap around");
+
+    // Many samples at once are the same as one at a time.
+    uint32_t state = 43;
+    std::vector<float>    us(1000), vs(1000);
+    std::vector<uint32_t> near(1000), linear(1000);
+    for (size_t i = 0; i < 1000; i++) {
+        state = state * 1664525 + 1013904223;
+        us[i] = static_cast<float>(state >> 8) / (1 << 22) - 2.0f;
+        state = state * 1664525 + 1013904223;
+        vs[i] = static_cast<float>(state >> 8) / (1 << 22) - 2.0f;
+    }
+    for (size_t level : { size_t { 0 }, size_t { 2 } }) {
+        texture.sample_nearest(us.data(), vs.data(), near.data(), 1000, level);
+        texture.sample_bilinear(us.data(), vs.data(), linear.data(), 1000,
+                                level);
+        bool same = true;
+        for (size_t i = 0; i < 1000; i++)
+            same = same &&
+                   near[i] == texture.sample_nearest(us[i], vs[i], level) &&
+                   linear[i] == texture.sample_bilinear(us[i], vs[i], level);
+        check(same, "batches of samples are the same as single ones");
+    }
+}
+
+void test_texture(void)
+{
+    test_layout();
+    test_sampling();
+}
@@ -0,0 +1,218 @@
+/* Tests of the vertex stage and the clipping of triangles.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+#include "../src/linalg.hh"
+#include "../src/transform.hh"
+#include "tests.hh"
+
+static constexpr size_t WIDTH  = 200;
+static constexpr size_t HEIGHT = 200;
+
+static bool is_near(float a, float b, float tolerance)
+{
+    return std::fabs(a - b) <= tolerance;
+}
+
+/* A square screen with a 90 degree field of view, so that the view space
+ * point (X, Y, Z) is at (X / -Z, Y / -Z) on the [-1, 1] square.
+ */
+static Mat4f get_projection(void)
+{
+    return perspective(std::numbers::pi_v<float> / 2.0f, 1.0f, 1.0f, 10.0f);
+}
+
+/* Whole batches and what's left of them are transformed like MAT4F does it,
+ * up to rounding, and SIMD lanes exactly like a vertex on its own.
+ */
+static void test_batches(void)
+{
+    Mat4f m = get_projection() *
+              look_at({ 1.0f, 2.0f, 6.0f }, {}, { 0.0f, 1.0f, 0.0f }) *
+              rotation({ 1.0f, 1.0f, 0.0f }, 0.7f);
+    size_t n = 3 * 4096 + 7;
+    uint32_t state = 51;
+    std::vector<float> x(n), y(n), z(n);
+    for (std::vector<float>* v : { &x, &y, &z }) {
+        for (float& f : *v) {
+            state = state * 1664525 + 1013904223;
+            f = static_cast<float>(state >> 8) / (1 << 24) * 6.0f - 3.0f;
+        }
+    }
+
+    VertexStage stage { m, WIDTH, HEIGHT, 4 };
+    TransformedVertices out {}, single {};
+    stage.transform(x.data(), y.data(), z.data(), n, out);
+    check(out.size() == n && out.width == WIDTH && out.height == HEIGHT,
+          "every vertex is transformed");
+
+    bool clip = true, screen = true, outcodes = true, lanes = true;
+    size_t visible = 0;
+    for (size_t i = 0; i < n; i++) {
+        Vec4f c = m * Vec4f { x[i], y[i], z[i], 1.0f };
+        float got[4] = { out.cx[i], out.cy[i], out.cz[i], out.cw[i] };
+        for (size_t k = 0; k < 4; k++)
+            clip = clip &&
+                   is_near(got[k], c[k], 1e-5f * (1.0f + std::fabs(c[k])));
+
+        uint8_t code = 0;
+        for (size_t k = 0; k < 3; k++)
+            code |= (c[k] < -c[3]) << (2 * k) | (c[k] > c[3]) << (2 * k + 1);
+        outcodes = outcodes && out.outcodes[i] == code;
+        if (code == 0) {
+            float sx = (c[0] / c[3] + 1.0f) * WIDTH / 2;
+            float sy = (c[1] / c[3] + 1.0f) * HEIGHT / 2;
+            float sz = (c[2] / c[3] + 1.0f) / 2;
+            screen = screen && is_near(out.sx[i], sx, 1e-3f) &&
+                     is_near(out.sy[i], sy, 1e-3f) &&
+                     is_near(out.sz[i], sz, 1e-5f);
+            visible++;
+        }
+
+        stage.transform(&x[i], &y[i], &z[i], 1, single);
+        lanes = lanes && single.cx[0] == out.cx[i] &&
+                single.cy[0] == out.cy[i] && single.cz[0] == out.cz[i] &&
+                single.cw[0] == out.cw[i] && single.sx[0] == out.sx[i] &&
+                single.sy[0] == out.sy[i] && single.sz[0] == out.sz[i] &&
+                single.outcodes[0] == out.outcodes[i];
+    }
+    check(visible > n / 4 && visible < n, "some vertices are visible");
+    check(clip, "clip coordinates are those of the matrix");
+    check(outcodes, "outcodes are those of the clip coordinates");
+    check(screen, "visible vertices are mapped onto the screen");
+    check(lanes, "vectors of vertices are transformed like single ones");
+}
+
+/* Clip space corners of the view frustum go to the corners of the screen,
+ * and the near and far planes to depths of 0 and 1.
+ */
+static void test_viewport(void)
+{
+    float x[] = { -1.0f, 1.0f, 0.0f, 1.0f, -0.5f };
+    float y[] = { -1.0f, 1.0f, 0.0f, -1.0f, 0.5f };
+    float z[] = { -1.0f, 1.0f, 0.0f, 0.5f, -0.5f };
+    VertexStage stage { Mat4f::identity(), 320, 240 };
+    TransformedVertices out {};
+    stage.transform(x, y, z, 5, out);
+    float sx[] = { 0.0f, 320.0f, 160.0f, 320.0f, 80.0f };
+    float sy[] = { 0.0f, 240.0f, 120.0f, 0.0f, 180.0f };
+    float sz[] = { 0.0f, 1.0f, 0.5f, 0.75f, 0.25f };
+    bool same = true;
+    for (size_t i = 0; i < 5; i++)
+        same = same && out.sx[i] == sx[i] && out.sy[i] == sy[i] &&
+               out.sz[i] == sz[i] && out.outcodes[i] == 0;
+    check(same, "clip space is mapped onto the viewport");
+
+    // At the near and far planes, and at the top and right of the view.
+    float px[] = { 0.0f, 0.0f, 0.0f, 4.0f };
+    float py[] = { 0.0f, 0.0f, 2.0f, 0.0f };
+    float pz[] = { -1.0f, -10.0f, -2.0f, -4.0f };
+    stage = VertexStage { get_projection(), WIDTH, HEIGHT };
+    stage.transform(px, py, pz, 4, out);
+    check(is_near(out.sz[0], 0.0f, 1e-6f) && is_near(out.sz[1], 1.0f, 1e-6f),
+          "the near and far planes have depths of 0 and 1");
+    check(is_near(out.sx[0], WIDTH / 2, 1e-4f) &&
+          is_near(out.sy[0], HEIGHT / 2, 1e-4f) &&
+          is_near(out.sy[2], HEIGHT, 1e-3f) && is_near(out.sx[3], WIDTH, 1e-3f),
+          "the field of view spans the screen");
+}
+
+// The corners of OUT are those of EXPECTED, in the same cyclic order.
+static bool has_corners(const Point3* out, const Point3* expected, size_t n)
+{
+    for (size_t start = 0; start < n; start++) {
+        bool same = true;
+        for (size_t k = 0; same && k < n; k++) {
+            const Point3 &a = out[(start + k) % n], &b = expected[k];
+            same = is_near(a.x, b.x, 1e-3f) && is_near(a.y, b.y, 1e-3f) &&
+                   is_near(a.z, b.z, 1e-5f);
+        }
+        if (same) return true;
+    }
+    return false;
+}
+
+/* A triangle with a corner behind the camera is cut at the near plane, where
+ * the edges to that corner meet it, and none of it is behind the camera.
+ * Triangles that are wholly inside are left be, those that are outside or
+ * face the wrong way are dropped.
+ */
+static void test_clipping(void)
+{
+    // In view space; the first is behind the camera, on the far side of W 0.
+    float x[] = { 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 3.0f, -1.0f, 1.0f };
+    float y[] = { 0.0f, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f };
+    float z[] = { 2.0f, -5.0f, -5.0f, -4.0f, 1.0f, 1.0f, 3.0f, -2.0f };
+    VertexStage stage { get_projection(), WIDTH, HEIGHT };
+    TransformedVertices v {};
+    stage.transform(x, y, z, 8, v);
+    check(v.outcodes[0] & 1 << 4 && v.cw[0] < 0.0f && v.outcodes[1] == 0 &&
+          v.outcodes[2] == 0, "a corner behind the camera is outside");
+
+    Point3 out[MAX_CLIPPED_CORNERS];
+    uint32_t behind[] = { 0, 1, 2 };
+    /* The edges from (0, 0, 2) meet the near plane at Z = -1 three sevenths
+     * of the way to the other corners.
+     */
+    float  cut = 3.0f / 7.0f * 100.0f;
+    Point3 quad[] = { { 100.0f - cut, 100.0f - cut, 0.0f },
+                      { 80.0f, 80.0f, 0.0f }, { 120.0f, 80.0f, 0.0f },
+                      { 100.0f + cut, 100.0f - cut, 0.0f } };
+    float far = 10.0f, near = 1.0f;
+    quad[1].z = quad[2].z = (far + near - 2.0f * far * near / 5.0f) /
+                            (far - near) / 2.0f + 0.5f;
+    size_t n = assemble_triangle(v, behind, Cull::NONE, out);
+    check(n == 4 && has_corners(out, quad, 4),
+          "a triangle is cut at the near plane");
+
+    uint32_t inside[] = { 3, 1, 2 };
+    n = assemble_triangle(v, inside, Cull::NONE, out);
+    Point3 triangle[] = { { v.sx[3], v.sy[3], v.sz[3] },
+                          { v.sx[1], v.sy[1], v.sz[1] },
+                          { v.sx[2], v.sy[2], v.sz[2] } };
+    check(n == 3 && has_corners(out, triangle, 3),
+          "a triangle inside of the view is left be");
+    check(assemble_triangle(v, inside, Cull::BACK, out) == 3 &&
+          assemble_triangle(v, inside, Cull::FRONT, out) == 0,
+          "a triangle is culled by its winding order");
+
+    uint32_t outside[] = { 4, 5, 6 };
+    check(assemble_triangle(v, outside, Cull::NONE, out) == 0,
+          "a triangle behind the camera is dropped");
+
+    // Any corners in front of the camera are on the near plane or beyond.
+    bool in_view = true;
+    for (uint32_t a : { 0, 4, 5, 6 }) {
+        uint32_t corners[] = { a, 1, 7 };
+        n = assemble_triangle(v, corners, Cull::NONE, out);
+        for (size_t k = 0; k < n; k++)
+            in_view = in_view && out[k].z >= -1e-6f && out[k].z <= 1.0f &&
+                      out[k].x >= -1e-3f && out[k].x <= WIDTH + 1e-3f &&
+                      out[k].y >= -1e-3f && out[k].y <= HEIGHT + 1e-3f;
+    }
+    check(in_view, "clipped corners are inside of the view");
+}
+
+void test_transform(void)
+{
+    test_batches();
+    test_viewport();
+    test_clipping();
+}
@@ -0,0 +1,88 @@
+/* Tests of TGA::WRITE_TO_MEMORY against TGA::WRITE_TO_FILE.
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../src/tga.hh"
+#include "tests.hh"
+
+/* Both overloads give the bytes of the file, for raw and RLE data, every
+ * origin and with a postage stamp, which comes after the pixel data.
+ */
+static void test_same_bytes(void)
+{
+    std::string path = temp_path("write.tga");
+    for (PixelFormat format : { PixelFormat::BGRA8, PixelFormat::BGR8,
+                                PixelFormat::Gray8 }) {
+        TGA image = make_test_image(143, 71, format, 31);
+        for (bool stamp : { false, true }) {
+            if (stamp) image.set_postage_stamp(image.make_thumbnail(32));
+            for (bool use_rle : { false, true }) {
+                for (Origin origin : { Origin::LowerLeft, Origin::UpperRight,
+                                       Origin::UpperLeft }) {
+                    WriteOptions options { use_rle, origin };
+                    image.write_to_file(path, options);
+                    std::vector<uint8_t> file = read_bytes(path);
+                    check(image.write_to_memory(options) == file,
+                          "a vector has the bytes of the file");
+
+                    std::vector<uint8_t> out(file.size() + 10, 0xab);
+                    size_t size = image.write_to_memory(out, options);
+                    check(size == file.size() &&
+                          std::equal(file.begin(), file.end(), out.begin()) &&
+                          out.back() == 0xab,
+                          "a span gets the bytes of the file and no more");
+                }
+            }
+        }
+    }
+    remove(path.c_str());
+}
+
+/* A span that is too small gets the size of the file back, and the image
+ * keeps its pixels and origin, so a retry with that size works.
+ */
+static void test_too_small(void)
+{
+    for (bool use_rle : { false, true }) {
+        TGA image = make_test_image(97, 53, PixelFormat::BGRA8, 32);
+        TGA copy { image };
+        WriteOptions options { use_rle, Origin::UpperLeft };
+        std::vector<uint8_t> file = image.write_to_memory(options);
+
+        for (size_t len : { size_t { 0 }, size_t { 18 }, file.size() / 2,
+                            file.size() - 1 }) {
+            std::vector<uint8_t> out(len);
+            check(image.write_to_memory(out, options) == file.size(),
+                  "a span that is too small gets the size of the file");
+            check(same_pixels(image, copy) &&
+                  image.get_origin() == Origin::UpperLeft,
+                  "a span that is too small leaves the image be");
+        }
+        std::vector<uint8_t> out(file.size());
+        check(image.write_to_memory(out, options) == file.size() &&
+              out == file, "a retry with the size of the file works");
+    }
+}
+
+void test_write(void)
+{
+    test_same_bytes();
+    test_too_small();
+}
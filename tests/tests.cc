@@ -15,9 +15,143 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
 #include "../src/common.hh"
+#include "tests.hh"
+
+static size_t failures = 0;
+
+void check(bool ok, std::string_view what, std::source_location loc)
+{
+    if (ok) return;
+    failures++;
+    std::cerr << loc.file_name() << ':' << loc.line() << ": check failed: "
+              << what << '\n';
+}
+
+bool is_fatal(const std::function<void(void)>& f)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stderr);
+        f();
+        _exit(0);
+    }
+    int status = 0;
+    check(pid > 0 && waitpid(pid, &status, 0) == pid,
+          "a fatal error can be tested in a child process");
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+size_t get_failures(void)
+{
+    return failures;
+}
+
+std::string temp_path(std::string_view name)
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    return dir / ("renderer_test_" + std::to_string(getpid()) + '_' +
+                  std::string { name });
+}
+
+std::string asset_path(std::string_view name)
+{
+    return "assets/test_images/" + std::string { name };
+}
+
+std::vector<std::string> list_assets(void)
+{
+    std::vector<std::string> paths {};
+    for (const auto& entry :
+         std::filesystem::directory_iterator { asset_path("") })
+        if (entry.path().extension() == ".tga")
+            paths.push_back(entry.path().string());
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+std::vector<uint8_t> read_bytes(const std::string& path)
+{
+    std::vector<uint8_t> bytes {};
+    FILE* file = fopen(path.c_str(), "rb");
+    check(file != nullptr, "the test file can be opened");
+    if (file == nullptr) return bytes;
+    uint8_t buf[4096];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), file)) > 0;)
+        bytes.insert(bytes.end(), buf, buf + n);
+    fclose(file);
+    return bytes;
+}
+
+void write_bytes(const std::string& path, const std::vector<uint8_t>& bytes)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    check(file != nullptr, "the test file can be created");
+    if (file == nullptr) return;
+    check(fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size(),
+          "the test file can be written");
+    fclose(file);
+}
+
+TGA make_test_image(uint16_t w, uint16_t h, PixelFormat format, uint32_t seed)
+{
+    size_t stride = format == PixelFormat::BGRA8 ? 4
+                  : format == PixelFormat::BGR8  ? 3 : 1;
+    std::vector<uint8_t> bytes(size_t { w } * h * stride);
+    uint32_t state = seed;
+    for (size_t i = 0; i < bytes.size(); i += stride) {
+        // Every other stretch of 16 pixels is a run of the previous pixel.
+        bool run = i >= stride && (i / stride / 16) % 2 == 1;
+        for (size_t k = 0; k < stride; k++) {
+            state = state * 1664525 + 1013904223;
+            bytes[i + k] = run ? bytes[i + k - stride]
+                               : static_cast<uint8_t>(state >> 24);
+        }
+    }
+    return TGA { w, h, format, std::move(bytes) };
+}
+
+bool same_pixels(const TGA& a, const TGA& b)
+{
+    if (a.get_width() != b.get_width() || a.get_height() != b.get_height())
+        return false;
+    for (size_t r = 0; r < a.get_height(); r++) {
+        for (size_t c = 0; c < a.get_width(); c++) {
+            Pixel p = a.get_pixel(r, c), q = b.get_pixel(r, c);
+            if (p.r != q.r || p.g != q.g || p.b != q.b || p.a != q.a)
+                return false;
+        }
+    }
+    return true;
+}
 
 int main(void)
 {
+    test_rle();
+    test_region();
+    test_incremental();
+    test_mips();
+    test_raster();
+    test_mesh();
+    test_load();
+    test_stream();
+    test_write();
+    test_loader();
+    test_texture();
+    test_transform();
+    test_pipeline();
+
+    if (get_failures() > 0) {
+        std::cerr << get_failures() << " checks failed\n";
+        return 1;
+    }
     return 0;
 }
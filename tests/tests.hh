@@ -0,0 +1,82 @@
+/* Helpers shared by all tests of the test suite (see tests.cc).
+ *
+ * renderer Copyright (C) 2021 Daniel Schuette
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _TESTS_HH_
+#define _TESTS_HH_
+
+#include <functional>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/common.hh"
+#include "../src/tga.hh"
+
+/* Errors in the library are fatal (see io.hh), so we can only test what
+ * succeeds. A failed CHECK is reported with its location and WHAT, and the
+ * test goes on, so that a single run shows every failure.
+ */
+void check(bool ok, std::string_view what,
+           std::source_location = std::source_location::current());
+
+/* Whether F is a fatal error, which it can only be in a process of its own.
+ * Its messages are dropped, since they are expected.
+ */
+bool is_fatal(const std::function<void(void)>& f);
+
+// The number of failed checks so far.
+size_t get_failures(void);
+
+// A path for a temporary file called NAME, which the test removes again.
+std::string temp_path(std::string_view name);
+
+/* The path of the test image NAME, and those of all test images, sorted.
+ * Tests run from the root of the project, like the renderer itself.
+ */
+std::string asset_path(std::string_view name);
+std::vector<std::string> list_assets(void);
+
+// The whole file at PATH, or BYTES as the whole file at PATH.
+std::vector<uint8_t> read_bytes(const std::string& path);
+void write_bytes(const std::string& path, const std::vector<uint8_t>& bytes);
+
+/* A W by H image of FORMAT whose pixels are a pseudo-random function of
+ * SEED, with runs of a single color mixed in, so that RLE gets both run and
+ * raw packets to work with.
+ */
+TGA make_test_image(uint16_t w, uint16_t h, PixelFormat, uint32_t seed);
+
+// Whether A and B have the same size and pixels, at lower-left coordinates.
+bool same_pixels(const TGA& a, const TGA& b);
+
+// The tests of each part of the library, run one after the other by MAIN.
+void test_rle(void);
+void test_region(void);
+void test_incremental(void);
+void test_mips(void);
+void test_raster(void);
+void test_mesh(void);
+void test_load(void);
+void test_stream(void);
+void test_write(void);
+void test_loader(void);
+void test_texture(void);
+void test_transform(void);
+void test_pipeline(void);
+
+#endif /* _TESTS_HH_ */